@@ -6,19 +6,117 @@
  * Update:  10 Jun 2016
  *----------------------------------------------------------------------*/
 
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <stdint.h>
 #include <getopt.h> 
+#include <unistd.h>
+#include <pthread.h>
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <sys/un.h>
+#include <netdb.h>
+#include <signal.h>
+#include <time.h>
+#include <sys/resource.h>
+#include <zlib.h>
+#include "acc2tax.h"
 
 /*----------------------------------------------------------------------*
  * Constants
  *----------------------------------------------------------------------*/
-#define MAX_GI 1050000000
-#define MAX_NAMES 5000000
 #define MAX_PATH 10000
 #define MAX_LINE_LENGTH 10000
 #define VERSION "v0.6"
+#define OPT_BUILD_INDEX 1000
+#define OPT_PRECOMPUTE 1001
+#define OPT_SNAPSHOT 1002
+#define OPT_WRITE_SNAPSHOT 1003
+#define OPT_SERVE 1004
+#define OPT_CLIENT 1005
+#define OPT_BUILD_DATABASE 1006
+#define OPT_SORT_MEMORY 1007
+#define OPT_FENCE 1008
+#define OPT_IN_MEMORY 1009
+#define OPT_UPDATE 1010
+#define OPT_RANKS 1011
+#define OPT_LCA 1012
+#define OPT_FORMAT 1013
+#define OPT_STATS 1014
+#define OPT_CACHE 1015
+#define OPT_AUTO 1016
+#define OPT_ASYNC 1017
+#define OPT_BUILD_SHARDS 1018
+#define OPT_BLOOM 1019
+#define OPT_HUGE_PAGES 1020
+#define OPT_NUMA 1021
+#define OPT_INPUT_FORMAT 1022
+#define CHUNK_LINES 4096
+#define CHUNK_FREE 0
+#define CHUNK_FILLED 1
+#define CHUNK_DONE 2
+#define IO_BUFFER_SIZE (1024 * 1024)
+#define MAX_FILTERS 4
+#define MAX_OUTPUT_RANKS 16
+#define FORMAT_LINEAGE 0
+#define FORMAT_TAXID 1
+#define FORMAT_DICT 2
+#define FORMAT_BINARY 3
+#define BINARY_MAGIC "A2TTAX"
+#define BINARY_VERSION 1
+#define MAX_ID_LENGTH 128
+#define INPUT_COLUMNS 0
+#define INPUT_BLAST 1
+#define INPUT_SAM 2
+#define INPUT_PAF 3
+#define MAX_ID_PARTS 8
+#define SAM_UNMAPPED 4
+
+/*----------------------------------------------------------------------*
+ * One input line in batch mode. Offsets are into batch_text.
+ *----------------------------------------------------------------------*/
+typedef struct {
+    size_t line_offset;
+    size_t id_offset;
+} BatchEntry;
+
+/*----------------------------------------------------------------------*
+ * A chunk of input lines passed from the reader to a worker thread and
+ * then, with its formatted output, to the writer thread.
+ *----------------------------------------------------------------------*/
+typedef struct {
+    int state;
+    int n_lines;
+    size_t line_offsets[CHUNK_LINES];
+    char* text;
+    size_t text_size;
+    size_t text_used;
+    char* output;
+    size_t output_size;
+} WorkChunk;
+
+/*----------------------------------------------------------------------*
+ * Counters for --stats. Lookup threads add to them atomically.
+ *----------------------------------------------------------------------*/
+typedef struct {
+    uint64_t lines;
+    uint64_t found;
+    uint64_t missing;
+    uint64_t unknown;
+    uint64_t lookup_ns;
+    uint64_t write_ns;
+} RunStats;
+
+/*----------------------------------------------------------------------*
+ * A stream connected to a zstd process
+ *----------------------------------------------------------------------*/
+typedef struct {
+    FILE* fp;
+    pid_t pid;
+} Filter;
 
 /*----------------------------------------------------------------------*
  * Globals
@@ -32,15 +130,63 @@ int is_accession = 1;
 int is_gi = 0;
 int strip_version = 0;
 int id_column = 1;
-long int memory_required = 0;
+int id_column_given = 0;
+int input_format = INPUT_COLUMNS;
 int keep_columns = 0;
-unsigned int* gi_to_node;
-char** names;
 const char* delim="\t";
-unsigned int* nodes;
-unsigned int max_gi = MAX_GI;
-FILE* acc_fp;
-long int acc_file_size;
+int precompute_lineages = 0;
+char snapshot_filename[MAX_PATH];
+char write_snapshot_filename[MAX_PATH];
+char serve_address[MAX_PATH];
+char client_address[MAX_PATH];
+Acc2TaxDB* db = 0;
+int build_index = 0;
+int build_database = 0;
+int update_database = 0;
+char** build_filenames = 0;
+int build_file_count = 0;
+long int sort_memory = 1024;
+unsigned int fence_interval = 0;
+int in_memory = 0;
+unsigned int lookup_cache_size = 0;
+int output_ranks[MAX_OUTPUT_RANKS];
+int output_rank_count = 0;
+int lca_column = 0;
+int output_format = FORMAT_LINEAGE;
+FILE* dict_fp = 0;
+uint8_t* dict_seen = 0;
+unsigned int dict_seen_size = 0;
+pthread_mutex_t dict_mutex = PTHREAD_MUTEX_INITIALIZER;
+int batch_mode = 0;
+char* batch_text = 0;
+size_t batch_text_size = 0;
+size_t batch_text_used = 0;
+int thread_count = 1;
+WorkChunk* work_chunks;
+int work_chunk_count;
+long int next_fill_sequence = 0;
+long int next_process_sequence = 0;
+int reader_finished = 0;
+pthread_mutex_t work_mutex = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t work_changed = PTHREAD_COND_INITIALIZER;
+int output_fd = 1;
+Filter filters[MAX_FILTERS];
+int filter_count = 0;
+char stats_filename[MAX_PATH];
+int collect_stats = 0;
+RunStats run_stats;
+int auto_mode = 0;
+int async_lookups = 0;
+int build_shards = 0;
+char** shard_keys = 0;
+int shard_key_count = 0;
+unsigned int filter_bits = 0;
+int huge_pages = ACC2TAX_PAGES_DEFAULT;
+int numa_placement = ACC2TAX_NUMA_DEFAULT;
+Acc2TaxOptions backend_options;
+Acc2TaxDB* backends[2][2];
+int backend_failed[2][2];
+pthread_mutex_t backend_mutex = PTHREAD_MUTEX_INITIALIZER;
 
 /*----------------------------------------------------------------------*
  * Function:   usage
@@ -55,19 +201,138 @@ void usage(void)
            "\nOptions:\n" \
            "    [-h | --help]       This help screen.\n" \
            "    [-a | --accession]  Query is accession IDs [default].\n" \
+           "    [-b | --batch]      Sort accession queries and resolve them in one sequential pass of the database.\n" \
            "    [-c | --column]     1-based column number of ID in input file (default 1).\n" \
            "    [-d | --database]   Directory containing NCBI taxonomy files.\n" \
-           "    [-e | --entries]    Max GI entries (default 1050000000).\n" \
+           "    [-e | --entries]    Ignored - the GI table is sized from the data.\n" \
            "    [-g | --gi]         Query is Genbank IDs.\n" \
-           "    [-i | --input]      File of IDs (GI or Accession), one per line.\n" \
+           "    [-i | --input]      File of IDs (GI or Accession), one per line. Use - for stdin.\n" \
+           "                        gzip and zstd compressed files are read directly.\n" \
            "    [-k | --keep]       Copy columns from input to output file, then append taxonomy as new column.\n" \
            "    [-n | --nucleotide] Query IDs are nucleotide [default].\n" \
-           "    [-o | --output]     Filename of output file.\n" \
+           "    [-o | --output]     Filename of output file. Use - for stdout, in which case messages\n" \
+           "                        go to stderr. Filenames ending .gz or .zst are compressed.\n" \
            "    [-p | --protein]    Query IDs are protein.\n" \
-           "    [-s | --strip]      Strip version from input acession IDs (ie. everything after .)" \
+           "    [-s | --strip]      Strip version from input acession IDs (ie. everything after .)\n" \
+           "    [-t | --threads]    Number of lookup threads (default 1).\n" \
+           "    [--auto]            Input mixes GIs and nucleotide and protein accessions. Each ID is\n" \
+           "                        sent to the right GI table or accession file, each opened when\n" \
+           "                        first needed. GIs not in the nucleotide table are tried as protein.\n" \
+           "    [--build-index]     Convert accession file in database directory to binary index and exit.\n" \
+           "    [--build-shards]    Split the binary index into shards by accession range and exit. Give the\n" \
+           "                        comma separated first accession of each shard after the first, eg.\n" \
+           "                        NC_,ND,NZ_,O puts RefSeq NC_ and NZ_ accessions in shards of their own.\n" \
+           "    [--build-database]  Build the sorted accession file and its index from the NCBI\n" \
+           "                        accession2taxid files (gzipped or plain) listed after the options.\n" \
+           "    [--bloom]           When building an index, also write a Bloom filter with this many bits\n" \
+           "                        per accession, so most missing accessions are rejected without a\n" \
+           "                        search. Try 10. Rebuilt indexes keep their filter.\n" \
+           "    [--update]          Apply the delta files listed after the options to the sorted accession\n" \
+           "                        file, and rebuild its index if there is one. Delta lines are accession\n" \
+           "                        file records to add or replace, or -ACC (or - then a tab and ACC)\n" \
+           "                        to remove accession ACC. Lines without an accession are ignored\n" \
+           "                        with a warning.\n" \
+           "    [--sort-memory]     Mb of memory to sort with when building the database (default 1024).\n" \
+           "    [--precompute]      Build lineage strings for all nodes at startup.\n" \
+           "    [--fence]           Without a binary index, keep the key found every this many bytes of\n" \
+           "                        the accession file in memory (and in a .fence file), so each lookup\n" \
+           "                        reads one block of the file. Try 65536.\n" \
+           "    [--ranks]           Instead of the full lineage, output the names at a comma separated\n" \
+           "                        list of ranks as columns, eg. phylum,genus,species. Ranks are domain,\n" \
+           "                        superkingdom, kingdom, phylum, class, order, family, genus, species.\n" \
+           "    [--lca]             Treat consecutive lines with the same value in this column (eg. 1 for\n" \
+           "                        BLAST query IDs) as a group, and output the lowest common ancestor of\n" \
+           "                        the group's IDs (from the column given by -c).\n" \
+           "    [--format]          Output format: lineage [default], taxid (ID and taxid), dict (ID and\n" \
+           "                        taxid, with each taxid's lineage written once to <output>.lineages)\n" \
+           "                        or binary (header, then a 32-bit taxid per input line, 0 if not found).\n" \
+           "    [--in-memory]       Load the binary accession index into a hash table in memory.\n" \
+           "    [--async]           Look up each chunk of input accessions with many index or fenced\n" \
+           "                        file searches in flight at once. Helps when the database isn't\n" \
+           "                        cached in memory, eg. on network storage.\n" \
+           "    [--huge-pages]      Back the GI, node, name and in-memory index tables with transparent\n" \
+           "                        or explicit (reserved, falling back to transparent) huge pages.\n" \
+           "    [--numa]            Interleave these tables across NUMA nodes, or replicate the GI table\n" \
+           "                        on each node (and interleave the rest).\n" \
+           "    [--input-format]    Read the subject (blast, for -outfmt 6), reference (sam) or target (paf)\n" \
+           "                        ID of each line, unless -c is given, taking the accession or GI\n" \
+           "                        out of names like gi|123|ref|NC_000913.3|. SAM headers and\n" \
+           "                        unmapped records are skipped.\n" \
+           "    [--cache]           Remember the results of this many accession lookups, so repeated\n" \
+           "                        IDs (eg. BLAST subjects) skip the search. Try 1000000.\n" \
+           "    [--stats]           Write timings, lookup counts and peak memory use to this file as JSON.\n" \
+           "    [--snapshot]        Load taxonomy (and GI table) from a snapshot file instead of .dmp files.\n" \
+           "    [--write-snapshot]  Load .dmp files, write them to a snapshot file and exit.\n" \
+           "    [--serve]           Load databases once and answer requests on a socket. Address is\n" \
+           "                        a Unix socket path or [host]:port. Each connection sends request\n" \
+           "                        lines, shuts down its write side and reads back the results.\n" \
+           "    [--client]          Send input file to a server at the given address, write results to output file.\n" \
            "\n");
 }
 
+/*----------------------------------------------------------------------*
+ * Function:   parse_shard_keys
+ * Purpose:    Parse the comma separated list of shard first keys
+ * Parameters: list -> list of keys
+ * Returns:    None
+ *----------------------------------------------------------------------*/
+void parse_shard_keys(char* list)
+{
+    char* saveptr;
+    char* key;
+    int n = 1;
+    int i;
+
+    for (i=0; list[i] != 0; i++) {
+        n += list[i] == ',';
+    }
+
+    shard_keys = malloc(n * sizeof(char*));
+    if (!shard_keys) {
+        printf("Error: couldn't allocate memory.\n");
+        exit(1);
+    }
+
+    shard_key_count = 0;
+    key = strtok_r(list, ",", &saveptr);
+    while (key) {
+        shard_keys[shard_key_count++] = key;
+        key = strtok_r(0, ",", &saveptr);
+    }
+
+    if (shard_key_count == 0) {
+        printf("Error: you must give the first accession of at least one shard.\n");
+        exit(1);
+    }
+}
+
+/*----------------------------------------------------------------------*
+ * Function:   parse_ranks
+ * Purpose:    Parse the comma separated list of ranks to output
+ * Parameters: list -> list of ranks
+ * Returns:    None
+ *----------------------------------------------------------------------*/
+void parse_ranks(char* list)
+{
+    char* saveptr;
+    char* rank = strtok_r(list, ",", &saveptr);
+
+    output_rank_count = 0;
+    while (rank) {
+        if (output_rank_count == MAX_OUTPUT_RANKS) {
+            printf("Error: too many ranks - maximum is %d.\n", MAX_OUTPUT_RANKS);
+            exit(1);
+        }
+        output_ranks[output_rank_count] = acc2tax_find_rank(rank);
+        if (output_ranks[output_rank_count] < 0) {
+            printf("Error: unknown rank %s.\n", rank);
+            exit(1);
+        }
+        output_rank_count++;
+        rank = strtok_r(0, ",", &saveptr);
+    }
+}
+
 /*----------------------------------------------------------------------*
  * Function:   parse_command_line
  * Purpose:    Parse command line options
@@ -79,6 +344,7 @@ void parse_command_line(int argc, char* argv[])
 {
     static struct option long_options[] = {
         {"accession", no_argument, NULL, 'a'},
+        {"batch", no_argument, NULL, 'b'},
         {"column", no_argument, NULL, 'c'},
         {"database", required_argument, NULL, 'd'},
         {"entries", required_argument, NULL, 'e'},
@@ -90,6 +356,30 @@ void parse_command_line(int argc, char* argv[])
         {"output", required_argument, NULL, 'o'},
         {"protein", no_argument, NULL, 'p'},
         {"strip", no_argument, NULL, 's'},
+        {"threads", required_argument, NULL, 't'},
+        {"build-index", no_argument, NULL, OPT_BUILD_INDEX},
+        {"precompute", no_argument, NULL, OPT_PRECOMPUTE},
+        {"snapshot", required_argument, NULL, OPT_SNAPSHOT},
+        {"write-snapshot", required_argument, NULL, OPT_WRITE_SNAPSHOT},
+        {"serve", required_argument, NULL, OPT_SERVE},
+        {"client", required_argument, NULL, OPT_CLIENT},
+        {"build-database", no_argument, NULL, OPT_BUILD_DATABASE},
+        {"sort-memory", required_argument, NULL, OPT_SORT_MEMORY},
+        {"fence", required_argument, NULL, OPT_FENCE},
+        {"in-memory", no_argument, NULL, OPT_IN_MEMORY},
+        {"update", no_argument, NULL, OPT_UPDATE},
+        {"ranks", required_argument, NULL, OPT_RANKS},
+        {"lca", required_argument, NULL, OPT_LCA},
+        {"format", required_argument, NULL, OPT_FORMAT},
+        {"stats", required_argument, NULL, OPT_STATS},
+        {"cache", required_argument, NULL, OPT_CACHE},
+        {"auto", no_argument, NULL, OPT_AUTO},
+        {"async", no_argument, NULL, OPT_ASYNC},
+        {"build-shards", required_argument, NULL, OPT_BUILD_SHARDS},
+        {"bloom", required_argument, NULL, OPT_BLOOM},
+        {"huge-pages", required_argument, NULL, OPT_HUGE_PAGES},
+        {"numa", required_argument, NULL, OPT_NUMA},
+        {"input-format", required_argument, NULL, OPT_INPUT_FORMAT},
         {0, 0, 0, 0}
     };
     int opt;
@@ -98,11 +388,17 @@ void parse_command_line(int argc, char* argv[])
     input_filename[0] = 0;
     output_filename[0] = 0;
     database_dir[0] = 0;
+    snapshot_filename[0] = 0;
+    write_snapshot_filename[0] = 0;
+    serve_address[0] = 0;
+    client_address[0] = 0;
+    stats_filename[0] = 0;
     
-    while ((opt = getopt_long(argc, argv, "ac:d:e:ghi:kno:ps", long_options, &longopt_index)) > 0)
+    while ((opt = getopt_long(argc, argv, "abc:d:e:ghi:kno:pst:", long_options, &longopt_index)) > 0)
     {
         switch(opt) {
             case 'h':
+                printf("\nacc2tax %s\n\n", VERSION);
                 usage();
                 exit(0);
                 break;
@@ -110,8 +406,12 @@ void parse_command_line(int argc, char* argv[])
                 is_accession = 1;
                 is_gi = 0;
                 break;
+            case 'b':
+                batch_mode = 1;
+                break;
             case 'c':
                 id_column = atoi(optarg);
+                id_column_given = 1;
                 break;
             case 'g':
                 is_accession = 0;
@@ -142,11 +442,7 @@ void parse_command_line(int argc, char* argv[])
                 strcpy(database_dir, optarg);
                 break;
             case 'e':
-                if (optarg==NULL) {
-                    printf("Error: Option requires an argument.\n");
-                    exit(1);
-                }
-                max_gi=atoi(optarg);
+                printf("Warning: -e is no longer needed, the GI table is sized from the data.\n");
                 break;
             case 'n':
                 is_nucleotide = 1;
@@ -159,9 +455,183 @@ void parse_command_line(int argc, char* argv[])
             case 's':
                 strip_version = 1;
                 break;
+            case 't':
+                thread_count = atoi(optarg);
+                if (thread_count < 1) {
+                    printf("Error: thread count must be at least 1.\n");
+                    exit(1);
+                }
+                break;
+            case OPT_BUILD_INDEX:
+                build_index = 1;
+                break;
+            case OPT_PRECOMPUTE:
+                precompute_lineages = 1;
+                break;
+            case OPT_SNAPSHOT:
+                strcpy(snapshot_filename, optarg);
+                break;
+            case OPT_WRITE_SNAPSHOT:
+                strcpy(write_snapshot_filename, optarg);
+                break;
+            case OPT_SERVE:
+                strcpy(serve_address, optarg);
+                break;
+            case OPT_CLIENT:
+                strcpy(client_address, optarg);
+                break;
+            case OPT_BUILD_DATABASE:
+                build_database = 1;
+                break;
+            case OPT_SORT_MEMORY:
+                sort_memory = atol(optarg);
+                if (sort_memory < 1) {
+                    printf("Error: sort memory must be at least 1 Mb.\n");
+                    exit(1);
+                }
+                break;
+            case OPT_FENCE:
+                fence_interval = strtoul(optarg, NULL, 10);
+                break;
+            case OPT_IN_MEMORY:
+                in_memory = 1;
+                break;
+            case OPT_UPDATE:
+                update_database = 1;
+                break;
+            case OPT_RANKS:
+                parse_ranks(optarg);
+                break;
+            case OPT_FORMAT:
+                if (strcmp(optarg, "lineage") == 0) {
+                    output_format = FORMAT_LINEAGE;
+                } else if (strcmp(optarg, "taxid") == 0) {
+                    output_format = FORMAT_TAXID;
+                } else if (strcmp(optarg, "dict") == 0) {
+                    output_format = FORMAT_DICT;
+                } else if (strcmp(optarg, "binary") == 0) {
+                    output_format = FORMAT_BINARY;
+                } else {
+                    printf("Error: unknown output format %s.\n", optarg);
+                    exit(1);
+                }
+                break;
+            case OPT_ASYNC:
+                async_lookups = 1;
+                break;
+            case OPT_HUGE_PAGES:
+                if (strcmp(optarg, "transparent") == 0) {
+                    huge_pages = ACC2TAX_PAGES_TRANSPARENT;
+                } else if (strcmp(optarg, "explicit") == 0) {
+                    huge_pages = ACC2TAX_PAGES_EXPLICIT;
+                } else {
+                    printf("Error: unknown huge pages option %s.\n", optarg);
+                    exit(1);
+                }
+                break;
+            case OPT_NUMA:
+                if (strcmp(optarg, "interleave") == 0) {
+                    numa_placement = ACC2TAX_NUMA_INTERLEAVE;
+                } else if (strcmp(optarg, "replicate") == 0) {
+                    numa_placement = ACC2TAX_NUMA_REPLICATE;
+                } else {
+                    printf("Error: unknown NUMA placement %s.\n", optarg);
+                    exit(1);
+                }
+                break;
+            case OPT_INPUT_FORMAT:
+                if (strcmp(optarg, "blast") == 0) {
+                    input_format = INPUT_BLAST;
+                } else if (strcmp(optarg, "sam") == 0) {
+                    input_format = INPUT_SAM;
+                } else if (strcmp(optarg, "paf") == 0) {
+                    input_format = INPUT_PAF;
+                } else {
+                    printf("Error: unknown input format %s.\n", optarg);
+                    exit(1);
+                }
+                break;
+            case OPT_BLOOM:
+                filter_bits = atoi(optarg);
+                if ((filter_bits < 1) || (filter_bits > 64)) {
+                    printf("Error: Bloom filter bits per key must be from 1 to 64.\n");
+                    exit(1);
+                }
+                break;
+            case OPT_BUILD_SHARDS:
+                parse_shard_keys(optarg);
+                build_shards = 1;
+                break;
+            case OPT_AUTO:
+                auto_mode = 1;
+                break;
+            case OPT_CACHE:
+                lookup_cache_size = strtoul(optarg, NULL, 10);
+                break;
+            case OPT_STATS:
+                strcpy(stats_filename, optarg);
+                collect_stats = 1;
+                break;
+            case OPT_LCA:
+                lca_column = atoi(optarg);
+                if (lca_column < 1) {
+                    printf("Error: LCA column must be at least 1.\n");
+                    exit(1);
+                }
+                break;
         }
     }
     
+    if (!id_column_given) {
+        // Subject of BLAST -outfmt 6, RNAME of SAM, target name of PAF
+        if (input_format == INPUT_BLAST) {
+            id_column = 2;
+        } else if (input_format == INPUT_SAM) {
+            id_column = 3;
+        } else if (input_format == INPUT_PAF) {
+            id_column = 6;
+        }
+    }
+    if (auto_mode) {
+        is_accession = 1;
+        is_gi = 0;
+        if (batch_mode) {
+            printf("Error: --auto can't be used with --batch.\n");
+            exit(2);
+        }
+    }
+    if ((async_lookups) && ((is_gi) || (auto_mode) || (lca_column > 0))) {
+        printf("Error: --async only applies to accession lookups, without --auto or --lca.\n");
+        exit(2);
+    }
+    if ((database_dir[0] == 0) && (client_address[0] == 0) && ((snapshot_filename[0] == 0) || (is_accession))) {
+        printf("Error: you must specify a database directory.\n");
+        exit(2);
+    }
+    if ((collect_stats) && ((build_database) || (update_database) || (build_index) || (build_shards) || (write_snapshot_filename[0] != 0) || (serve_address[0] != 0) || (client_address[0] != 0))) {
+        printf("Error: --stats only applies when looking up an input file.\n");
+        exit(2);
+    }
+    if ((filter_bits > 0) && (!build_database) && (!update_database) && (!build_index) && (!build_shards)) {
+        printf("Error: --bloom only applies when building an index.\n");
+        exit(2);
+    }
+    if ((build_database) || (update_database)) {
+        build_filenames = argv + optind;
+        build_file_count = argc - optind;
+        if (build_file_count == 0) {
+            printf("Error: you must list the %s files to %s.\n", build_database ? "accession2taxid" : "delta", build_database ? "build from" : "apply");
+            exit(2);
+        }
+        return;
+    }
+    if ((output_format == FORMAT_DICT) && ((serve_address[0] != 0) || (strcmp(output_filename, "-") == 0))) {
+        printf("Error: dict format needs an output file to name the lineage table after.\n");
+        exit(2);
+    }
+    if ((build_index) || (build_shards) || (write_snapshot_filename[0] != 0) || (serve_address[0] != 0)) {
+        return;
+    }
     if (input_filename[0] == 0) {
         printf("Error: you must specify an input filename.\n");
         exit(2);
@@ -170,10 +640,6 @@ void parse_command_line(int argc, char* argv[])
         printf("Error: you must specify an output filename.\n");
         exit(2);
     }
-    if (database_dir[0] == 0) {
-        printf("Error: you must specify a database directory.\n");
-        exit(2);
-    }
 }
 
 /*----------------------------------------------------------------------*
@@ -192,548 +658,1625 @@ void chomp(char* str)
 }
 
 /*----------------------------------------------------------------------*
- * Function:   allocate_memory
- * Purpose:    Allocate memory to store tabkes
- * Parameters: None
+ * Function:   write_lineage_text
+ * Purpose:    Write cached lineage of a node to a file, or the names at
+ *             the ranks chosen with --ranks
+ * Parameters: fp_out -> file to write to
+ *             node = taxid
  * Returns:    None
  *----------------------------------------------------------------------*/
-void allocate_memory(void)
+void write_lineage_text(FILE* fp_out, unsigned int node)
 {
-    if (is_gi) {
-        memory_required+=(max_gi * sizeof(unsigned int));
-        printf("Allocating memory for GI list (%d entries)\n", max_gi);
-        gi_to_node = calloc(max_gi, sizeof(unsigned int));
-        if (!gi_to_node) {
-            printf("Error: couldn't allocate memory.\n");
-            exit(1);
+    size_t length;
+    const char* lineage;
+    int i;
+    
+    if (output_rank_count > 0) {
+        for (i=0; i<output_rank_count; i++) {
+            unsigned int ancestor = acc2tax_rank_ancestor(db, node, output_ranks[i]);
+            
+            if (i > 0) {
+                fputc('\t', fp_out);
+            }
+            if (ancestor) {
+                const char* name = acc2tax_name(db, ancestor);
+                
+                fputs(name ? name : "Unknown", fp_out);
+            }
         }
+        return;
     }
     
-    memory_required+=(MAX_NAMES * sizeof(char*));
-    printf("Allocating memory for names list (%d entries)\n", MAX_NAMES);
-    names = calloc(MAX_NAMES, sizeof(char*));
-    if (!names) {
-        printf("Error: couldn't allocate memory.\n");
-        exit(1);
-    }
-
-    memory_required+=(MAX_NAMES * sizeof(int*));
-    printf("Allocating memory for nodes list (%d entries)\n", MAX_NAMES);
-    nodes = calloc(MAX_NAMES, sizeof(int*));
-    if (!nodes) {
-        printf("Error: couldn't allocate memory.\n");
-        exit(1);
+    lineage = acc2tax_lineage(db, node, &length);
+    if (lineage) {
+        fwrite(lineage, 1, length, fp_out);
+    } else {
+        printf("\nError: node %u out of range\n", node);
+        fputs("Unknown", fp_out);
     }
-
-    printf("Total memory required %ld Mb\n", memory_required / (1024*1025));
 }
 
 /*----------------------------------------------------------------------*
- * Function:   load_gi_node_list
- * Purpose:    Load GI to node list translation file
- * Parameters: filename -> filename of file
+ * Function:   add_dict_entry
+ * Purpose:    Write a node's lineage to the dict format lineage table,
+ *             if it isn't there already
+ * Parameters: node = taxid
  * Returns:    None
  *----------------------------------------------------------------------*/
-void load_gi_to_node_list()
+void add_dict_entry(unsigned int node)
 {
-    char filename[MAX_PATH];
-    char line[1024];
-    FILE* fp;
+    uint8_t bit = 1 << (node & 7);
     
-    if (is_nucleotide) {
-        sprintf(filename, "%s/gi_taxid_nucl.dmp", database_dir);
-    } else {
-        sprintf(filename, "%s/gi_taxid_prot.dmp", database_dir);        
+    if ((node == 0) || (node >= dict_seen_size) || (__atomic_fetch_or(&dict_seen[node >> 3], bit, __ATOMIC_RELAXED) & bit)) {
+        return;
     }
-    printf("Opening database file %s\n", filename);
-    fp = fopen(filename, "r");
-    if (!fp) {
-        printf("Error: can't open %s\n", filename);
-    }    
     
-    while (!feof(fp)) {
-        if (fgets(line, 1024, fp)) {
-            char* gi_str = strtok(line, "\t");
-            char* node_id_str = strtok(0, "\t");
-            
-            if ((!gi_str) || (!node_id_str)) {
-                printf("Error: bad line in GI file\n");
-            } else {
-                unsigned int gi = atoi(gi_str);
-                unsigned int node_id = atoi(node_id_str);
-                
-                if (gi >= max_gi) {
-                    printf("Error: GI out of range - %d\n", gi);
-                    exit(1);
-                } else {
-                    gi_to_node[gi] = node_id;
-                }
-            
-            }
-        
-        }
-    }
-           
-    fclose(fp);
+    pthread_mutex_lock(&dict_mutex);
+    fprintf(dict_fp, "%u\t", node);
+    write_lineage_text(dict_fp, node);
+    fputc('\n', dict_fp);
+    pthread_mutex_unlock(&dict_mutex);
 }
 
 /*----------------------------------------------------------------------*
- * Function:   load_node_list
- * Purpose:    Load the list of nodes and parent nodes
- * Parameters: None
+ * Function:   write_lineage
+ * Purpose:    Write the result for a node in the chosen output format -
+ *             its lineage, or its taxid
+ * Parameters: fp_out -> file to write to
+ *             node = taxid
  * Returns:    None
  *----------------------------------------------------------------------*/
-void load_node_list(void)
+void write_lineage(FILE* fp_out, unsigned int node)
 {
-    char filename[MAX_PATH];
-    char line[1024];
-    FILE* fp;
-    
-    sprintf(filename, "%s/nodes.dmp", database_dir);
-    printf("Opening database file %s\n", filename);
-    fp = fopen(filename, "r");
-    if (!fp) {
-        printf("Error: can't open %s\n", filename);
-    }
-        
-    while (!feof(fp)) {
-        if (fgets(line, 1024, fp)) {
-            char* child_str = strtok(line, "\t");
-            char* ignore = strtok(0, "\t");
-            char* parent_str = strtok(0, "\t");
-            
-            if ((!child_str) || (!parent_str)) {
-                printf("Error: bad line in nodes file\n");
-            } else {
-                unsigned int child = atoi(child_str);
-                unsigned int parent = atoi(parent_str);                
-                nodes[child] = parent;
-            }
+    if (output_format == FORMAT_LINEAGE) {
+        write_lineage_text(fp_out, node);
+    } else {
+        fprintf(fp_out, "%u", node);
+        if (output_format == FORMAT_DICT) {
+            add_dict_entry(node);
         }
     }
-    
-    fclose(fp);
 }
 
 /*----------------------------------------------------------------------*
- * Function:   get_name_fields
- * Purpose:    Get name fields from an entry in the name file. Can't use
- *             simple strtok because sometimes fields are missing.
- * Parameters: None
+ * Function:   write_binary_taxid
+ * Purpose:    Write one row of binary format output
+ * Parameters: fp_out -> file to write to
+ *             taxid = taxid, or 0 if not found
  * Returns:    None
  *----------------------------------------------------------------------*/
-void get_name_fields(char* string, char* id, char* name, char* unique_name, char* class)
+void write_binary_taxid(FILE* fp_out, unsigned int taxid)
 {
-    char fields[16][128];
-    int field = 0;
-    int p = 0;
-    char* s = string;
+    uint32_t value = taxid;
     
-    // Separate fields
-    fields[0][0] = 0;    
-    while (*s != 0) {
-        if (*s == '\t') {
-            fields[field][p] = 0;
-            field++;
-            p = 0;
-            fields[field][p] = 0;
-        } else {
-            fields[field][p++] = *s;
-        }
-        s++;
-    }
-    fields[field][p] = 0;
-
-    // Return values
-    strcpy(id, fields[0]);
-    strcpy(name, fields[2]);
-    strcpy(unique_name, fields[4]);
-    strcpy(class, fields[6]);
+    fwrite(&value, sizeof(uint32_t), 1, fp_out);
 }
 
 /*----------------------------------------------------------------------*
- * Function:   load_name_list
- * Purpose:    Load the name list - converts between node IDs and names
- * Parameters: filename -> filename of name list
+ * Function:   write_binary_header
+ * Purpose:    Start binary format output - 8 bytes of magic, then 32-bit
+ *             format version and taxid width in bytes, all native endian
+ * Parameters: fp_out -> file to write to
  * Returns:    None
  *----------------------------------------------------------------------*/
-void load_name_list(void)
+void write_binary_header(FILE* fp_out)
 {
-    char filename[MAX_PATH];
-    char line[1024];
-    FILE* fp;
-    
-    sprintf(filename, "%s/names.dmp", database_dir);
-    printf("Opening database file %s\n", filename);
-    fp = fopen(filename, "r");    
-    if (!fp) {
-        printf("Error: can't open %s\n", filename);
-    }
+    char magic[8] = BINARY_MAGIC;
+    uint32_t fields[2] = {BINARY_VERSION, sizeof(uint32_t)};
     
-    while (!feof(fp)) {
-        if (fgets(line, 1024, fp)) {
-            char id_str[128];
-            char name[128];
-            char unique_name[128];
-            char class[128];
-            
-            get_name_fields(line, id_str, name, unique_name, class);
-            
-            unsigned int id = atoi(id_str);
-            
-            if (id > MAX_NAMES) {
-                printf("Error: id (%d) is greater than maximum currently allowed (%d)\n", id, MAX_NAMES);
-                exit(1);
-            }
+    fwrite(magic, 1, sizeof(magic), fp_out);
+    fwrite(fields, sizeof(uint32_t), 2, fp_out);
+}
 
-            if (strcmp(class, "scientific name") == 0) {
-                memory_required += (strlen(name)+1);
-                names[id] = malloc(strlen(name)+1);
-                if (!names[id]) {
-                    printf("Error: can't allocate memory for name\n");
-                } else {
-                    strcpy(names[id], name);
-                }
-            }
+/*----------------------------------------------------------------------*
+ * Function:   find_column
+ * Purpose:    Find a column of a line without copying it. As with strtok,
+ *             a run of delimiters separates two columns.
+ * Parameters: line -> line string
+ *             column = 1-based column number
+ *             length -> to store length of column (0 if there isn't one)
+ * Returns:    Pointer to start of column within line
+ *----------------------------------------------------------------------*/
+const char* find_column(const char* line, int column, size_t* length)
+{
+    const char* start = line;
+    int c;
+    
+    for (c=1; ; c++) {
+        start += strspn(start, delim);
+        *length = strcspn(start, delim);
+        if ((*length == 0) || (c == column)) {
+            return start;
         }
+        start += *length;
     }
-    
-    fclose(fp);
 }
 
 /*----------------------------------------------------------------------*
- * Function:   get_taxonomy_by_gi
- * Purpose:    Given a GI, return taxonomy string
- * Parameters: None
+ * Function:   copy_field
+ * Purpose:    Copy part of a line into a string, truncating if needed
+ * Parameters: field -> string to copy into
+ *             size = size of field
+ *             start -> start of part
+ *             length = length of part
  * Returns:    None
  *----------------------------------------------------------------------*/
-char* get_taxonomy_from_node(int current_node, char* taxonomy)
+void copy_field(char* field, size_t size, const char* start, size_t length)
 {
-    int node_list[1024];
-    int n = 0;
-    int i;
-
-    taxonomy[0] = 0;
-
-    while (current_node > 1) {
-        node_list[n++] = current_node;
-        current_node = nodes[current_node];
-    }
-    
-    for (i=n-1; i>=0; i--) {
-        if (names[node_list[i]] > 0) {
-            strcat(taxonomy, names[node_list[i]]);
-            if (i > 0) strcat(taxonomy, ",");
-        } else {
-            strcat(taxonomy, "Unknown");
-            if (i > 0) strcat(taxonomy, ",");
-            printf("\nError: no name for node %d\n", node_list[i]);
-        }
+    if (length >= size) {
+        length = size - 1;
     }
+    memcpy(field, start, length);
+    field[length] = 0;
+}
+
+/*----------------------------------------------------------------------*
+ * Function:   get_column_from_line
+ * Purpose:    Find a column of a line
+ * Parameters: line -> line string
+ *             column = 1-based column number
+ *             field -> string to put column into
+ *             size = size of field
+ * Returns:    None
+ *----------------------------------------------------------------------*/
+void get_column_from_line(const char* line, int column, char* field, size_t size) {
+    size_t length;
+    const char* start = find_column(line, column, &length);
     
-    return taxonomy;
+    copy_field(field, size, start, length);
 }
 
 /*----------------------------------------------------------------------*
- * Function:   get_taxonomy_by_gi
- * Purpose:    Given a GI, return taxonomy string
- * Parameters: None
+ * Function:   get_sequence_id
+ * Purpose:    Pick the accession (or GI, with -g) out of an NCBI style
+ *             sequence ID of | separated parts, as used for BLAST
+ *             subjects and SAM/PAF reference names - gi|123|ref|NC_1.1|,
+ *             ref|NC_1.1|, or pdb|1ABC|A for accession 1ABC_A. IDs
+ *             without a | are used as they are.
+ * Parameters: start -> start of ID
+ *             length = length of ID
+ *             id -> string to put accession or GI into
  * Returns:    None
  *----------------------------------------------------------------------*/
-char* get_taxonomy_by_gi(int gi, char* taxonomy)
+void get_sequence_id(const char* start, size_t length, char* id)
 {
-    int e = 0;
-    int current_node;
+    const char* parts[MAX_ID_PARTS] = {NULL};
+    size_t part_lengths[MAX_ID_PARTS] = {0};
+    const char* end = start + length;
+    int n = 0;
+    int pick = 1;
     
-    if ((gi >= max_gi) || (gi < 1)) {
-        printf("\nError: bad GI (%d)\n", gi);
-        e = 1;
+    if (!memchr(start, '|', length)) {
+        copy_field(id, MAX_ID_LENGTH, start, length);
+        return;
     }
     
-    if (e == 0) {
-        current_node = gi_to_node[gi];
+    while ((start <= end) && (n < MAX_ID_PARTS)) {
+        const char* bar = memchr(start, '|', end - start);
         
-        if (current_node == 0) {
-            printf("\nError: GI (%d) node (%d) invalid\n", gi, current_node);
-            e = 2;
+        if (!bar) {
+            bar = end;
         }
+        parts[n] = start;
+        part_lengths[n++] = bar - start;
+        start = bar + 1;
     }
     
-    if (e == 0) {
-        taxonomy = get_taxonomy_from_node(current_node, taxonomy);
+    if ((part_lengths[0] == 2) && (strncmp(parts[0], "gi", 2) == 0)) {
+        // The accession follows the GI and the database tag
+        if ((!is_gi) && (n > 3) && (part_lengths[3] > 0)) {
+            pick = 3;
+        }
+    } else if ((part_lengths[0] == 3) && (strncmp(parts[0], "pdb", 3) == 0) && (n > 2) && (part_lengths[2] > 0)) {
+        size_t chain = part_lengths[1] + 1 + part_lengths[2] < MAX_ID_LENGTH ? part_lengths[2] : 0;
+        
+        copy_field(id, MAX_ID_LENGTH, parts[1], part_lengths[1]);
+        if (chain > 0) {
+            strcat(id, "_");
+            strncat(id, parts[2], chain);
+        }
+        return;
     }
     
-    return taxonomy;
+    if ((n > pick) && (part_lengths[pick] > 0)) {
+        copy_field(id, MAX_ID_LENGTH, parts[pick], part_lengths[pick]);
+    } else {
+        copy_field(id, MAX_ID_LENGTH, parts[0], part_lengths[0]);
+    }
 }
 
 /*----------------------------------------------------------------------*
  * Function:   get_id_from_line
- * Purpose:    Find ID from correct column of line
+ * Purpose:    Find ID from correct column of line. For BLAST, SAM and
+ *             PAF input, the subject or reference name is decoded, and
+ *             unmapped SAM records have no ID.
  * Parameters: line -> line string
-*              id -> string to put ID into
+ *             id -> string of MAX_ID_LENGTH to put ID into
  * Returns:    None
  *----------------------------------------------------------------------*/
-void get_id_from_line(char* line, char* id) {
-    char line_copy[MAX_LINE_LENGTH];
-    char* token;
-    int c = 1;
+void get_id_from_line(const char* line, char* id) {
+    size_t length;
+    const char* start = find_column(line, id_column, &length);
     
     id[0] = 0;
-    strcpy(line_copy, line);
+    if (length == 0) {
+        return;
+    }
     
-    if (strtok(line_copy, delim) == 0) {
-        if (id_column == 1) {
-            strcpy(id, line);
-        }
-    } else {
-        if (c == id_column) {
-            strcpy(id, line);
-        }
-        c++;
+    if (input_format == INPUT_COLUMNS) {
+        copy_field(id, MAX_ID_LENGTH, start, length);
+        return;
+    }
+    
+    if (input_format == INPUT_SAM) {
+        size_t flag_length;
+        const char* flag = find_column(line, 2, &flag_length);
         
-        while (c <= id_column) {
-            token = strtok(0, delim);
-            if (token == 0) {
-                break;
-            } else if (c == id_column) {
-                strcpy(id, token);
-            }
-            c++;
+        if (((length == 1) && (*start == '*')) || ((flag_length > 0) && (strtol(flag, NULL, 10) & SAM_UNMAPPED))) {
+            return;
         }
     }
+    
+    get_sequence_id(start, length, id);
 }
 
 /*----------------------------------------------------------------------*
- * Function:
- * Purpose:
- * Parameters:
- * Returns:
+ * Function:   read_request_line
+ * Purpose:    Read the next line of a request file, without its newline,
+ *             skipping SAM header lines
+ * Parameters: line -> buffer of MAX_LINE_LENGTH for line
+ *             fp_in -> file to read
+ * Returns:    1 if a line was read, 0 at end of file
  *----------------------------------------------------------------------*/
-void get_closest_record(long int pos, char* line) {
-    char c;
-    char temp[1024];
-    char token[1024];
-    char* this_acc;
-    char* prev_acc;
-    char* next_acc;
-    
-    while (pos >= 0) {
-        fseek(acc_fp, pos, SEEK_SET);
-        pos--;
-        
-        c = fgetc(acc_fp);
-        if (c == '\n') {
-            break;
+int read_request_line(char* line, FILE* fp_in)
+{
+    while (fgets(line, MAX_LINE_LENGTH, fp_in)) {
+        if ((input_format == INPUT_SAM) && (line[0] == '@')) {
+            continue;
         }
+        chomp(line);
+        return 1;
     }
     
-    fgets(line, 1024, acc_fp);
-    
-#ifdef DEBUG
-    printf("Got line: %s\n", line);
-#endif
+    return 0;
 }
 
 /*----------------------------------------------------------------------*
- * Function:
- * Purpose:
- * Parameters:
- * Returns:
+ * Function:   strip_accession_version
+ * Purpose:    Strip version from accession (ie. everything after .)
+ * Parameters: id -> accession to change
+ * Returns:    None
  *----------------------------------------------------------------------*/
-void split_fields(char* line, char** accession, char** version, long int* taxid, long int* gi) {
-    char* taxid_str;
-    char* gi_str;
-    
-    *accession = strtok(line, "\t");
-    *version = strtok(NULL, "\t");
-    taxid_str = strtok(NULL, "\t");
-    gi_str = strtok(NULL, "\t");
+void strip_accession_version(char* id)
+{
+    int i;
     
-    if (taxid_str != NULL) {
-        *taxid = atoi(taxid_str);
-    } else {
-        *taxid = 0;
+    for (i=strlen(id)-1; i>0; i--) {
+        if (id[i] == '.') {
+            id[i] = 0;
+            break;
+        }
     }
-    
-    if (gi_str != NULL) {
-        *gi = atoi(gi_str);
+}
+
+/*----------------------------------------------------------------------*
+ * Function:   write_accession_result
+ * Purpose:    Write output line for an accession query
+ * Parameters: fp_out -> output file
+ *             line -> input line
+ *             id -> accession
+ *             found -> 1 if accession was found
+ *             taxid -> taxid of accession
+ * Returns:    None
+ *----------------------------------------------------------------------*/
+void write_accession_result(FILE* fp_out, char* line, char* id, int found, unsigned int taxid)
+{
+    if (output_format == FORMAT_BINARY) {
+        write_binary_taxid(fp_out, found == 1 ? taxid : 0);
+    } else if (found == 1) {
+        const char* start = keep_columns ? line : id;
+        
+        fwrite(start, 1, strlen(start), fp_out);
+        fputs(delim, fp_out);
+        if ((taxid == 0) && (output_format == FORMAT_LINEAGE)) {
+            fputs("Unknown", fp_out);
+        } else {
+            write_lineage(fp_out, taxid);
+        }
+        fputc('\n', fp_out);
     } else {
-        *gi = 0;
+        printf("\nCouldn't find: [%s]\n", id);
     }
-    
-#ifdef DEBUG
-    printf("Accession: %s\n", *accession);
-    printf("Version: %s\n", *version);
-    printf("Tax ID: %ld\n", *taxid);
-    printf("GI: %ld\n", *gi);
-#endif
 }
 
 /*----------------------------------------------------------------------*
- * Function:
- * Purpose:
- * Parameters:
- * Returns:
+ * Function:   get_backend
+ * Purpose:    Return the database handle for one kind of ID, opening it
+ *             on first use with the taxonomy of the main handle
+ * Parameters: protein = 1 for protein IDs
+ *             gi = 1 for GIs, 0 for accessions
+ * Returns:    Database handle, or NULL if it couldn't be opened
  *----------------------------------------------------------------------*/
-int find_accession(char* search_accession, char* line, char** accession, char** version, long int* taxid, long int* gi) {
-    long int min = 0;
-    long int max = acc_file_size;
-    int similarity;
-    int found = 0;
+Acc2TaxDB* get_backend(int protein, int gi)
+{
+    Acc2TaxDB* backend = __atomic_load_n(&backends[protein][gi], __ATOMIC_ACQUIRE);
     
-#ifdef DEBUG
-    printf("Finding %s\n", search_accession);
-#endif
+    if ((backend) || (__atomic_load_n(&backend_failed[protein][gi], __ATOMIC_ACQUIRE))) {
+        return backend;
+    }
     
-    while (found == 0) {
-        long int current_pos = min + ((max-min) / 2);
-#ifdef DEBUG
-        printf("Min: %d Max: %d\n", min, max);
-#endif
-        get_closest_record(current_pos, line);
-        split_fields(line, accession, version, taxid, gi);
-        
-        similarity = strcmp(*accession, search_accession);
-        if (similarity == 0) {
-            found = 1;
-        } else if (similarity > 0) {
-            max = current_pos;
-        } else if (similarity < 0) {
-            min = current_pos;
-        }
+    pthread_mutex_lock(&backend_mutex);
+    backend = backends[protein][gi];
+    if ((!backend) && (!backend_failed[protein][gi])) {
+        Acc2TaxOptions options = backend_options;
         
-        if (labs(max - min) < 20) {
-            break;
+        printf("\nOpening %s %s database\n", protein ? "protein" : "nucleotide", gi ? "GI" : "accession");
+        options.protein = protein;
+        options.load_gi = gi;
+        options.load_accessions = !gi;
+        backend = acc2tax_open_shared(db, &options);
+        if (backend) {
+            __atomic_store_n(&backends[protein][gi], backend, __ATOMIC_RELEASE);
+        } else {
+            printf("Warning: couldn't open the %s %s database, so those IDs won't be found\n", protein ? "protein" : "nucleotide", gi ? "GI" : "accession");
+            __atomic_store_n(&backend_failed[protein][gi], 1, __ATOMIC_RELEASE);
         }
     }
+    pthread_mutex_unlock(&backend_mutex);
     
-    return found;
+    return backend;
 }
 
 /*----------------------------------------------------------------------*
- * Function:   process_request_file
- * Purpose:    Find taxonomy for a file of GIs
- * Parameters: filename -> name of file containing one GI per line
- * Returns:    None
+ * Function:   is_protein_accession
+ * Purpose:    Classify an accession by its prefix, following the NCBI
+ *             formats. RefSeq protein prefixes (AP_, NP_, WP_, XP_, YP_,
+ *             ZP_) have P second, GenBank protein accessions are three
+ *             letters then five or seven digits, and PDB IDs are a digit,
+ *             three characters, an underscore and a chain.
+ * Parameters: id -> accession
+ * Returns:    1 for a protein accession, 0 for nucleotide
  *----------------------------------------------------------------------*/
-void process_request_file()
+int is_protein_accession(const char* id)
 {
-    FILE *fp_in;
-    FILE *fp_out;
-    char buffer[1024];
-    char *accession;
-    char *version;
-    char line[MAX_LINE_LENGTH];
-    char id[128];
-    char t[1024];
-    int count = 0;
-    long int taxid;
-    long int gi;
-    int found;
-
-    fp_in = fopen(input_filename, "r");
-    if (!fp_in) {
-        printf("Error: can't open %s\n", input_filename);
+    int letters = 0;
+    int digits = 0;
+    
+    if ((id[0] >= 'A') && (id[0] <= 'Z') && (id[1] >= 'A') && (id[1] <= 'Z') && (id[2] == '_')) {
+        return id[1] == 'P';
+    }
+    
+    if ((id[0] >= '0') && (id[0] <= '9') && (strlen(id) > 5) && (id[4] == '_')) {
+        return 1;
+    }
+    
+    while ((id[letters] >= 'A') && (id[letters] <= 'Z')) {
+        letters++;
+    }
+    while ((id[letters + digits] >= '0') && (id[letters + digits] <= '9')) {
+        digits++;
+    }
+    
+    return (letters == 3) && ((digits == 5) || (digits == 7));
+}
+
+/*----------------------------------------------------------------------*
+ * Function:   lookup_auto
+ * Purpose:    Find taxid for an ID of any kind. All digits is a GI, which
+ *             could be in either GI table; anything else is an accession
+ *             classified by prefix.
+ * Parameters: id -> GI or accession
+ *             taxid -> to store taxid
+ * Returns:    1 if found, 0 otherwise
+ *----------------------------------------------------------------------*/
+int lookup_auto(char* id, unsigned int* taxid)
+{
+    Acc2TaxDB* backend;
+    
+    if (strspn(id, "0123456789") == strlen(id)) {
+        unsigned int gi = strtoul(id, NULL, 10);
+        int protein;
+        
+        for (protein=0; (gi > 0) && (protein<2); protein++) {
+            backend = get_backend(protein, 1);
+            if ((backend) && (acc2tax_lookup_gi(backend, gi, taxid))) {
+                return 1;
+            }
+        }
+        *taxid = 0;
+        return 0;
+    }
+    
+    if (strip_version) {
+        strip_accession_version(id);
+    }
+    
+    backend = get_backend(is_protein_accession(id), 0);
+    if (!backend) {
+        *taxid = 0;
+        return 0;
+    }
+    
+    return acc2tax_lookup_accession(backend, id, taxid);
+}
+
+/*----------------------------------------------------------------------*
+ * Function:   lookup_id
+ * Purpose:    Find taxid for a GI or accession
+ * Parameters: id -> GI or accession, version stripped if requested
+ *             taxid -> to store taxid
+ * Returns:    1 if found, 0 otherwise
+ *----------------------------------------------------------------------*/
+int lookup_id(char* id, unsigned int* taxid)
+{
+    if (auto_mode) {
+        return lookup_auto(id, taxid);
+    }
+    
+    if (is_gi) {
+        unsigned int gi = strtoul(id, NULL, 10);
+        
+        return (gi > 0) && (acc2tax_lookup_gi(db, gi, taxid));
+    }
+    
+    if (strip_version) {
+        strip_accession_version(id);
+    }
+    
+    return acc2tax_lookup_accession(db, id, taxid);
+}
+
+/*----------------------------------------------------------------------*
+ * Function:   get_nanoseconds
+ * Purpose:    Read the monotonic clock
+ * Parameters: None
+ * Returns:    Time in nanoseconds
+ *----------------------------------------------------------------------*/
+uint64_t get_nanoseconds(void)
+{
+    struct timespec ts;
+    
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    
+    return ((uint64_t)ts.tv_sec * 1000000000) + ts.tv_nsec;
+}
+
+/*----------------------------------------------------------------------*
+ * Function:   add_time
+ * Purpose:    Add time since start to a --stats timer
+ * Parameters: timer -> timer in run_stats
+ *             start = start time in nanoseconds
+ * Returns:    Current time in nanoseconds
+ *----------------------------------------------------------------------*/
+uint64_t add_time(uint64_t* timer, uint64_t start)
+{
+    uint64_t now = get_nanoseconds();
+    
+    __atomic_add_fetch(timer, now - start, __ATOMIC_RELAXED);
+    
+    return now;
+}
+
+/*----------------------------------------------------------------------*
+ * Function:   count_result
+ * Purpose:    Count a line for --stats
+ * Parameters: has_id = 1 if an ID was found in the line
+ *             found = 1 if the ID was found in the database
+ *             taxid = taxid of ID
+ * Returns:    None
+ *----------------------------------------------------------------------*/
+void count_result(int has_id, int found, unsigned int taxid)
+{
+    __atomic_add_fetch(&run_stats.lines, 1, __ATOMIC_RELAXED);
+    if (!has_id) {
+        return;
+    }
+    if (!found) {
+        __atomic_add_fetch(&run_stats.missing, 1, __ATOMIC_RELAXED);
+    } else if ((taxid == 0) || (acc2tax_parent(db, taxid) == 0)) {
+        __atomic_add_fetch(&run_stats.unknown, 1, __ATOMIC_RELAXED);
+    } else {
+        __atomic_add_fetch(&run_stats.found, 1, __ATOMIC_RELAXED);
+    }
+}
+
+/*----------------------------------------------------------------------*
+ * Function:   write_request_result
+ * Purpose:    Write output for one line of the request file
+ * Parameters: fp_out -> file to write result to
+ *             line -> input line
+ *             id -> ID from line, or empty if there wasn't one
+ *             found = 1 if ID was found
+ *             taxid = taxid of ID
+ * Returns:    None
+ *----------------------------------------------------------------------*/
+void write_request_result(FILE* fp_out, char* line, char* id, int found, unsigned int taxid)
+{
+    if (output_format == FORMAT_BINARY) {
+        // Every line gets a row, so rows match input lines
+        write_binary_taxid(fp_out, found ? taxid : 0);
+    } else if (id[0] == 0) {
+        // Unmapped SAM records have no reference, which isn't an error
+        if (input_format != INPUT_SAM) {
+            printf("Couldn't get ID!");
+        }
+    } else if (is_gi) {
+        unsigned int gi = strtoul(id, NULL, 10);
+        
+        if (gi < 1) {
+            printf("Error: bad GI (%s) in request file\n", id);
+        } else {
+            fprintf(fp_out, "%u\t", gi);
+            if (found) {
+                write_lineage(fp_out, taxid);
+            } else {
+                printf("\nError: GI (%u) node (%u) invalid\n", gi, taxid);
+            }
+            fputc('\n', fp_out);
+        }
+    } else if (is_accession) {
+        write_accession_result(fp_out, line, id, found, taxid);
+    }
+}
+
+/*----------------------------------------------------------------------*
+ * Function:   process_request_line
+ * Purpose:    Find taxonomy for one line of the request file
+ * Parameters: fp_out -> file to write result to
+ *             line -> input line (without newline)
+ * Returns:    None
+ *----------------------------------------------------------------------*/
+void process_request_line(FILE* fp_out, char* line)
+{
+    char id[MAX_ID_LENGTH];
+    unsigned int taxid = 0;
+    uint64_t start = collect_stats ? get_nanoseconds() : 0;
+    int found = 0;
+    
+    get_id_from_line(line, id);
+    if (id[0] != 0) {
+        found = lookup_id(id, &taxid);
+    }
+    if (collect_stats) {
+        count_result(id[0] != 0, found, taxid);
+        start = add_time(&run_stats.lookup_ns, start);
+    }
+    
+    write_request_result(fp_out, line, id, found, taxid);
+    
+    if (collect_stats) {
+        add_time(&run_stats.write_ns, start);
+    }
+}
+
+/*----------------------------------------------------------------------*
+ * Function:   gz_cookie_read, gz_cookie_write, gz_cookie_close
+ * Purpose:    stdio cookie functions so a zlib stream can be used as a
+ *             FILE*
+ *----------------------------------------------------------------------*/
+ssize_t gz_cookie_read(void* cookie, char* buffer, size_t size)
+{
+    return gzread(cookie, buffer, size);
+}
+
+ssize_t gz_cookie_write(void* cookie, const char* buffer, size_t size)
+{
+    return gzwrite(cookie, buffer, size) == size ? size : -1;
+}
+
+int gz_cookie_close(void* cookie)
+{
+    return gzclose(cookie) == Z_OK ? 0 : EOF;
+}
+
+/*----------------------------------------------------------------------*
+ * Function:   open_gz_stream
+ * Purpose:    Open a gzip stream on a file descriptor as a FILE*. When
+ *             reading, data that isn't gzipped is passed through as is.
+ * Parameters: fd = file descriptor
+ *             mode -> "r" or "w"
+ * Returns:    Stream, or NULL on failure
+ *----------------------------------------------------------------------*/
+FILE* open_gz_stream(int fd, char* mode)
+{
+    cookie_io_functions_t functions = {gz_cookie_read, gz_cookie_write, NULL, gz_cookie_close};
+    gzFile gz = gzdopen(fd, mode[0] == 'r' ? "rb" : "wb");
+    FILE* fp;
+
+    if (!gz) {
+        return NULL;
+    }
+    gzbuffer(gz, IO_BUFFER_SIZE);
+
+    fp = fopencookie(gz, mode, functions);
+    if (!fp) {
+        gzclose(gz);
+    }
+
+    return fp;
+}
+
+/*----------------------------------------------------------------------*
+ * Function:   open_zstd_stream
+ * Purpose:    Run the zstd program as a filter on a file descriptor
+ * Parameters: fd = file descriptor to decompress from or compress to
+ *             mode -> "r" or "w"
+ * Returns:    Stream connected to zstd, or NULL on failure
+ *----------------------------------------------------------------------*/
+FILE* open_zstd_stream(int fd, char* mode)
+{
+    int reading = mode[0] == 'r';
+    int pipe_fds[2];
+    FILE* fp;
+    pid_t pid;
+
+    if ((filter_count == MAX_FILTERS) || (pipe(pipe_fds) != 0)) {
+        return NULL;
+    }
+
+    pid = fork();
+    if (pid < 0) {
+        close(pipe_fds[0]);
+        close(pipe_fds[1]);
+        return NULL;
+    } else if (pid == 0) {
+        dup2(reading ? fd : pipe_fds[0], 0);
+        dup2(reading ? pipe_fds[1] : fd, 1);
+        close(pipe_fds[0]);
+        close(pipe_fds[1]);
+        close(fd);
+        execlp("zstd", "zstd", "-q", reading ? "-dc" : "-c", (char*)NULL);
+        fprintf(stderr, "Error: can't run zstd\n");
+        _exit(127);
+    }
+
+    close(fd);
+    close(reading ? pipe_fds[1] : pipe_fds[0]);
+    fp = fdopen(reading ? pipe_fds[0] : pipe_fds[1], mode);
+    if (fp) {
+        filters[filter_count].fp = fp;
+        filters[filter_count].pid = pid;
+        filter_count++;
+    }
+
+    return fp;
+}
+
+/*----------------------------------------------------------------------*
+ * Function:   has_extension
+ * Purpose:    Check if a filename ends with an extension
+ * Parameters: filename -> filename
+ *             extension -> extension, including the dot
+ * Returns:    1 if it does, 0 otherwise
+ *----------------------------------------------------------------------*/
+int has_extension(char* filename, char* extension)
+{
+    size_t length = strlen(filename);
+    size_t extension_length = strlen(extension);
+
+    return (length > extension_length) && (strcmp(filename + length - extension_length, extension) == 0);
+}
+
+/*----------------------------------------------------------------------*
+ * Function:   open_input_file
+ * Purpose:    Open a request file for reading, or stdin if filename is
+ *             "-". Files are recognised as gzip or zstd compressed from
+ *             their first bytes. Input from a pipe may be gzipped or
+ *             plain.
+ * Parameters: filename -> filename
+ * Returns:    Stream
+ *----------------------------------------------------------------------*/
+FILE* open_input_file(char* filename)
+{
+    unsigned char magic[4];
+    FILE* fp = 0;
+    int fd;
+
+    if (strcmp(filename, "-") == 0) {
+        fd = dup(0);
+    } else {
+        fd = open(filename, O_RDONLY);
+    }
+
+    if (fd >= 0) {
+        ssize_t got = pread(fd, magic, sizeof(magic), 0);
+
+        if (got < 0) {
+            fp = open_gz_stream(fd, "r");
+        } else if ((got == 4) && (magic[0] == 0x28) && (magic[1] == 0xB5) && (magic[2] == 0x2F) && (magic[3] == 0xFD)) {
+            fp = open_zstd_stream(fd, "r");
+        } else if ((got >= 2) && (magic[0] == 0x1F) && (magic[1] == 0x8B)) {
+            fp = open_gz_stream(fd, "r");
+        } else {
+            fp = fdopen(fd, "r");
+        }
+    }
+
+    if (!fp) {
+        printf("Error: can't open %s\n", filename);
         exit(1);
     }
+    setvbuf(fp, NULL, _IOFBF, IO_BUFFER_SIZE);
+
+    return fp;
+}
+
+/*----------------------------------------------------------------------*
+ * Function:   open_output_file
+ * Purpose:    Open a results file for writing, or stdout if filename is
+ *             "-". Filenames ending .gz or .zst are compressed.
+ * Parameters: filename -> filename
+ * Returns:    Stream
+ *----------------------------------------------------------------------*/
+FILE* open_output_file(char* filename)
+{
+    FILE* fp = 0;
+    int fd;
+
+    if (strcmp(filename, "-") == 0) {
+        fd = dup(output_fd);
+    } else {
+        fd = open(filename, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+    }
+
+    if (fd >= 0) {
+        if (has_extension(filename, ".gz")) {
+            fp = open_gz_stream(fd, "w");
+        } else if (has_extension(filename, ".zst")) {
+            fp = open_zstd_stream(fd, "w");
+        } else {
+            fp = fdopen(fd, "w");
+        }
+    }
+
+    if (!fp) {
+        printf("Error: can't open %s\n", filename);
+        exit(1);
+    }
+    setvbuf(fp, NULL, _IOFBF, IO_BUFFER_SIZE);
+
+    return fp;
+}
+
+/*----------------------------------------------------------------------*
+ * Function:   close_file
+ * Purpose:    Close a stream from open_input_file or open_output_file,
+ *             waiting for any compression filter to finish
+ * Parameters: fp -> stream
+ * Returns:    0 on success, EOF on failure
+ *----------------------------------------------------------------------*/
+int close_file(FILE* fp)
+{
+    int result = fclose(fp);
+    int i;
+
+    for (i=0; i<filter_count; i++) {
+        if (filters[i].fp == fp) {
+            int status;
+
+            if ((waitpid(filters[i].pid, &status, 0) < 0) || (!WIFEXITED(status)) || (WEXITSTATUS(status) != 0)) {
+                result = EOF;
+            }
+            filters[i] = filters[--filter_count];
+            break;
+        }
+    }
+
+    return result;
+}
+
+/*----------------------------------------------------------------------*
+ * Function:   close_output_file
+ * Purpose:    Close results file, exiting if any of it wasn't written
+ * Parameters: fp -> stream
+ *             filename -> filename, for error message
+ * Returns:    None
+ *----------------------------------------------------------------------*/
+void close_output_file(FILE* fp, char* filename)
+{
+    if (close_file(fp) != 0) {
+        printf("Error: failed writing %s\n", filename);
+        exit(1);
+    }
+}
+
+/*----------------------------------------------------------------------*
+ * Function:   open_results_file
+ * Purpose:    Open the output file and start output in the chosen format
+ * Parameters: None
+ * Returns:    Output file
+ *----------------------------------------------------------------------*/
+FILE* open_results_file(void)
+{
+    FILE* fp_out = open_output_file(output_filename);
+    
+    if (output_format == FORMAT_BINARY) {
+        write_binary_header(fp_out);
+    } else if (output_format == FORMAT_DICT) {
+        char dict_filename[MAX_PATH + 16];
+        
+        sprintf(dict_filename, "%s.lineages", output_filename);
+        dict_fp = fopen(dict_filename, "w");
+        if (!dict_fp) {
+            printf("Error: can't open %s\n", dict_filename);
+            exit(1);
+        }
+        dict_seen_size = acc2tax_node_count(db);
+        dict_seen = calloc((dict_seen_size / 8) + 1, sizeof(uint8_t));
+        if (!dict_seen) {
+            printf("Error: couldn't allocate memory.\n");
+            exit(1);
+        }
+    }
+    
+    return fp_out;
+}
+
+/*----------------------------------------------------------------------*
+ * Function:   close_results_file
+ * Purpose:    Close the output file, and the dict format lineage table
+ * Parameters: fp_out -> output file
+ * Returns:    None
+ *----------------------------------------------------------------------*/
+void close_results_file(FILE* fp_out)
+{
+    close_output_file(fp_out, output_filename);
+    
+    if (dict_fp) {
+        if ((ferror(dict_fp)) || (fclose(dict_fp) != 0)) {
+            printf("Error: failed writing %s.lineages\n", output_filename);
+            exit(1);
+        }
+        dict_fp = 0;
+        free(dict_seen);
+        dict_seen = 0;
+    }
+}
+
+/*----------------------------------------------------------------------*
+ * Function:   process_request_stream
+ * Purpose:    Find taxonomy for each line read from a stream
+ * Parameters: fp_in -> stream of requests
+ *             fp_out -> stream to write results to
+ *             show_progress = 1 to print a dot every 100 lines
+ * Returns:    Number of lines processed
+ *----------------------------------------------------------------------*/
+int process_request_stream(FILE* fp_in, FILE* fp_out, int show_progress)
+{
+    char line[MAX_LINE_LENGTH];
+    int count = 0;
+    
+    while (!feof(fp_in)) {        
+        if (read_request_line(line, fp_in)) {
+            count++;
+            if ((show_progress) && ((count % 100) == 0)) {
+                printf(".");
+                fflush(stdout);
+            }
+            
+            process_request_line(fp_out, line);
+        }
+    }
+    
+    return count;
+}
+
+/*----------------------------------------------------------------------*
+ * Function:   process_request_file
+ * Purpose:    Find taxonomy for a file of GIs
+ * Parameters: filename -> name of file containing one GI per line
+ * Returns:    None
+ *----------------------------------------------------------------------*/
+void process_request_file()
+{
+    FILE *fp_in;
+    FILE *fp_out;
+    int count = 0;
+
+    fp_in = open_input_file(input_filename);
+    fp_out = open_results_file();
+    
+    count = process_request_stream(fp_in, fp_out, 1);
+    
+    close_results_file(fp_out);
+    close_file(fp_in);
+    
+    printf("\n\nDone. Processed %d IDs.\n", count);
+}
+
+/*----------------------------------------------------------------------*
+ * Function:   write_lca_group
+ * Purpose:    Write output line for a group of hits
+ * Parameters: fp_out -> output file
+ *             key -> group key
+ *             hits = number of hits found
+ *             lca = lowest common ancestor of hits
+ * Returns:    None
+ *----------------------------------------------------------------------*/
+void write_lca_group(FILE* fp_out, char* key, int hits, unsigned int lca)
+{
+    if (output_format == FORMAT_BINARY) {
+        write_binary_taxid(fp_out, lca);
+        return;
+    }
+    if (hits == 0) {
+        printf("\nCouldn't find any hits for: [%s]\n", key);
+        return;
+    }
+    
+    fputs(key, fp_out);
+    fputs(delim, fp_out);
+    if ((lca == 0) && (output_format == FORMAT_LINEAGE)) {
+        fputs("Unknown", fp_out);
+    } else {
+        write_lineage(fp_out, lca);
+    }
+    fputc('\n', fp_out);
+}
+
+/*----------------------------------------------------------------------*
+ * Function:   process_request_file_lca
+ * Purpose:    Find the lowest common ancestor of each group of
+ *             consecutive lines with the same key
+ * Parameters: None
+ * Returns:    None
+ *----------------------------------------------------------------------*/
+void process_request_file_lca(void)
+{
+    char line[MAX_LINE_LENGTH];
+    char key[MAX_LINE_LENGTH];
+    char group_key[MAX_LINE_LENGTH];
+    char id[MAX_LINE_LENGTH];
+    FILE* fp_in;
+    FILE* fp_out;
+    unsigned int lca = 0;
+    int hits = 0;
+    int count = 0;
+    int groups = 0;
+    
+    fp_in = open_input_file(input_filename);
+    fp_out = open_results_file();
+    
+    group_key[0] = 0;
+    while (read_request_line(line, fp_in)) {
+        unsigned int taxid = 0;
+        uint64_t start = collect_stats ? get_nanoseconds() : 0;
+        int found = 0;
+        
+        count++;
+        if ((count % 100) == 0) {
+            printf(".");
+            fflush(stdout);
+        }
+        
+        get_column_from_line(line, lca_column, key, MAX_LINE_LENGTH);
+        if ((groups == 0) || (strcmp(key, group_key) != 0)) {
+            if (groups > 0) {
+                write_lca_group(fp_out, group_key, hits, lca);
+                if (collect_stats) {
+                    start = add_time(&run_stats.write_ns, start);
+                }
+            }
+            strcpy(group_key, key);
+            groups++;
+            hits = 0;
+            lca = 0;
+        }
+        
+        get_id_from_line(line, id);
+        if (id[0] != 0) {
+            found = lookup_id(id, &taxid);
+        }
+        if ((found) && (taxid != 0)) {
+            lca = hits == 0 ? taxid : acc2tax_lca(db, lca, taxid);
+            hits++;
+        }
+        if (collect_stats) {
+            count_result(id[0] != 0, found, taxid);
+            add_time(&run_stats.lookup_ns, start);
+        }
+    }
+    if (groups > 0) {
+        uint64_t start = collect_stats ? get_nanoseconds() : 0;
+        
+        write_lca_group(fp_out, group_key, hits, lca);
+        if (collect_stats) {
+            add_time(&run_stats.write_ns, start);
+        }
+    }
+    
+    close_results_file(fp_out);
+    close_file(fp_in);
+    
+    printf("\n\nDone. Processed %d IDs in %d groups.\n", count, groups);
+}
+
+/*----------------------------------------------------------------------*
+ * Function:   process_chunk_async
+ * Purpose:    Resolve a chunk's accessions together with
+ *             ACC2TAX_BATCH_ASYNC, then write its results
+ * Parameters: fp_out -> file to write results to
+ *             chunk -> chunk of input lines
+ * Returns:    None
+ *----------------------------------------------------------------------*/
+void process_chunk_async(FILE* fp_out, WorkChunk* chunk)
+{
+    char (*ids)[MAX_ID_LENGTH] = malloc(CHUNK_LINES * sizeof(*ids));
+    const char* id_pointers[CHUNK_LINES];
+    unsigned int taxids[CHUNK_LINES];
+    int found[CHUNK_LINES];
+    uint64_t start = collect_stats ? get_nanoseconds() : 0;
+    int i;
+    
+    if (!ids) {
+        printf("Error: couldn't allocate memory.\n");
+        exit(1);
+    }
+    
+    for (i=0; i<chunk->n_lines; i++) {
+        get_id_from_line(chunk->text + chunk->line_offsets[i], ids[i]);
+        if (strip_version) {
+            strip_accession_version(ids[i]);
+        }
+        id_pointers[i] = ids[i];
+    }
+    
+    acc2tax_lookup_accessions(db, id_pointers, chunk->n_lines, taxids, found, ACC2TAX_BATCH_ASYNC);
+    if (collect_stats) {
+        for (i=0; i<chunk->n_lines; i++) {
+            count_result(ids[i][0] != 0, found[i], taxids[i]);
+        }
+        start = add_time(&run_stats.lookup_ns, start);
+    }
+    
+    for (i=0; i<chunk->n_lines; i++) {
+        write_request_result(fp_out, chunk->text + chunk->line_offsets[i], ids[i], found[i], taxids[i]);
+    }
+    if (collect_stats) {
+        add_time(&run_stats.write_ns, start);
+    }
+    
+    free(ids);
+}
+
+/*----------------------------------------------------------------------*
+ * Function:   lookup_worker
+ * Purpose:    Worker thread - takes filled chunks in sequence order,
+ *             resolves each line into the chunk's output buffer
+ * Parameters: arg -> unused
+ * Returns:    NULL
+ *----------------------------------------------------------------------*/
+void* lookup_worker(void* arg)
+{
+    while (1) {
+        WorkChunk* chunk;
+        FILE* fp_chunk;
+        int i;
+        
+        pthread_mutex_lock(&work_mutex);
+        while ((next_process_sequence == next_fill_sequence) && (!reader_finished)) {
+            pthread_cond_wait(&work_changed, &work_mutex);
+        }
+        if (next_process_sequence == next_fill_sequence) {
+            pthread_mutex_unlock(&work_mutex);
+            break;
+        }
+        chunk = &work_chunks[next_process_sequence % work_chunk_count];
+        next_process_sequence++;
+        pthread_mutex_unlock(&work_mutex);
+        
+        fp_chunk = open_memstream(&chunk->output, &chunk->output_size);
+        if (!fp_chunk) {
+            printf("Error: couldn't allocate memory.\n");
+            exit(1);
+        }
+        if (async_lookups) {
+            process_chunk_async(fp_chunk, chunk);
+        } else {
+            for (i=0; i<chunk->n_lines; i++) {
+                process_request_line(fp_chunk, chunk->text + chunk->line_offsets[i]);
+            }
+        }
+        fclose(fp_chunk);
+        
+        pthread_mutex_lock(&work_mutex);
+        chunk->state = CHUNK_DONE;
+        pthread_cond_broadcast(&work_changed);
+        pthread_mutex_unlock(&work_mutex);
+    }
+    
+    return NULL;
+}
+
+/*----------------------------------------------------------------------*
+ * Function:   ordered_writer
+ * Purpose:    Writer thread - writes finished chunks in input order
+ * Parameters: arg -> output file
+ * Returns:    NULL
+ *----------------------------------------------------------------------*/
+void* ordered_writer(void* arg)
+{
+    FILE* fp_out = arg;
+    long int next_write_sequence = 0;
+    uint64_t start;
+    
+    while (1) {
+        WorkChunk* chunk = &work_chunks[next_write_sequence % work_chunk_count];
+        
+        pthread_mutex_lock(&work_mutex);
+        while (!(((next_write_sequence < next_fill_sequence) && (chunk->state == CHUNK_DONE)) ||
+                 ((next_write_sequence == next_fill_sequence) && (reader_finished)))) {
+            pthread_cond_wait(&work_changed, &work_mutex);
+        }
+        if (next_write_sequence == next_fill_sequence) {
+            pthread_mutex_unlock(&work_mutex);
+            break;
+        }
+        pthread_mutex_unlock(&work_mutex);
+        
+        start = collect_stats ? get_nanoseconds() : 0;
+        fwrite(chunk->output, 1, chunk->output_size, fp_out);
+        if (collect_stats) {
+            add_time(&run_stats.write_ns, start);
+        }
+        free(chunk->output);
+        chunk->output = 0;
+        
+        pthread_mutex_lock(&work_mutex);
+        chunk->state = CHUNK_FREE;
+        next_write_sequence++;
+        pthread_cond_broadcast(&work_changed);
+        pthread_mutex_unlock(&work_mutex);
+    }
+    
+    return NULL;
+}
+
+/*----------------------------------------------------------------------*
+ * Function:   process_request_file_threaded
+ * Purpose:    Find taxonomy for a request file using a pool of worker
+ *             threads. This thread reads chunks of lines, workers
+ *             resolve them and a writer thread outputs them in order.
+ * Parameters: None
+ * Returns:    None
+ *----------------------------------------------------------------------*/
+void process_request_file_threaded()
+{
+    FILE *fp_in;
+    FILE *fp_out;
+    char line[MAX_LINE_LENGTH];
+    pthread_t* workers;
+    pthread_t writer;
+    int count = 0;
+    int i;
 
-    fp_out = fopen(output_filename, "w");
-    if (!fp_out) {
-        fclose(fp_in);
-        printf("Error: can't open %s\n", output_filename);
+    fp_in = open_input_file(input_filename);
+    fp_out = open_results_file();
+    
+    printf("Using %d threads\n", thread_count);
+    
+    work_chunk_count = thread_count * 2;
+    work_chunks = calloc(work_chunk_count, sizeof(WorkChunk));
+    workers = calloc(thread_count, sizeof(pthread_t));
+    if ((!work_chunks) || (!workers)) {
+        printf("Error: couldn't allocate memory.\n");
         exit(1);
-    }    
+    }
     
-    while (!feof(fp_in)) {        
-        if (fgets(line, MAX_LINE_LENGTH, fp_in)) {
-            chomp(line);
+    for (i=0; i<thread_count; i++) {
+        pthread_create(&workers[i], NULL, lookup_worker, NULL);
+    }
+    pthread_create(&writer, NULL, ordered_writer, fp_out);
+    
+    while (!feof(fp_in)) {
+        WorkChunk* chunk = &work_chunks[next_fill_sequence % work_chunk_count];
+        
+        pthread_mutex_lock(&work_mutex);
+        while (chunk->state != CHUNK_FREE) {
+            pthread_cond_wait(&work_changed, &work_mutex);
+        }
+        pthread_mutex_unlock(&work_mutex);
+        
+        chunk->n_lines = 0;
+        chunk->text_used = 0;
+        while ((chunk->n_lines < CHUNK_LINES) && (read_request_line(line, fp_in))) {
+            size_t length;
+            
             count++;
             if ((count % 100) == 0) {
                 printf(".");
                 fflush(stdout);
             }
             
-            get_id_from_line(line, id);
-            if (id[0] == 0) {
+            length = strlen(line) + 1;
+            if (chunk->text_used + length > chunk->text_size) {
+                chunk->text_size = (chunk->text_size + length) * 2;
+                chunk->text = realloc(chunk->text, chunk->text_size);
+                if (!chunk->text) {
+                    printf("Error: couldn't allocate memory.\n");
+                    exit(1);
+                }
+            }
+            memcpy(chunk->text + chunk->text_used, line, length);
+            chunk->line_offsets[chunk->n_lines++] = chunk->text_used;
+            chunk->text_used += length;
+        }
+        
+        if (chunk->n_lines > 0) {
+            pthread_mutex_lock(&work_mutex);
+            chunk->state = CHUNK_FILLED;
+            next_fill_sequence++;
+            pthread_cond_broadcast(&work_changed);
+            pthread_mutex_unlock(&work_mutex);
+        }
+    }
+    
+    pthread_mutex_lock(&work_mutex);
+    reader_finished = 1;
+    pthread_cond_broadcast(&work_changed);
+    pthread_mutex_unlock(&work_mutex);
+    
+    for (i=0; i<thread_count; i++) {
+        pthread_join(workers[i], NULL);
+    }
+    pthread_join(writer, NULL);
+    
+    for (i=0; i<work_chunk_count; i++) {
+        free(work_chunks[i].text);
+    }
+    free(work_chunks);
+    free(workers);
+    
+    close_results_file(fp_out);
+    close_file(fp_in);
+    
+    printf("\n\nDone. Processed %d IDs.\n", count);
+}
+
+/*----------------------------------------------------------------------*
+ * Function:   add_batch_text
+ * Purpose:    Append a string to the batch text store
+ * Parameters: string -> string to store
+ * Returns:    Offset of stored string
+ *----------------------------------------------------------------------*/
+size_t add_batch_text(char* string)
+{
+    size_t length = strlen(string) + 1;
+    size_t offset = batch_text_used;
+    
+    if (batch_text_used + length > batch_text_size) {
+        batch_text_size = (batch_text_size + length) * 2;
+        batch_text = realloc(batch_text, batch_text_size);
+        if (!batch_text) {
+            printf("Error: couldn't allocate memory.\n");
+            exit(1);
+        }
+    }
+    
+    memcpy(batch_text + offset, string, length);
+    batch_text_used += length;
+    
+    return offset;
+}
+
+/*----------------------------------------------------------------------*
+ * Function:   process_request_file_batch
+ * Purpose:    Find taxonomy for a file of accessions by sorting the
+ *             queries, resolving them in one sequential pass over the
+ *             database and writing results back in input order. All
+ *             queries are held in memory.
+ * Parameters: None
+ * Returns:    None
+ *----------------------------------------------------------------------*/
+void process_request_file_batch()
+{
+    FILE *fp_in;
+    FILE *fp_out;
+    char line[MAX_LINE_LENGTH];
+    char id[MAX_ID_LENGTH];
+    BatchEntry* entries = 0;
+    const char** ids;
+    unsigned int* taxids;
+    int* found;
+    long int entries_size = 0;
+    long int n = 0;
+    long int i;
+    uint64_t start;
+    int count = 0;
+
+    fp_in = open_input_file(input_filename);
+    fp_out = open_results_file();
+    
+    printf("Reading queries\n");
+    while (read_request_line(line, fp_in)) {
+        count++;
+        
+        get_id_from_line(line, id);
+        if ((id[0] == 0) && (output_format != FORMAT_BINARY)) {
+            if (input_format != INPUT_SAM) {
                 printf("Couldn't get ID!");
-            } else {
-                //printf("ID: %s\n", id);
-                
-                if (is_gi) {
-                    int gi = atoi(id);
-                    
-                    if (gi < 1) {
-                        printf("Error: bad GI (%d) in request file\n", gi);
-                    } else {
-                        get_taxonomy_by_gi(gi, t);
-                        fprintf(fp_out, "%i\t%s\n", gi, t);
-                    }
-                } else if (is_accession) {
-                    // Strip version
-                    if (strip_version) {
-                        int i;
-                        for (i=strlen(id)-1; i>0; i--) {
-                            if (id[i] == '.') {
-                                id[i] = 0;
-                                break;
-                            }
-                        }
-                    }
-                    
-                    found = find_accession(id, buffer, &accession, &version, &taxid, &gi);
-                    if (found == 1) {
-                        if (taxid == 0) {
-                            strcpy(t, "Unknown");
-                        } else {
-                            get_taxonomy_from_node(taxid, t);
-                        }
-                        //printf("Found %s: %s, %s, %d, %d\n", id, accession, version, taxid, gi);
-                        if (keep_columns) {
-                            fprintf(fp_out, "%s%s%s\n", line, delim, t);
-                        } else {
-                            fprintf(fp_out, "%s%s%s\n", id, delim, t);
-                        }
-                    } else {
-                        printf("\nCouldn't find: [%s]\n", id);
-                    }
+            }
+            if (collect_stats) {
+                count_result(0, 0, 0);
+            }
+            continue;
+        }
+        
+        if (strip_version) {
+            strip_accession_version(id);
+        }
+        
+        if (n == entries_size) {
+            entries_size = entries_size ? entries_size * 2 : 1024;
+            entries = realloc(entries, entries_size * sizeof(BatchEntry));
+            if (!entries) {
+                printf("Error: couldn't allocate memory.\n");
+                exit(1);
+            }
+        }
+        
+        entries[n].line_offset = keep_columns ? add_batch_text(line) : 0;
+        entries[n].id_offset = add_batch_text(id);
+        n++;
+    }
+    close_file(fp_in);
+    
+    ids = malloc((n + 1) * sizeof(char*));
+    taxids = malloc((n + 1) * sizeof(unsigned int));
+    found = malloc((n + 1) * sizeof(int));
+    if ((!ids) || (!taxids) || (!found)) {
+        printf("Error: couldn't allocate memory.\n");
+        exit(1);
+    }
+    for (i=0; i<n; i++) {
+        ids[i] = batch_text + entries[i].id_offset;
+    }
+    
+    printf("Merging %ld queries with database\n", n);
+    start = collect_stats ? get_nanoseconds() : 0;
+    acc2tax_lookup_accessions(db, ids, n, taxids, found, ACC2TAX_BATCH_MERGE);
+    if (collect_stats) {
+        for (i=0; i<n; i++) {
+            count_result(ids[i][0] != 0, found[i], taxids[i]);
+        }
+        start = add_time(&run_stats.lookup_ns, start);
+    }
+    
+    for (i=0; i<n; i++) {
+        write_accession_result(fp_out, batch_text + entries[i].line_offset, batch_text + entries[i].id_offset, found[i], taxids[i]);
+    }
+    if (collect_stats) {
+        add_time(&run_stats.write_ns, start);
+    }
+    
+    close_results_file(fp_out);
+    free(ids);
+    free(taxids);
+    free(found);
+    free(entries);
+    free(batch_text);
+    batch_text = 0;
+    
+    printf("\n\nDone. Processed %d IDs.\n", count);
+}
+
+/*----------------------------------------------------------------------*
+ * Function:   open_socket
+ * Purpose:    Create a socket for a server or client address. An address
+ *             containing a colon is [host]:port for TCP, anything else
+ *             is the path of a Unix domain socket.
+ * Parameters: address -> address string
+ *             listening = 1 to bind and listen, 0 to connect
+ * Returns:    Socket file descriptor
+ *----------------------------------------------------------------------*/
+int open_socket(char* address, int listening)
+{
+    char* colon = strrchr(address, ':');
+    int fd = -1;
+    
+    if (colon) {
+        struct addrinfo hints;
+        struct addrinfo* results;
+        struct addrinfo* ai;
+        char host[MAX_PATH];
+        int one = 1;
+        
+        memcpy(host, address, colon - address);
+        host[colon - address] = 0;
+        memset(&hints, 0, sizeof(hints));
+        hints.ai_family = AF_UNSPEC;
+        hints.ai_socktype = SOCK_STREAM;
+        hints.ai_flags = listening ? AI_PASSIVE : 0;
+        if (getaddrinfo(host[0] ? host : NULL, colon + 1, &hints, &results) != 0) {
+            printf("Error: can't resolve %s\n", address);
+            exit(1);
+        }
+        
+        for (ai = results; ai; ai = ai->ai_next) {
+            fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+            if (fd < 0) {
+                continue;
+            }
+            if (listening) {
+                setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+                if (bind(fd, ai->ai_addr, ai->ai_addrlen) == 0) {
+                    break;
+                }
+            } else if (connect(fd, ai->ai_addr, ai->ai_addrlen) == 0) {
+                break;
+            }
+            close(fd);
+            fd = -1;
+        }
+        freeaddrinfo(results);
+    } else {
+        struct sockaddr_un sun;
+        
+        if (strlen(address) >= sizeof(sun.sun_path)) {
+            printf("Error: socket path too long - %s\n", address);
+            exit(1);
+        }
+        memset(&sun, 0, sizeof(sun));
+        sun.sun_family = AF_UNIX;
+        strcpy(sun.sun_path, address);
+        
+        fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (fd >= 0) {
+            if (listening) {
+                unlink(address);
+                if (bind(fd, (struct sockaddr*)&sun, sizeof(sun)) != 0) {
+                    close(fd);
+                    fd = -1;
                 }
+            } else if (connect(fd, (struct sockaddr*)&sun, sizeof(sun)) != 0) {
+                close(fd);
+                fd = -1;
             }
         }
     }
     
+    if (fd < 0) {
+        printf("Error: can't %s %s\n", listening ? "listen on" : "connect to", address);
+        exit(1);
+    }
+    
+    if ((listening) && (listen(fd, 64) != 0)) {
+        printf("Error: can't listen on %s\n", address);
+        exit(1);
+    }
+    
+    return fd;
+}
+
+/*----------------------------------------------------------------------*
+ * Function:   serve_connection
+ * Purpose:    Thread to answer one client connection. Requests are read
+ *             until the client shuts down its side, results are written
+ *             back as they are found.
+ * Parameters: arg -> socket file descriptor
+ * Returns:    NULL
+ *----------------------------------------------------------------------*/
+void* serve_connection(void* arg)
+{
+    int fd = (int)(intptr_t)arg;
+    FILE* fp_in = fdopen(fd, "r");
+    FILE* fp_out = fdopen(dup(fd), "w");
+    int count;
+    
+    if ((!fp_in) || (!fp_out)) {
+        printf("Error: can't open connection streams\n");
+        if (fp_in) fclose(fp_in); else close(fd);
+        if (fp_out) fclose(fp_out);
+        return NULL;
+    }
+    
+    if (output_format == FORMAT_BINARY) {
+        write_binary_header(fp_out);
+    }
+    count = process_request_stream(fp_in, fp_out, 0);
     fclose(fp_out);
     fclose(fp_in);
     
-    printf("\n\nDone. Processed %d IDs.\n", count);
+    printf("Answered %d requests\n", count);
+    fflush(stdout);
+    
+    return NULL;
 }
 
 /*----------------------------------------------------------------------*
- * Function:
- * Purpose:
- * Parameters:
- * Returns:
+ * Function:   run_server
+ * Purpose:    Answer lookup requests on a socket until killed. Each
+ *             connection is handled by its own thread and shares the
+ *             loaded databases.
+ * Parameters: address -> address to listen on
+ * Returns:    None
  *----------------------------------------------------------------------*/
-void open_acc_file(char* filename) {
-    acc_fp = fopen(filename, "r");
-    if (!acc_fp) {
-        printf("Error: can't open %s\n", filename);
-        exit(1);
+void run_server(char* address)
+{
+    int listen_fd = open_socket(address, 1);
+    
+    signal(SIGPIPE, SIG_IGN);
+    printf("Listening on %s\n", address);
+    fflush(stdout);
+    
+    while (1) {
+        pthread_t thread;
+        int fd = accept(listen_fd, NULL, NULL);
+        
+        if (fd < 0) {
+            continue;
+        }
+        
+        if (pthread_create(&thread, NULL, serve_connection, (void*)(intptr_t)fd) != 0) {
+            printf("Error: can't create thread for connection\n");
+            close(fd);
+        } else {
+            pthread_detach(thread);
+        }
+    }
+}
+
+/*----------------------------------------------------------------------*
+ * Function:   client_sender
+ * Purpose:    Thread to copy the input file to the server, so that
+ *             results can be read back at the same time
+ * Parameters: arg -> socket file descriptor
+ * Returns:    NULL
+ *----------------------------------------------------------------------*/
+void* client_sender(void* arg)
+{
+    int fd = (int)(intptr_t)arg;
+    FILE* fp_in = open_input_file(input_filename);
+    char buffer[65536];
+    size_t got;
+    
+    while ((got = fread(buffer, 1, sizeof(buffer), fp_in)) > 0) {
+        char* p = buffer;
+        
+        while (got > 0) {
+            ssize_t sent = write(fd, p, got);
+            if (sent <= 0) {
+                printf("Error: lost connection to server\n");
+                exit(1);
+            }
+            p += sent;
+            got -= sent;
+        }
     }
-    fseek(acc_fp, 0, SEEK_END);
-    acc_file_size = ftell(acc_fp);
-    printf("File size: %li\n", acc_file_size);
+    
+    close_file(fp_in);
+    shutdown(fd, SHUT_WR);
+    
+    return NULL;
 }
 
 /*----------------------------------------------------------------------*
- * Function:
- * Purpose:
- * Parameters:
- * Returns:
+ * Function:   run_client
+ * Purpose:    Send the input file to a server and write its replies to
+ *             the output file
+ * Parameters: address -> address of server
+ * Returns:    None
  *----------------------------------------------------------------------*/
-void close_acc_file() {
-    if (acc_fp) {
-        fclose(acc_fp);
+void run_client(char* address)
+{
+    int fd = open_socket(address, 0);
+    FILE* fp_out;
+    pthread_t sender;
+    char buffer[65536];
+    ssize_t got;
+    
+    fp_out = open_output_file(output_filename);
+    
+    pthread_create(&sender, NULL, client_sender, (void*)(intptr_t)fd);
+    while ((got = read(fd, buffer, sizeof(buffer))) > 0) {
+        fwrite(buffer, 1, got, fp_out);
     }
+    pthread_join(sender, NULL);
+    
+    close(fd);
+    close_output_file(fp_out, output_filename);
+    
+    printf("Done.\n");
 }
 
 char* get_first_token(char* string, char* value, char token) {
@@ -751,24 +2294,132 @@ char* get_first_token(char* string, char* value, char token) {
 }
 
 /*----------------------------------------------------------------------*
- * Function:
- * Purpose:
- * Parameters:
- * Returns:
+ * Function:   write_json_string
+ * Purpose:    Write a quoted JSON string, escaping as needed
+ * Parameters: fp -> file to write to
+ *             string -> string to write
+ * Returns:    None
+ *----------------------------------------------------------------------*/
+void write_json_string(FILE* fp, const char* string)
+{
+    fputc('"', fp);
+    for (; *string; string++) {
+        if ((*string == '"') || (*string == '\\')) {
+            fprintf(fp, "\\%c", *string);
+        } else if ((unsigned char)*string < ' ') {
+            fprintf(fp, "\\u%04x", *string);
+        } else {
+            fputc(*string, fp);
+        }
+    }
+    fputc('"', fp);
+}
+
+/*----------------------------------------------------------------------*
+ * Function:   get_total_stats
+ * Purpose:    Add up library statistics of the main handle and any
+ *             --auto backends
+ * Parameters: total -> to store totals
+ * Returns:    None
  *----------------------------------------------------------------------*/
-void load_accession_file(void)
+void get_total_stats(Acc2TaxStats* total)
 {
-    char filename[MAX_PATH];
+    int i;
     
-    if (is_nucleotide) {
-        sprintf(filename, "%s/acc2tax_nucl_all.txt", database_dir);
-    } else {
-        sprintf(filename, "%s/acc2tax_prot_all.txt", database_dir);
+    acc2tax_get_stats(db, total);
+    for (i=0; i<4; i++) {
+        Acc2TaxDB* backend = backends[i / 2][i % 2];
+        Acc2TaxStats stats;
+        
+        if (!backend) {
+            continue;
+        }
+        acc2tax_get_stats(backend, &stats);
+        total->load_gi_seconds += stats.load_gi_seconds;
+        total->load_accessions_seconds += stats.load_accessions_seconds;
+        total->accession_lookups += stats.accession_lookups;
+        total->accessions_found += stats.accessions_found;
+        total->gi_lookups += stats.gi_lookups;
+        total->gis_found += stats.gis_found;
+        total->probes += stats.probes;
+        total->bytes_read += stats.bytes_read;
+        total->cache_hits += stats.cache_hits;
+        total->cache_misses += stats.cache_misses;
+        total->filter_rejects += stats.filter_rejects;
+        total->placed_bytes += stats.placed_bytes;
+    }
+}
+
+/*----------------------------------------------------------------------*
+ * Function:   write_stats_file
+ * Purpose:    Write the --stats report as JSON. Lookup and write times
+ *             are summed over threads, so can exceed the process time.
+ * Parameters: load_seconds = time to open the database
+ *             process_seconds = time to process the input file
+ * Returns:    None
+ *----------------------------------------------------------------------*/
+void write_stats_file(double load_seconds, double process_seconds)
+{
+    const char* page_names[] = {"default", "transparent", "explicit"};
+    const char* numa_names[] = {"default", "interleave", "replicate"};
+    Acc2TaxStats stats;
+    struct rusage usage;
+    uint64_t lookups;
+    FILE* fp;
+    
+    get_total_stats(&stats);
+    lookups = stats.accession_lookups + stats.gi_lookups;
+    getrusage(RUSAGE_SELF, &usage);
+    
+    fp = fopen(stats_filename, "w");
+    if (!fp) {
+        printf("Error: can't open %s\n", stats_filename);
+        exit(1);
     }
     
-    printf("Opening database file %s\n", filename);
+    fprintf(fp, "{\n");
+    fprintf(fp, "    \"version\": \"%s\",\n", VERSION);
+    fprintf(fp, "    \"input\": ");
+    write_json_string(fp, input_filename);
+    fprintf(fp, ",\n");
+    fprintf(fp, "    \"threads\": %d,\n", thread_count);
+    fprintf(fp, "    \"load_seconds\": %.6f,\n", load_seconds);
+    fprintf(fp, "    \"allocate_seconds\": %.6f,\n", stats.allocate_seconds);
+    fprintf(fp, "    \"load_gi_seconds\": %.6f,\n", stats.load_gi_seconds);
+    fprintf(fp, "    \"load_nodes_seconds\": %.6f,\n", stats.load_nodes_seconds);
+    fprintf(fp, "    \"load_names_seconds\": %.6f,\n", stats.load_names_seconds);
+    fprintf(fp, "    \"load_snapshot_seconds\": %.6f,\n", stats.load_snapshot_seconds);
+    fprintf(fp, "    \"load_accessions_seconds\": %.6f,\n", stats.load_accessions_seconds);
+    fprintf(fp, "    \"build_tables_seconds\": %.6f,\n", stats.build_tables_seconds);
+    fprintf(fp, "    \"process_seconds\": %.6f,\n", process_seconds);
+    fprintf(fp, "    \"lookup_seconds\": %.6f,\n", run_stats.lookup_ns / 1e9);
+    fprintf(fp, "    \"write_seconds\": %.6f,\n", run_stats.write_ns / 1e9);
+    fprintf(fp, "    \"lines\": %lu,\n", (unsigned long)run_stats.lines);
+    fprintf(fp, "    \"lines_per_second\": %.1f,\n", process_seconds > 0 ? run_stats.lines / process_seconds : 0);
+    fprintf(fp, "    \"found\": %lu,\n", (unsigned long)run_stats.found);
+    fprintf(fp, "    \"missing\": %lu,\n", (unsigned long)run_stats.missing);
+    fprintf(fp, "    \"unknown_taxid\": %lu,\n", (unsigned long)run_stats.unknown);
+    fprintf(fp, "    \"accession_lookups\": %lu,\n", (unsigned long)stats.accession_lookups);
+    fprintf(fp, "    \"gi_lookups\": %lu,\n", (unsigned long)stats.gi_lookups);
+    fprintf(fp, "    \"probes\": %lu,\n", (unsigned long)stats.probes);
+    fprintf(fp, "    \"probes_per_lookup\": %.2f,\n", lookups ? (double)stats.probes / lookups : 0);
+    fprintf(fp, "    \"bytes_read\": %lu,\n", (unsigned long)stats.bytes_read);
+    fprintf(fp, "    \"bytes_read_per_lookup\": %.1f,\n", lookups ? (double)stats.bytes_read / lookups : 0);
+    fprintf(fp, "    \"cache_hits\": %lu,\n", (unsigned long)stats.cache_hits);
+    fprintf(fp, "    \"cache_misses\": %lu,\n", (unsigned long)stats.cache_misses);
+    fprintf(fp, "    \"cache_hit_rate\": %.4f,\n", stats.cache_hits + stats.cache_misses ? (double)stats.cache_hits / (stats.cache_hits + stats.cache_misses) : 0);
+    fprintf(fp, "    \"filter_rejects\": %lu,\n", (unsigned long)stats.filter_rejects);
+    fprintf(fp, "    \"huge_pages\": \"%s\",\n", page_names[stats.huge_pages]);
+    fprintf(fp, "    \"numa_placement\": \"%s\",\n", numa_names[stats.numa_placement]);
+    fprintf(fp, "    \"numa_nodes\": %d,\n", stats.numa_nodes);
+    fprintf(fp, "    \"placed_bytes\": %lu,\n", (unsigned long)stats.placed_bytes);
+    fprintf(fp, "    \"peak_rss_bytes\": %lu\n", (unsigned long)usage.ru_maxrss * 1024);
+    fprintf(fp, "}\n");
     
-    open_acc_file(filename);
+    if ((ferror(fp)) || (fclose(fp) != 0)) {
+        printf("Error: failed writing %s\n", stats_filename);
+        exit(1);
+    }
 }
 
 /*----------------------------------------------------------------------*
@@ -776,27 +2427,111 @@ void load_accession_file(void)
  *----------------------------------------------------------------------*/
 int main(int argc, char* argv[])
 {
+    Acc2TaxOptions options;
+    uint64_t start;
+    double load_seconds;
+    
     //setbuf(stdout, NULL);
     
-    printf("\nacc2tax %s\n\n", VERSION);
-
     parse_command_line(argc, argv);
-    allocate_memory();
-    if (is_gi) {
-        load_gi_to_node_list();
-    } else if (is_accession) {
-        load_accession_file();
+    
+    // Results to stdout - keep it for them and send messages to stderr
+    if (strcmp(output_filename, "-") == 0) {
+        output_fd = dup(1);
+        dup2(2, 1);
+    }
+    
+    printf("\nacc2tax %s\n\n", VERSION);
+    
+    acc2tax_default_options(&options);
+    options.database_dir = database_dir;
+    options.snapshot_filename = snapshot_filename[0] != 0 ? snapshot_filename : NULL;
+    options.protein = is_protein;
+    options.load_gi = is_gi;
+    options.load_accessions = is_accession && !auto_mode;
+    options.precompute_lineages = precompute_lineages;
+    options.fence_interval = fence_interval;
+    options.in_memory = in_memory;
+    options.filter_bits = filter_bits;
+    options.huge_pages = huge_pages;
+    options.numa_placement = numa_placement;
+    options.rank_table = output_rank_count > 0;
+    options.lca_table = lca_column > 0;
+    options.collect_stats = collect_stats;
+    options.lookup_cache_size = lookup_cache_size;
+    backend_options = options;
+    backend_options.rank_table = 0;
+    backend_options.lca_table = 0;
+    backend_options.precompute_lineages = 0;
+    
+    if (build_database) {
+        if (!acc2tax_build_database(&options, build_filenames, build_file_count, sort_memory * 1024 * 1024, thread_count)) {
+            exit(1);
+        }
+        return (acc2tax_build_index(&options) && acc2tax_build_shards(&options, NULL, 0)) ? 0 : 1;
+    }
+    
+    if (update_database) {
+        return acc2tax_update_database(&options, build_filenames, build_file_count) ? 0 : 1;
+    }
+    
+    if (build_index) {
+        return acc2tax_build_index(&options) ? 0 : 1;
+    }
+    
+    if (build_shards) {
+        return acc2tax_build_shards(&options, shard_keys, shard_key_count) ? 0 : 1;
+    }
+    
+    if (client_address[0] != 0) {
+        run_client(client_address);
+        return 0;
+    }
+    
+    if (write_snapshot_filename[0] != 0) {
+        options.load_accessions = 0;
+        options.precompute_lineages = 0;
+        db = acc2tax_open(&options);
+        if ((!db) || (!acc2tax_write_snapshot(db, write_snapshot_filename))) {
+            exit(1);
+        }
+        acc2tax_close(db);
+        return 0;
     }
-    load_node_list();
-    load_name_list();
-
-    printf("Memory required: %ld MB\n\n", memory_required / (1024 * 1024));
     
-    process_request_file();
+    start = get_nanoseconds();
+    db = acc2tax_open(&options);
+    if (!db) {
+        exit(1);
+    }
+    load_seconds = (get_nanoseconds() - start) / 1e9;
 
-    if (is_accession) {
-        close_acc_file();
+    printf("Memory required: %ld MB\n\n", acc2tax_memory_required(db) / (1024 * 1024));
+    
+    if (serve_address[0] != 0) {
+        run_server(serve_address);
+    }
+    
+    start = get_nanoseconds();
+    if (lca_column > 0) {
+        process_request_file_lca();
+    } else if (batch_mode && is_accession) {
+        process_request_file_batch();
+    } else if ((thread_count > 1) || (async_lookups)) {
+        process_request_file_threaded();
+    } else {
+        process_request_file();
+    }
+    
+    if (collect_stats) {
+        write_stats_file(load_seconds, (get_nanoseconds() - start) / 1e9);
     }
+
+    acc2tax_close(backends[0][0]);
+    acc2tax_close(backends[0][1]);
+    acc2tax_close(backends[1][0]);
+    acc2tax_close(backends[1][1]);
+    acc2tax_close(db);
     
     return 0;
 }
@@ -0,0 +1,119 @@
+/*----------------------------------------------------------------------*
+ * File:    acc2tax.h
+ * Author:  Richard Leggett (richard.leggett@tgac.ac.uk)
+ * Purpose: Library interface for GI/accession to taxonomy lookups
+ * Created: 10 Jan 2013
+ *----------------------------------------------------------------------*/
+
+#ifndef ACC2TAX_H
+#define ACC2TAX_H
+
+#include <stdio.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*----------------------------------------------------------------------*
+ * A database handle holds everything loaded by acc2tax_open. Lookup and
+ * lineage calls on one handle are safe to make from several threads.
+ *----------------------------------------------------------------------*/
+typedef struct Acc2TaxDB Acc2TaxDB;
+
+/*----------------------------------------------------------------------*
+ * What to load, and where from
+ *----------------------------------------------------------------------*/
+typedef struct {
+    const char* database_dir;       // Directory of NCBI taxonomy files
+    const char* snapshot_filename;  // Snapshot to map instead of .dmp files, or NULL
+    int protein;                    // 1 for protein GI/accession databases
+    int load_gi;                    // 1 to load the GI table
+    int load_accessions;            // 1 to open the accession file or index
+    int precompute_lineages;        // 1 to build all lineage strings on open
+    unsigned int fence_interval;    // Sample a key every this many bytes of the accession text file, or 0
+    int in_memory;                  // 1 to load the accession index into an in-memory hash table
+    unsigned int filter_bits;       // Bits per key of a Bloom filter to build with an index, or 0
+    unsigned int lookup_cache_size; // Accession lookup results to remember, or 0 for no cache
+    int load_threads;               // Threads to parse the GI file with, or 0 for one per CPU
+    int rank_table;                 // 1 to build a table of each node's standard rank ancestors
+    int lca_table;                  // 1 to build a table for constant time acc2tax_lca
+    int collect_stats;              // 1 to count lookups, probes and bytes read for acc2tax_get_stats
+    int huge_pages;                 // ACC2TAX_PAGES_* backing for the large lookup tables
+    int numa_placement;             // ACC2TAX_NUMA_* placement of the large lookup tables
+    FILE* log_fp;                   // Progress and error messages, or NULL for none
+} Acc2TaxOptions;
+
+/*----------------------------------------------------------------------*
+ * Load times and lookup counters, filled in by acc2tax_get_stats. Load
+ * times are always recorded; counters only with collect_stats set.
+ *----------------------------------------------------------------------*/
+typedef struct {
+    double allocate_seconds;        // Allocating the node and name tables
+    double load_gi_seconds;         // Parsing the GI file
+    double load_nodes_seconds;      // Parsing nodes.dmp
+    double load_names_seconds;      // Parsing names.dmp
+    double load_snapshot_seconds;   // Mapping a snapshot instead of the .dmp files
+    double load_accessions_seconds; // Opening the accession file or index, with fences or hash table
+    double build_tables_seconds;    // Rank and LCA tables, and precomputed lineages
+    uint64_t accession_lookups;
+    uint64_t accessions_found;
+    uint64_t gi_lookups;
+    uint64_t gis_found;
+    uint64_t probes;                // Records or keys compared by accession lookups
+    uint64_t bytes_read;            // Bytes read from the accession file or index by lookups
+    uint64_t cache_hits;            // Accession lookups answered by the lookup cache
+    uint64_t cache_misses;          // Cacheable accession lookups that had to search
+    uint64_t filter_rejects;        // Accession lookups the Bloom filter showed can't be found
+    int huge_pages;                 // ACC2TAX_PAGES_* backing the tables got
+    int numa_placement;             // ACC2TAX_NUMA_* placement the tables got
+    int numa_nodes;                 // NUMA nodes found
+    uint64_t placed_bytes;          // Bytes of tables copied into placed memory
+} Acc2TaxStats;
+
+/*----------------------------------------------------------------------*
+ * Memory backing and NUMA placement of the GI, node, name, rank, LCA and
+ * in-memory index tables. Explicit huge pages fall back to transparent
+ * ones if none are reserved. Replication copies the GI table to every
+ * NUMA node, and interleaves the rest.
+ *----------------------------------------------------------------------*/
+#define ACC2TAX_PAGES_DEFAULT 0
+#define ACC2TAX_PAGES_TRANSPARENT 1
+#define ACC2TAX_PAGES_EXPLICIT 2
+#define ACC2TAX_NUMA_DEFAULT 0
+#define ACC2TAX_NUMA_INTERLEAVE 1
+#define ACC2TAX_NUMA_REPLICATE 2
+
+/*----------------------------------------------------------------------*
+ * Methods for acc2tax_lookup_accessions
+ *----------------------------------------------------------------------*/
+#define ACC2TAX_BATCH_SEARCH 0      // Binary search for each accession
+#define ACC2TAX_BATCH_MERGE 1       // Sort, then one sequential database pass
+#define ACC2TAX_BATCH_ASYNC 2       // Many searches in flight at once, for uncached databases
+
+void acc2tax_default_options(Acc2TaxOptions* options);
+Acc2TaxDB* acc2tax_open(const Acc2TaxOptions* options);
+Acc2TaxDB* acc2tax_open_shared(Acc2TaxDB* taxonomy, const Acc2TaxOptions* options);
+void acc2tax_close(Acc2TaxDB* db);
+
+int acc2tax_lookup_accession(Acc2TaxDB* db, const char* accession, unsigned int* taxid);
+size_t acc2tax_lookup_accessions(Acc2TaxDB* db, const char** accessions, size_t n, unsigned int* taxids, int* found, int method);
+int acc2tax_lookup_gi(Acc2TaxDB* db, unsigned int gi, unsigned int* taxid);
+
+const char* acc2tax_lineage(Acc2TaxDB* db, unsigned int taxid, size_t* length);
+const char* acc2tax_name(Acc2TaxDB* db, unsigned int taxid);
+unsigned int acc2tax_parent(Acc2TaxDB* db, unsigned int taxid);
+int acc2tax_find_rank(const char* rank);
+const char* acc2tax_rank(Acc2TaxDB* db, unsigned int taxid);
+unsigned int acc2tax_rank_ancestor(Acc2TaxDB* db, unsigned int taxid, int rank);
+unsigned int acc2tax_lca(Acc2TaxDB* db, unsigned int a, unsigned int b);
+unsigned int acc2tax_node_count(Acc2TaxDB* db);
+long int acc2tax_memory_required(Acc2TaxDB* db);
+void acc2tax_get_stats(Acc2TaxDB* db, Acc2TaxStats* stats);
+int acc2tax_shard_count(Acc2TaxDB* db);
+int acc2tax_shard_of(Acc2TaxDB* db, const char* accession);
+
+int acc2tax_build_database(const Acc2TaxOptions* options, char** filenames, int n_files, size_t memory_limit, int threads);
+int acc2tax_update_database(const Acc2TaxOptions* options, char** filenames, int n_files);
+int acc2tax_build_index(const Acc2TaxOptions* options);
+int acc2tax_build_shards(const Acc2TaxOptions* options, char** first_keys, int n_keys);
+int acc2tax_write_snapshot(Acc2TaxDB* db, const char* filename);
+
+#endif
@@ -0,0 +1,436 @@
+/*----------------------------------------------------------------------*
+ * File:    bench.c
+ * Purpose: Time each phase of acc2tax - loading, lookup and output -
+ *          against a database made by generate
+ *----------------------------------------------------------------------*/
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <getopt.h>
+#include <time.h>
+#include <unistd.h>
+#include "acc2tax.h"
+
+/*----------------------------------------------------------------------*
+ * Constants
+ *----------------------------------------------------------------------*/
+#define MAX_PATH 10000
+#define MAX_LINE_LENGTH 1024
+
+/*----------------------------------------------------------------------*
+ * Queries read from a file, one per line
+ *----------------------------------------------------------------------*/
+typedef struct {
+    char* text;
+    char** lines;
+    size_t n;
+} QueryFile;
+
+/*----------------------------------------------------------------------*
+ * Globals
+ *----------------------------------------------------------------------*/
+char database_dir[MAX_PATH] = "";
+int is_protein = 0;
+unsigned int fence_interval = 65536;
+int repeats = 1;
+FILE* fp_null;
+
+/*----------------------------------------------------------------------*
+ * Function:   usage
+ * Purpose:    Report program usage.
+ * Parameters: None
+ * Returns:    None
+ *----------------------------------------------------------------------*/
+void usage(void)
+{
+    printf("\nTime acc2tax phases against a database made by generate.\n" \
+           "\nOptions:\n" \
+           "    [-d | --database]   Database directory, with queries_acc.txt and queries_gi.txt (required).\n" \
+           "    [-p | --protein]    Use protein files.\n" \
+           "    [-f | --fence]      Fence interval for the text file backend (default 65536).\n" \
+           "    [-r | --repeats]    Times to repeat each lookup pass (default 1).\n" \
+           "\nWith a binary index present, the index, in-memory, batch merge and async backends\n" \
+           "are timed. Without one, the text file, fence, fence async and batch merge backends\n" \
+           "are timed.\n" \
+           "\n");
+}
+
+/*----------------------------------------------------------------------*
+ * Function:   parse_command_line
+ * Purpose:    Parse command line options
+ * Parameters: argc = number of arguments
+ *             argv -> array of arguments
+ * Returns:    None
+ *----------------------------------------------------------------------*/
+void parse_command_line(int argc, char* argv[])
+{
+    static struct option long_options[] = {
+        {"database", required_argument, NULL, 'd'},
+        {"protein", no_argument, NULL, 'p'},
+        {"fence", required_argument, NULL, 'f'},
+        {"repeats", required_argument, NULL, 'r'},
+        {"help", no_argument, NULL, 'h'},
+        {0, 0, 0, 0}
+    };
+    int opt;
+    int long_index;
+
+    while ((opt = getopt_long(argc, argv, "d:pf:r:h", long_options, &long_index)) != -1) {
+        switch (opt) {
+            case 'd':
+                if (strlen(optarg) >= MAX_PATH - 32) {
+                    printf("Error: directory name too long.\n");
+                    exit(1);
+                }
+                strcpy(database_dir, optarg);
+                break;
+            case 'p':
+                is_protein = 1;
+                break;
+            case 'f':
+                fence_interval = strtoul(optarg, NULL, 10);
+                break;
+            case 'r':
+                repeats = atoi(optarg);
+                if (repeats < 1) {
+                    repeats = 1;
+                }
+                break;
+            case 'h':
+                usage();
+                exit(0);
+                break;
+        }
+    }
+
+    if (database_dir[0] == 0) {
+        printf("Error: you must specify a database directory.\n");
+        exit(2);
+    }
+}
+
+/*----------------------------------------------------------------------*
+ * Function:   now
+ * Purpose:    Read the monotonic clock
+ * Parameters: None
+ * Returns:    Time in seconds
+ *----------------------------------------------------------------------*/
+double now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec + (ts.tv_nsec / 1e9);
+}
+
+/*----------------------------------------------------------------------*
+ * Function:   report
+ * Purpose:    Print one line of results
+ * Parameters: phase -> name of phase
+ *             seconds = time taken
+ *             items = number of items processed, or 0
+ *             note -> extra detail, or NULL
+ * Returns:    None
+ *----------------------------------------------------------------------*/
+void report(const char* phase, double seconds, size_t items, const char* note)
+{
+    if (items > 0) {
+        printf("%-32s %10.3f %12lu %14.0f  %s\n", phase, seconds, (unsigned long)items, seconds > 0 ? items / seconds : 0, note ? note : "");
+    } else {
+        printf("%-32s %10.3f %12s %14s  %s\n", phase, seconds, "", "", note ? note : "");
+    }
+    fflush(stdout);
+}
+
+/*----------------------------------------------------------------------*
+ * Function:   read_query_file
+ * Purpose:    Read a query file into memory
+ * Parameters: name -> file name within database directory
+ *             queries -> to store queries
+ * Returns:    None
+ *----------------------------------------------------------------------*/
+void read_query_file(const char* name, QueryFile* queries)
+{
+    char filename[MAX_PATH + 64];
+    char line[MAX_LINE_LENGTH];
+    size_t text_size = 1024 * 1024;
+    size_t text_used = 0;
+    size_t lines_size = 1024;
+    size_t* offsets;
+    size_t i;
+    FILE* fp;
+
+    sprintf(filename, "%s/%s", database_dir, name);
+    fp = fopen(filename, "r");
+    if (!fp) {
+        printf("Error: can't open %s\n", filename);
+        exit(1);
+    }
+
+    queries->n = 0;
+    queries->text = malloc(text_size);
+    offsets = malloc(lines_size * sizeof(size_t));
+    if ((!queries->text) || (!offsets)) {
+        printf("Error: couldn't allocate memory.\n");
+        exit(1);
+    }
+
+    while (fgets(line, MAX_LINE_LENGTH, fp)) {
+        size_t length;
+
+        line[strcspn(line, "\r\n")] = 0;
+        length = strlen(line) + 1;
+        if (text_used + length > text_size) {
+            text_size *= 2;
+            queries->text = realloc(queries->text, text_size);
+        }
+        if (queries->n == lines_size) {
+            lines_size *= 2;
+            offsets = realloc(offsets, lines_size * sizeof(size_t));
+        }
+        if ((!queries->text) || (!offsets)) {
+            printf("Error: couldn't allocate memory.\n");
+            exit(1);
+        }
+        memcpy(queries->text + text_used, line, length);
+        offsets[queries->n++] = text_used;
+        text_used += length;
+    }
+    fclose(fp);
+
+    queries->lines = malloc((queries->n + 1) * sizeof(char*));
+    if (!queries->lines) {
+        printf("Error: couldn't allocate memory.\n");
+        exit(1);
+    }
+    for (i=0; i<queries->n; i++) {
+        queries->lines[i] = queries->text + offsets[i];
+    }
+    free(offsets);
+}
+
+/*----------------------------------------------------------------------*
+ * Function:   open_database
+ * Purpose:    Open a database handle and time it, then report the time
+ *             of each phase of the open from the library's stats
+ * Parameters: options -> options
+ *             phase -> name to report time under
+ * Returns:    Database handle
+ *----------------------------------------------------------------------*/
+Acc2TaxDB* open_database(const Acc2TaxOptions* options, const char* phase)
+{
+    double start = now();
+    Acc2TaxDB* db = acc2tax_open(options);
+    Acc2TaxStats stats;
+
+    if (!db) {
+        printf("Error: couldn't open database\n");
+        exit(1);
+    }
+    report(phase, now() - start, 0, NULL);
+
+    // The .dmp files are parsed at the same time, so these overlap
+    acc2tax_get_stats(db, &stats);
+    report("  allocate", stats.allocate_seconds, 0, NULL);
+    report("  load nodes", stats.load_nodes_seconds, 0, "in parallel");
+    report("  load names", stats.load_names_seconds, 0, "in parallel");
+    if (options->load_gi) {
+        report("  load gi", stats.load_gi_seconds, 0, "in parallel");
+    }
+    if (options->load_accessions) {
+        report("  load accessions", stats.load_accessions_seconds, 0, NULL);
+    }
+    report("  build tables", stats.build_tables_seconds, 0, NULL);
+
+    return db;
+}
+
+/*----------------------------------------------------------------------*
+ * Function:   time_accession_lookups
+ * Purpose:    Time looking up every accession query, one at a time or
+ *             as a batch
+ * Parameters: db -> database handle
+ *             queries -> accession queries
+ *             taxids -> to store taxids
+ *             found -> to store found flags
+ *             phase -> name to report time under
+ *             method = -1 for single lookups, or a batch method
+ * Returns:    None
+ *----------------------------------------------------------------------*/
+void time_accession_lookups(Acc2TaxDB* db, QueryFile* queries, unsigned int* taxids, int* found, const char* phase, int method)
+{
+    char note[64];
+    size_t hits = 0;
+    double start = now();
+    size_t i;
+    int r;
+
+    for (r=0; r<repeats; r++) {
+        if (method < 0) {
+            for (i=0; i<queries->n; i++) {
+                found[i] = acc2tax_lookup_accession(db, queries->lines[i], &taxids[i]);
+            }
+        } else {
+            acc2tax_lookup_accessions(db, (const char**)queries->lines, queries->n, taxids, found, method);
+        }
+    }
+
+    for (i=0; i<queries->n; i++) {
+        hits += found[i] ? 1 : 0;
+    }
+    sprintf(note, "%.1f%% found", queries->n ? (100.0 * hits) / queries->n : 0);
+    report(phase, now() - start, queries->n * repeats, note);
+}
+
+/*----------------------------------------------------------------------*
+ * Function:   time_output
+ * Purpose:    Time writing lineages for found queries, as acc2tax does
+ * Parameters: db -> database handle
+ *             queries -> queries
+ *             taxids -> taxid of each query
+ *             found -> found flag of each query
+ *             phase -> name to report time under
+ * Returns:    None
+ *----------------------------------------------------------------------*/
+void time_output(Acc2TaxDB* db, QueryFile* queries, unsigned int* taxids, int* found, const char* phase)
+{
+    double start = now();
+    size_t written = 0;
+    size_t i;
+
+    for (i=0; i<queries->n; i++) {
+        if (found[i]) {
+            size_t length;
+            const char* lineage = acc2tax_lineage(db, taxids[i], &length);
+
+            fputs(queries->lines[i], fp_null);
+            fputc('\t', fp_null);
+            if (lineage) {
+                fwrite(lineage, 1, length, fp_null);
+            }
+            fputc('\n', fp_null);
+            written++;
+        }
+    }
+    fflush(fp_null);
+
+    report(phase, now() - start, written, NULL);
+}
+
+/*----------------------------------------------------------------------*
+ * Function:   main
+ * Purpose:    Entry point to program
+ * Parameters: argc = number of arguments
+ *             argv -> array of arguments
+ * Returns:    Exit status
+ *----------------------------------------------------------------------*/
+int main(int argc, char* argv[])
+{
+    Acc2TaxOptions options;
+    Acc2TaxDB* db;
+    QueryFile acc_queries;
+    QueryFile gi_queries;
+    char index_filename[MAX_PATH + 64];
+    unsigned int* taxids;
+    int* found;
+    int has_index;
+    size_t n;
+    size_t i;
+
+    parse_command_line(argc, argv);
+    fp_null = fopen("/dev/null", "w");
+    if (!fp_null) {
+        printf("Error: can't open /dev/null\n");
+        exit(1);
+    }
+
+    read_query_file("queries_acc.txt", &acc_queries);
+    read_query_file("queries_gi.txt", &gi_queries);
+    n = acc_queries.n > gi_queries.n ? acc_queries.n : gi_queries.n;
+    taxids = malloc((n + 1) * sizeof(unsigned int));
+    found = malloc((n + 1) * sizeof(int));
+    if ((!taxids) || (!found)) {
+        printf("Error: couldn't allocate memory.\n");
+        exit(1);
+    }
+
+    sprintf(index_filename, "%s/acc2tax_%s_all.idx", database_dir, is_protein ? "prot" : "nucl");
+    has_index = access(index_filename, R_OK) == 0;
+
+    printf("\nacc2tax benchmark: %s, %lu accession and %lu GI queries, %s\n\n", database_dir, (unsigned long)acc_queries.n, (unsigned long)gi_queries.n, has_index ? "binary index" : "text file");
+    printf("%-32s %10s %12s %14s\n", "Phase", "Seconds", "Items", "Items/second");
+
+    acc2tax_default_options(&options);
+    options.database_dir = database_dir;
+    options.protein = is_protein;
+    options.log_fp = NULL;
+
+    // Taxonomy alone, then with the GI table
+    options.load_accessions = 0;
+    db = open_database(&options, "load nodes+names");
+    acc2tax_close(db);
+
+    options.load_gi = 1;
+    db = open_database(&options, "load nodes+names+gi");
+    {
+        double start = now();
+        size_t hits = 0;
+        char note[64];
+        int r;
+
+        for (r=0; r<repeats; r++) {
+            for (i=0; i<gi_queries.n; i++) {
+                found[i] = acc2tax_lookup_gi(db, strtoul(gi_queries.lines[i], NULL, 10), &taxids[i]);
+            }
+        }
+        for (i=0; i<gi_queries.n; i++) {
+            hits += found[i] ? 1 : 0;
+        }
+        sprintf(note, "%.1f%% found", gi_queries.n ? (100.0 * hits) / gi_queries.n : 0);
+        report("lookup gi", now() - start, gi_queries.n * repeats, note);
+    }
+    time_output(db, &gi_queries, taxids, found, "output gi lineages (cold)");
+    time_output(db, &gi_queries, taxids, found, "output gi lineages (cached)");
+    acc2tax_close(db);
+    options.load_gi = 0;
+
+    // Accession backends
+    options.load_accessions = 1;
+    db = open_database(&options, has_index ? "open index" : "open text file");
+    time_accession_lookups(db, &acc_queries, taxids, found, has_index ? "lookup index" : "lookup text file", -1);
+    time_accession_lookups(db, &acc_queries, taxids, found, "lookup batch merge", ACC2TAX_BATCH_MERGE);
+    if (has_index) {
+        time_accession_lookups(db, &acc_queries, taxids, found, "lookup batch async", ACC2TAX_BATCH_ASYNC);
+    }
+    time_output(db, &acc_queries, taxids, found, "output accession lineages");
+    acc2tax_close(db);
+
+    if (has_index) {
+        options.in_memory = 1;
+        db = open_database(&options, "open index in memory");
+        time_accession_lookups(db, &acc_queries, taxids, found, "lookup in memory", -1);
+        acc2tax_close(db);
+    } else if (fence_interval > 0) {
+        options.fence_interval = fence_interval;
+        db = open_database(&options, "open text file with fences");
+        time_accession_lookups(db, &acc_queries, taxids, found, "lookup fences", -1);
+        time_accession_lookups(db, &acc_queries, taxids, found, "lookup fences batch async", ACC2TAX_BATCH_ASYNC);
+        acc2tax_close(db);
+    }
+
+    printf("\n");
+
+    free(taxids);
+    free(found);
+    free(acc_queries.text);
+    free(acc_queries.lines);
+    free(gi_queries.text);
+    free(gi_queries.lines);
+    fclose(fp_null);
+
+    return 0;
+}
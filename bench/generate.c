@@ -0,0 +1,501 @@
+/*----------------------------------------------------------------------*
+ * File:    generate.c
+ * Purpose: Generate a synthetic acc2tax database and query files for
+ *          benchmarking
+ *----------------------------------------------------------------------*/
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <getopt.h>
+#include <sys/stat.h>
+
+/*----------------------------------------------------------------------*
+ * Constants
+ *----------------------------------------------------------------------*/
+#define MAX_PATH 10000
+#define ACCESSION_WIDTH 24
+#define RANK_LEVELS 7
+
+/*----------------------------------------------------------------------*
+ * Ranks by depth below the root, and the share of nodes at each depth
+ *----------------------------------------------------------------------*/
+static const char* level_ranks[RANK_LEVELS] = {
+    "superkingdom", "phylum", "class", "order", "family", "genus", "species"
+};
+static const double level_shares[RANK_LEVELS] = {
+    0.0001, 0.001, 0.004, 0.015, 0.05, 0.2, 0.7299
+};
+
+/*----------------------------------------------------------------------*
+ * Accession prefixes, a mix of GenBank, RefSeq and WGS styles
+ *----------------------------------------------------------------------*/
+static const char* prefixes[] = {
+    "A", "AB", "CP", "JAAB", "KX", "MN", "NC_", "NM_", "NZ_CP", "WP_", "XM_", "XP_"
+};
+#define PREFIX_COUNT (sizeof(prefixes) / sizeof(prefixes[0]))
+
+/*----------------------------------------------------------------------*
+ * Globals
+ *----------------------------------------------------------------------*/
+char output_dir[MAX_PATH] = "";
+unsigned int node_count = 100000;
+unsigned long accession_count = 1000000;
+unsigned long gi_count = 1000000;
+unsigned long query_count = 100000;
+double miss_ratio = 0.1;
+double duplicate_ratio = 0.5;
+int sorted_queries = 0;
+int is_protein = 0;
+unsigned int seed = 1;
+unsigned int* species_nodes = 0;
+unsigned int species_count = 0;
+uint64_t random_state;
+
+/*----------------------------------------------------------------------*
+ * Function:   usage
+ * Purpose:    Report program usage.
+ * Parameters: None
+ * Returns:    None
+ *----------------------------------------------------------------------*/
+void usage(void)
+{
+    printf("\nGenerate a synthetic acc2tax database and query files.\n" \
+           "\nOptions:\n" \
+           "    [-d | --database]   Directory to write to (required).\n" \
+           "    [-n | --nodes]      Number of taxonomy nodes (default 100000).\n" \
+           "    [-a | --accessions] Number of accessions (default 1000000).\n" \
+           "    [-g | --gis]        Number of GIs (default 1000000).\n" \
+           "    [-q | --queries]    Number of queries in each query file (default 100000).\n" \
+           "    [-m | --misses]     Fraction of queries not in the database (default 0.1).\n" \
+           "    [-u | --duplicates] Fraction of queries repeating an earlier query (default 0.5).\n" \
+           "    [-s | --sorted]     Sort the query files.\n" \
+           "    [-p | --protein]    Write protein files rather than nucleotide.\n" \
+           "    [-r | --seed]       Random seed (default 1).\n" \
+           "\nWrites nodes.dmp, names.dmp, acc2tax_nucl_all.txt (or _prot_), gi_taxid_nucl.dmp\n" \
+           "(or _prot), queries_acc.txt and queries_gi.txt.\n" \
+           "\n");
+}
+
+/*----------------------------------------------------------------------*
+ * Function:   parse_command_line
+ * Purpose:    Parse command line options
+ * Parameters: argc = number of arguments
+ *             argv -> array of arguments
+ * Returns:    None
+ *----------------------------------------------------------------------*/
+void parse_command_line(int argc, char* argv[])
+{
+    static struct option long_options[] = {
+        {"database", required_argument, NULL, 'd'},
+        {"nodes", required_argument, NULL, 'n'},
+        {"accessions", required_argument, NULL, 'a'},
+        {"gis", required_argument, NULL, 'g'},
+        {"queries", required_argument, NULL, 'q'},
+        {"misses", required_argument, NULL, 'm'},
+        {"duplicates", required_argument, NULL, 'u'},
+        {"sorted", no_argument, NULL, 's'},
+        {"protein", no_argument, NULL, 'p'},
+        {"seed", required_argument, NULL, 'r'},
+        {"help", no_argument, NULL, 'h'},
+        {0, 0, 0, 0}
+    };
+    int opt;
+    int long_index;
+
+    while ((opt = getopt_long(argc, argv, "d:n:a:g:q:m:u:spr:h", long_options, &long_index)) != -1) {
+        switch (opt) {
+            case 'd':
+                if (strlen(optarg) >= MAX_PATH - 32) {
+                    printf("Error: directory name too long.\n");
+                    exit(1);
+                }
+                strcpy(output_dir, optarg);
+                break;
+            case 'n':
+                node_count = strtoul(optarg, NULL, 10);
+                break;
+            case 'a':
+                accession_count = strtoul(optarg, NULL, 10);
+                break;
+            case 'g':
+                gi_count = strtoul(optarg, NULL, 10);
+                break;
+            case 'q':
+                query_count = strtoul(optarg, NULL, 10);
+                break;
+            case 'm':
+                miss_ratio = atof(optarg);
+                break;
+            case 'u':
+                duplicate_ratio = atof(optarg);
+                break;
+            case 's':
+                sorted_queries = 1;
+                break;
+            case 'p':
+                is_protein = 1;
+                break;
+            case 'r':
+                seed = strtoul(optarg, NULL, 10);
+                break;
+            case 'h':
+                usage();
+                exit(0);
+                break;
+        }
+    }
+
+    if (output_dir[0] == 0) {
+        printf("Error: you must specify a directory.\n");
+        exit(2);
+    }
+    if (node_count < 100) {
+        printf("Error: need at least 100 nodes.\n");
+        exit(2);
+    }
+    if (miss_ratio + duplicate_ratio > 1) {
+        printf("Error: misses and duplicates can't add up to more than 1.\n");
+        exit(2);
+    }
+}
+
+/*----------------------------------------------------------------------*
+ * Function:   next_random
+ * Purpose:    Random number generator (xorshift64*), so datasets are
+ *             the same from one platform to the next
+ * Parameters: None
+ * Returns:    Random 64-bit number
+ *----------------------------------------------------------------------*/
+uint64_t next_random(void)
+{
+    random_state ^= random_state >> 12;
+    random_state ^= random_state << 25;
+    random_state ^= random_state >> 27;
+
+    return random_state * 2685821657736338717ULL;
+}
+
+/*----------------------------------------------------------------------*
+ * Function:   random_below
+ * Purpose:    Random number in a range
+ * Parameters: n = size of range
+ * Returns:    Random number from 0 to n-1
+ *----------------------------------------------------------------------*/
+uint64_t random_below(uint64_t n)
+{
+    return next_random() % n;
+}
+
+/*----------------------------------------------------------------------*
+ * Function:   random_fraction
+ * Purpose:    Random fraction
+ * Parameters: None
+ * Returns:    Random number from 0 up to 1
+ *----------------------------------------------------------------------*/
+double random_fraction(void)
+{
+    return (next_random() >> 11) * (1.0 / 9007199254740992.0);
+}
+
+/*----------------------------------------------------------------------*
+ * Function:   open_file
+ * Purpose:    Open a file in the output directory for writing
+ * Parameters: name -> file name
+ * Returns:    File pointer
+ *----------------------------------------------------------------------*/
+FILE* open_file(const char* name)
+{
+    char filename[MAX_PATH + 64];
+    FILE* fp;
+
+    sprintf(filename, "%s/%s", output_dir, name);
+    printf("Writing %s\n", filename);
+    fp = fopen(filename, "w");
+    if (!fp) {
+        printf("Error: can't open %s\n", filename);
+        exit(1);
+    }
+    setvbuf(fp, NULL, _IOFBF, 1024 * 1024);
+
+    return fp;
+}
+
+/*----------------------------------------------------------------------*
+ * Function:   close_file
+ * Purpose:    Close an output file, checking for errors
+ * Parameters: fp -> file
+ * Returns:    None
+ *----------------------------------------------------------------------*/
+void close_file(FILE* fp)
+{
+    if ((ferror(fp)) || (fclose(fp) != 0)) {
+        printf("Error: failed writing file\n");
+        exit(1);
+    }
+}
+
+/*----------------------------------------------------------------------*
+ * Function:   write_taxonomy
+ * Purpose:    Write nodes.dmp and names.dmp. Nodes are laid out in levels
+ *             below the root, each node's parent picked at random from
+ *             the level above.
+ * Parameters: None
+ * Returns:    None
+ *----------------------------------------------------------------------*/
+void write_taxonomy(void)
+{
+    FILE* fp_nodes = open_file("nodes.dmp");
+    FILE* fp_names = open_file("names.dmp");
+    unsigned int level_start = 1;
+    unsigned int level_size = 1;
+    unsigned int node = 2;
+    int level;
+
+    fprintf(fp_nodes, "1\t|\t1\t|\tno rank\t|\t\t|\t8\t|\n");
+    fprintf(fp_names, "1\t|\troot\t|\t\t|\tscientific name\t|\n");
+
+    for (level=0; level<RANK_LEVELS; level++) {
+        unsigned int size = (unsigned int)((node_count - 1) * level_shares[level]);
+        unsigned int i;
+
+        if (size < 1) {
+            size = 1;
+        }
+        if ((level == RANK_LEVELS - 1) || (node + size > node_count + 1)) {
+            size = node_count + 1 - node;
+        }
+
+        if (level == RANK_LEVELS - 1) {
+            species_nodes = malloc(size * sizeof(unsigned int));
+            if (!species_nodes) {
+                printf("Error: couldn't allocate memory.\n");
+                exit(1);
+            }
+        }
+
+        for (i=0; i<size; i++) {
+            unsigned int parent = level_start + random_below(level_size);
+
+            fprintf(fp_nodes, "%u\t|\t%u\t|\t%s\t|\t\t|\t0\t|\n", node, parent, level_ranks[level]);
+            fprintf(fp_names, "%u\t|\t%s %u\t|\t\t|\tscientific name\t|\n", node, level_ranks[level], node);
+            if ((node % 3) == 0) {
+                fprintf(fp_names, "%u\t|\tsynonym %u\t|\t\t|\tsynonym\t|\n", node, node);
+            }
+            if (level == RANK_LEVELS - 1) {
+                species_nodes[species_count++] = node;
+            }
+            node++;
+        }
+
+        level_start += level_size;
+        level_size = size;
+    }
+
+    close_file(fp_nodes);
+    close_file(fp_names);
+}
+
+/*----------------------------------------------------------------------*
+ * Function:   make_accession
+ * Purpose:    Make the accession for an index. Every index gives a
+ *             different accession.
+ * Parameters: index = accession number
+ *             accession -> to store accession
+ * Returns:    None
+ *----------------------------------------------------------------------*/
+void make_accession(uint64_t index, char* accession)
+{
+    const char* prefix = prefixes[index % PREFIX_COUNT];
+    uint64_t number = index / PREFIX_COUNT;
+    int digits = strlen(prefix) >= 4 ? 8 : (strlen(prefix) == 1 ? 5 : 6);
+
+    // Numbers too long for the usual width just get longer
+    sprintf(accession, "%s%0*lu", prefix, digits, (unsigned long)number);
+}
+
+/*----------------------------------------------------------------------*
+ * Function:   compare_accessions
+ * Purpose:    qsort comparator for accessions, byte order as acc2tax uses
+ * Parameters: a, b -> accessions
+ * Returns:    <0, 0 or >0
+ *----------------------------------------------------------------------*/
+int compare_accessions(const void* a, const void* b)
+{
+    return strcmp(a, b);
+}
+
+/*----------------------------------------------------------------------*
+ * Function:   compare_numbers
+ * Purpose:    qsort comparator for 64-bit numbers
+ * Parameters: a, b -> numbers
+ * Returns:    <0, 0 or >0
+ *----------------------------------------------------------------------*/
+int compare_numbers(const void* a, const void* b)
+{
+    uint64_t number_a = *(const uint64_t*)a;
+    uint64_t number_b = *(const uint64_t*)b;
+
+    return (number_a > number_b) - (number_a < number_b);
+}
+
+/*----------------------------------------------------------------------*
+ * Function:   write_accessions
+ * Purpose:    Write the sorted accession file
+ * Parameters: accessions -> to store accessions, to be freed by caller
+ * Returns:    None
+ *----------------------------------------------------------------------*/
+void write_accessions(char** accessions)
+{
+    FILE* fp = open_file(is_protein ? "acc2tax_prot_all.txt" : "acc2tax_nucl_all.txt");
+    uint64_t i;
+
+    *accessions = malloc(accession_count * ACCESSION_WIDTH);
+    if (!*accessions) {
+        printf("Error: couldn't allocate memory.\n");
+        exit(1);
+    }
+    for (i=0; i<accession_count; i++) {
+        make_accession(i, *accessions + (i * ACCESSION_WIDTH));
+    }
+    qsort(*accessions, accession_count, ACCESSION_WIDTH, compare_accessions);
+
+    for (i=0; i<accession_count; i++) {
+        char* accession = *accessions + (i * ACCESSION_WIDTH);
+
+        fprintf(fp, "%s\t%s.%d\t%u\t%lu\n", accession, accession, 1 + (int)random_below(3), species_nodes[random_below(species_count)], (unsigned long)(i + 1));
+    }
+
+    close_file(fp);
+}
+
+/*----------------------------------------------------------------------*
+ * Function:   write_gis
+ * Purpose:    Write the GI file. GIs are spaced out so the GI table has
+ *             gaps, as the real one does.
+ * Parameters: None
+ * Returns:    None
+ *----------------------------------------------------------------------*/
+void write_gis(void)
+{
+    FILE* fp = open_file(is_protein ? "gi_taxid_prot.dmp" : "gi_taxid_nucl.dmp");
+    uint64_t i;
+
+    for (i=0; i<gi_count; i++) {
+        fprintf(fp, "%lu\t%u\n", (unsigned long)((i * 3) + 1), species_nodes[random_below(species_count)]);
+    }
+
+    close_file(fp);
+}
+
+/*----------------------------------------------------------------------*
+ * Function:   pick_queries
+ * Purpose:    Choose query numbers. A number below count is a hit on that
+ *             entry, count or more is a miss. Duplicates repeat an
+ *             earlier query.
+ * Parameters: count = number of database entries
+ * Returns:    Array of query_count numbers, to be freed by caller
+ *----------------------------------------------------------------------*/
+uint64_t* pick_queries(uint64_t count)
+{
+    uint64_t* queries = malloc((query_count + 1) * sizeof(uint64_t));
+    uint64_t i;
+
+    if (!queries) {
+        printf("Error: couldn't allocate memory.\n");
+        exit(1);
+    }
+
+    for (i=0; i<query_count; i++) {
+        if ((i > 0) && (random_fraction() < duplicate_ratio)) {
+            queries[i] = queries[random_below(i)];
+        } else if ((random_fraction() < miss_ratio) || (count == 0)) {
+            queries[i] = count + random_below(count + 1000);
+        } else {
+            queries[i] = random_below(count);
+        }
+    }
+
+    return queries;
+}
+
+/*----------------------------------------------------------------------*
+ * Function:   write_queries
+ * Purpose:    Write the accession and GI query files
+ * Parameters: accessions -> sorted accessions
+ * Returns:    None
+ *----------------------------------------------------------------------*/
+void write_queries(char* accessions)
+{
+    FILE* fp;
+    char* lines;
+    uint64_t* queries;
+    uint64_t i;
+
+    queries = pick_queries(accession_count);
+    lines = malloc((query_count + 1) * ACCESSION_WIDTH);
+    if (!lines) {
+        printf("Error: couldn't allocate memory.\n");
+        exit(1);
+    }
+    for (i=0; i<query_count; i++) {
+        if (queries[i] < accession_count) {
+            strcpy(lines + (i * ACCESSION_WIDTH), accessions + (queries[i] * ACCESSION_WIDTH));
+        } else {
+            sprintf(lines + (i * ACCESSION_WIDTH), "ZZ%09lu", (unsigned long)queries[i]);
+        }
+    }
+    if (sorted_queries) {
+        qsort(lines, query_count, ACCESSION_WIDTH, compare_accessions);
+    }
+    fp = open_file("queries_acc.txt");
+    for (i=0; i<query_count; i++) {
+        fprintf(fp, "%s\n", lines + (i * ACCESSION_WIDTH));
+    }
+    close_file(fp);
+    free(lines);
+    free(queries);
+
+    queries = pick_queries(gi_count);
+    for (i=0; i<query_count; i++) {
+        queries[i] = (queries[i] * 3) + 1;
+    }
+    if (sorted_queries) {
+        qsort(queries, query_count, sizeof(uint64_t), compare_numbers);
+    }
+    fp = open_file("queries_gi.txt");
+    for (i=0; i<query_count; i++) {
+        fprintf(fp, "%lu\n", (unsigned long)queries[i]);
+    }
+    close_file(fp);
+    free(queries);
+}
+
+/*----------------------------------------------------------------------*
+ * Function:   main
+ * Purpose:    Entry point to program
+ * Parameters: argc = number of arguments
+ *             argv -> array of arguments
+ * Returns:    Exit status
+ *----------------------------------------------------------------------*/
+int main(int argc, char* argv[])
+{
+    char* accessions;
+
+    parse_command_line(argc, argv);
+    random_state = ((uint64_t)seed * 0x9E3779B97F4A7C15ULL) | 1;
+    mkdir(output_dir, 0755);
+
+    write_taxonomy();
+    write_accessions(&accessions);
+    write_gis();
+    write_queries(accessions);
+
+    free(accessions);
+    free(species_nodes);
+    printf("Done. %u nodes, %lu accessions, %lu GIs, %lu queries of each type.\n", node_count, accession_count, gi_count, query_count);
+
+    return 0;
+}
@@ -0,0 +1,6163 @@
+/*----------------------------------------------------------------------*
+ * File:    libacc2tax.c
+ * Author:  Richard Leggett (richard.leggett@tgac.ac.uk)
+ * Purpose: Load NCBI taxonomy databases and convert GI or accession
+ *          to taxonomy. All state is held in an Acc2TaxDB handle.
+ * Created: 10 Jan 2013
+ *----------------------------------------------------------------------*/
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdarg.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <pthread.h>
+#include <sched.h>
+#include <time.h>
+#include <sys/syscall.h>
+#include <linux/mempolicy.h>
+#include <zlib.h>
+#include "acc2tax.h"
+
+/*----------------------------------------------------------------------*
+ * Constants
+ *----------------------------------------------------------------------*/
+#define GI_PAGE_BITS 16
+#define GI_PAGE_SIZE (1 << GI_PAGE_BITS)
+#define MAX_NAMES 5000000
+#define MAX_PATH 10000
+#define MAX_FILENAME (MAX_PATH + 64)
+#define MAX_LINE_LENGTH 10000
+#define INDEX_MAGIC "A2TIDX"
+#define INDEX_VERSION 2
+#define MAX_KEY_WIDTH 128
+#define PACKED_KEY_CHARS 21
+#define SNAPSHOT_MAGIC "A2TSNAP"
+#define SNAPSHOT_VERSION 3
+#define SNAPSHOT_HAS_GI 1
+#define SNAPSHOT_PROTEIN 2
+#define BATCH_CHUNK 65536
+#define MAX_SORT_RUNS 512
+#define FENCE_MAGIC "A2TFENC"
+#define FENCE_VERSION 1
+#define MAX_FENCE_INTERVAL (64 * 1024 * 1024)
+#define MAX_SORT_THREADS 64
+#define DMP_BLOCK_SIZE (4 * 1024 * 1024)
+#define GI_DIRECTORY_SIZE (1u << (32 - GI_PAGE_BITS))
+#define MAX_LOAD_THREADS 64
+#define MIN_GI_CHUNK_SIZE (16 * 1024 * 1024)
+#define MAX_RANKS 256
+#define MAX_RANK_NAME 32
+#define STANDARD_RANK_COUNT 9
+#define MAX_LINEAGE_DEPTH 1024
+#define LCA_BLOCK_BITS 5
+#define LCA_BLOCK_SIZE (1 << LCA_BLOCK_BITS)
+#define LCA_NONE UINT32_MAX
+#define CACHE_WAYS 8
+#define ASYNC_WINDOW 256
+#define ASYNC_READAHEAD (128 * 1024)
+#define ASYNC_SHARED_PROBES 8
+#define SHARD_MAGIC "A2TSHRD"
+#define SHARD_VERSION 1
+#define MAX_SHARDS 4096
+#define FILTER_MAGIC "A2TBLOM"
+#define FILTER_VERSION 1
+#define FILTER_BLOCK_WORDS 8
+#define MAX_FILTER_HASHES 7
+#define MAX_FILTER_BITS 64
+#define HUGE_PAGE_SIZE (2 * 1024 * 1024)
+#define MAX_NUMA_NODES 64
+#define MAX_NUMA_NODE_ID 1024
+#define NODE_MASK_BITS (8 * sizeof(unsigned long))
+#define MAX_PLACED_TABLES (2 * MAX_NUMA_NODES + 16)
+
+/*----------------------------------------------------------------------*
+ * Ranks that can be looked up directly with acc2tax_rank_ancestor
+ *----------------------------------------------------------------------*/
+static const char* standard_ranks[STANDARD_RANK_COUNT] = {
+    "domain", "superkingdom", "kingdom", "phylum", "class", "order", "family", "genus", "species"
+};
+
+/*----------------------------------------------------------------------*
+ * Binary accession index header. The header is followed by count packed
+ * 128-bit keys (see pack_accession) and a parallel array of count 32-bit
+ * taxids. Accessions that can't be packed follow as fallback_count keys
+ * of key_width bytes each (NUL padded) and their taxids. Both tables
+ * are sorted as strcmp would sort the accessions.
+ *----------------------------------------------------------------------*/
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t key_width;
+    uint64_t count;
+    uint64_t fallback_count;
+} IndexHeader;
+
+/*----------------------------------------------------------------------*
+ * Accession packed into an integer key
+ *----------------------------------------------------------------------*/
+typedef struct {
+    uint64_t hi;
+    uint64_t lo;
+} PackedKey;
+
+/*----------------------------------------------------------------------*
+ * One table of an accession index - packed keys or fallback strings
+ *----------------------------------------------------------------------*/
+typedef struct {
+    int packed;
+    uint32_t key_size;
+    uint64_t count;
+    uint64_t keys_offset;
+    uint64_t taxids_offset;
+} IndexTable;
+
+/*----------------------------------------------------------------------*
+ * Slot of the in-memory accession table. Empty slots have key.hi of 0.
+ *----------------------------------------------------------------------*/
+typedef struct {
+    PackedKey key;
+    uint32_t taxid;
+    uint32_t unused;
+} HashEntry;
+
+/*----------------------------------------------------------------------*
+ * Remembered result of an accession lookup. Empty entries have key.hi
+ * of 0.
+ *----------------------------------------------------------------------*/
+typedef struct {
+    PackedKey key;
+    uint32_t taxid;
+    uint8_t found;
+    uint8_t referenced;
+} CacheEntry;
+
+/*----------------------------------------------------------------------*
+ * Set of the lookup cache. An accession can only be held in the set its
+ * hash picks, and the set's entries are replaced in CLOCK order.
+ *----------------------------------------------------------------------*/
+typedef struct {
+    CacheEntry entries[CACHE_WAYS];
+    uint8_t hand;
+    uint8_t lock;
+} CacheSet;
+
+/*----------------------------------------------------------------------*
+ * Accession prepared for comparing with keys of an index table
+ *----------------------------------------------------------------------*/
+typedef struct {
+    int packed;
+    PackedKey packed_key;
+    size_t length;
+    char key[MAX_KEY_WIDTH];
+} IndexQuery;
+
+/*----------------------------------------------------------------------*
+ * Binary taxonomy snapshot header. Each section is stored at an 8 byte
+ * aligned offset from the start of the file so the file can be mapped
+ * and used in place. The GI table is stored as a directory of 1-based
+ * page numbers (0 for an empty page) followed by the populated pages.
+ * Node ranks are one byte per node, indexing rank names of MAX_RANK_NAME
+ * bytes each.
+ *----------------------------------------------------------------------*/
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t flags;
+    uint64_t nodes_offset;
+    uint64_t nodes_count;
+    uint64_t name_offsets_offset;
+    uint64_t name_offsets_count;
+    uint64_t names_offset;
+    uint64_t names_size;
+    uint64_t gi_directory_offset;
+    uint64_t gi_directory_count;
+    uint64_t gi_pages_offset;
+    uint64_t gi_pages_count;
+    uint64_t ranks_offset;
+    uint64_t ranks_count;
+    uint64_t rank_names_offset;
+    uint64_t rank_names_count;
+} SnapshotHeader;
+
+/*----------------------------------------------------------------------*
+ * Fence file header. The header is followed by count FenceEntry records
+ * and then keys_size bytes of NUL terminated keys.
+ *----------------------------------------------------------------------*/
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t interval;
+    uint64_t file_size;
+    uint64_t file_mtime;
+    uint64_t count;
+    uint64_t keys_size;
+} FenceHeader;
+
+/*----------------------------------------------------------------------*
+ * Bloom filter file header, written alongside an index. The header is
+ * followed by block_count blocks of FILTER_BLOCK_WORDS 64-bit words. Each
+ * key sets hashes bits within one block, so a lookup touches one cache
+ * line. index_size and index_mtime identify the index it was built with.
+ *----------------------------------------------------------------------*/
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t hashes;
+    uint32_t bits_per_key;
+    uint32_t unused;
+    uint64_t block_count;
+    uint64_t key_count;
+    uint64_t index_size;
+    uint64_t index_mtime;
+} FilterHeader;
+
+/*----------------------------------------------------------------------*
+ * Sampled key of the accession file - the record at offset starts with
+ * the key at offset key of the fence key arena
+ *----------------------------------------------------------------------*/
+typedef struct {
+    uint64_t offset;
+    uint32_t key;
+    uint32_t unused;
+} FenceEntry;
+
+/*----------------------------------------------------------------------*
+ * Cached lineage string for a node
+ *----------------------------------------------------------------------*/
+typedef struct {
+    size_t length;
+    char string[];
+} Lineage;
+
+/*----------------------------------------------------------------------*
+ * One query of a batch lookup, sorted by accession
+ *----------------------------------------------------------------------*/
+typedef struct {
+    const char* accession;
+    size_t index;
+} BatchQuery;
+
+/*----------------------------------------------------------------------*
+ * Binary search of the index in progress in an asynchronous batch. Once
+ * the key matches, the next read is of its taxid.
+ *----------------------------------------------------------------------*/
+typedef struct {
+    IndexQuery query;
+    IndexTable* table;
+    int64_t min;
+    int64_t max;
+    int64_t current;
+    size_t index;
+    int matched;
+    int prefetched;
+    int depth;
+} AsyncSearch;
+
+/*----------------------------------------------------------------------*
+ * Slice of records sorted by one thread when building the database
+ *----------------------------------------------------------------------*/
+typedef struct {
+    char** lines;
+    size_t n;
+} SortSlice;
+
+/*----------------------------------------------------------------------*
+ * Sorted records being merged - either a slice in memory or a run file
+ *----------------------------------------------------------------------*/
+typedef struct {
+    char* line;
+    char** next;
+    char** end;
+    FILE* fp;
+    char* buffer;
+} MergeSource;
+
+/*----------------------------------------------------------------------*
+ * Block reader for .dmp files - lines are split in place in the buffer
+ *----------------------------------------------------------------------*/
+typedef struct {
+    int fd;
+    char* buffer;
+    size_t size;
+    size_t start;
+    size_t end;
+    uint64_t buffer_offset;
+    uint64_t limit;
+    int skip_partial;
+    int eof;
+    int error;
+} DmpReader;
+
+/*----------------------------------------------------------------------*
+ * Byte range of the GI file parsed by one thread
+ *----------------------------------------------------------------------*/
+typedef struct {
+    Acc2TaxDB* db;
+    const char* filename;
+    uint64_t begin;
+    uint64_t end;
+    int result;
+} GiChunk;
+
+/*----------------------------------------------------------------------*
+ * One database file loaded by its own thread at startup
+ *----------------------------------------------------------------------*/
+typedef struct {
+    Acc2TaxDB* db;
+    int (*load)(Acc2TaxDB* db);
+    double* seconds;
+    pthread_t thread;
+    int started;
+    int result;
+} LoadTask;
+
+/*----------------------------------------------------------------------*
+ * Record of a delta file, at offset in the delta text until the text is
+ * complete and line can be set
+ *----------------------------------------------------------------------*/
+typedef struct {
+    char* line;
+    size_t offset;
+    size_t sequence;
+} DeltaRecord;
+
+/*----------------------------------------------------------------------*
+ * Index shard listed in a shard manifest. The shard holds accessions
+ * from first_key up to the next shard's first key, and is opened as a
+ * handle of its own when first needed.
+ *----------------------------------------------------------------------*/
+typedef struct {
+    char first_key[MAX_KEY_WIDTH + 1];
+    char filename[MAX_FILENAME];
+    Acc2TaxDB* db;
+    int failed;
+} ShardEntry;
+
+/*----------------------------------------------------------------------*
+ * Table copied into memory mapped with the chosen page size and NUMA
+ * policy, unmapped when the handle is closed
+ *----------------------------------------------------------------------*/
+typedef struct {
+    void* data;
+    size_t size;
+} PlacedTable;
+
+/*----------------------------------------------------------------------*
+ * Database handle
+ *----------------------------------------------------------------------*/
+struct Acc2TaxDB {
+    char database_dir[MAX_PATH];
+    int is_protein;
+    int has_gi;
+    FILE* log_fp;
+    int load_threads;
+    long int memory_required;
+    int collect_stats;
+    int shares_taxonomy;
+    Acc2TaxStats stats;
+    int huge_pages;
+    int numa_placement;
+    int numa_nodes;
+    int memory_nodes[MAX_NUMA_NODES];
+    int* cpu_replicas;
+    int cpu_count;
+    PlacedTable placed_tables[MAX_PLACED_TABLES];
+    int placed_count;
+    unsigned int** gi_pages;
+    unsigned int** gi_replicas[MAX_NUMA_NODES];
+    int gi_replica_count;
+    unsigned int gi_directory_size;
+    unsigned int gi_pages_used;
+    char* name_arena;
+    size_t name_arena_size;
+    size_t name_arena_used;
+    uint32_t* name_offsets;
+    unsigned int name_offsets_size;
+    unsigned int* nodes;
+    unsigned int nodes_size;
+    uint8_t* node_ranks;
+    char rank_names[MAX_RANKS][MAX_RANK_NAME];
+    unsigned int rank_count;
+    int standard_rank_of[MAX_RANKS];
+    uint32_t* rank_ancestors;
+    unsigned int rank_ancestors_size;
+    uint32_t* euler_nodes;
+    uint16_t* euler_depths;
+    uint32_t* euler_masks;
+    uint64_t euler_size;
+    uint32_t* euler_first;
+    unsigned int euler_first_size;
+    uint32_t* block_minima;
+    uint64_t block_count;
+    int block_levels;
+    Lineage** lineages;
+    void* snapshot_map;
+    size_t snapshot_size;
+    char acc_filename[MAX_FILENAME];
+    FILE* acc_fp;
+    long int acc_file_size;
+    char* acc_map;
+    FILE* index_fp;
+    IndexHeader index_header;
+    IndexTable index_tables[2];
+    int in_memory;
+    HashEntry* hash_entries;
+    uint64_t hash_mask;
+    char* fallback_keys;
+    uint32_t* fallback_taxids;
+    CacheSet* cache_sets;
+    uint64_t cache_mask;
+    unsigned int lookup_cache_size;
+    uint64_t* filter_blocks;
+    uint64_t filter_block_count;
+    uint32_t filter_hashes;
+    ShardEntry* shards;
+    int shard_count;
+    pthread_mutex_t shard_mutex;
+    unsigned int fence_interval;
+    FenceEntry* fences;
+    size_t fence_count;
+    size_t fences_size;
+    char* fence_keys;
+    size_t fence_keys_used;
+    size_t fence_keys_size;
+};
+
+/*----------------------------------------------------------------------*
+ * Function:   log_message
+ * Purpose:    Write a progress or error message, if logging is enabled
+ * Parameters: log_fp -> log file, or NULL
+ *             format -> printf format, followed by arguments
+ * Returns:    None
+ *----------------------------------------------------------------------*/
+static void log_message(FILE* log_fp, const char* format, ...)
+{
+    va_list args;
+
+    if (log_fp) {
+        va_start(args, format);
+        vfprintf(log_fp, format, args);
+        va_end(args);
+    }
+}
+
+/*----------------------------------------------------------------------*
+ * Function:   get_seconds
+ * Purpose:    Read the monotonic clock, for timing load phases
+ * Parameters: None
+ * Returns:    Time in seconds
+ *----------------------------------------------------------------------*/
+static double get_seconds(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec + (ts.tv_nsec / 1e9);
+}
+
+/*----------------------------------------------------------------------*
+ * Function:   add_stat
+ * Purpose:    Add to a lookup counter, if counters are being collected.
+ *             Lookups run in several threads, so the add is atomic.
+ * Parameters: db -> database handle
+ *             counter -> counter in db->stats
+ *             n = amount to add
+ * Returns:    None
+ *----------------------------------------------------------------------*/
+static inline void add_stat(Acc2TaxDB* db, uint64_t* counter, uint64_t n)
+{
+    if (db->collect_stats) {
+        __atomic_add_fetch(counter, n, __ATOMIC_RELAXED);
+    }
+}
+
+/*----------------------------------------------------------------------*
+ * Function:   allocate_memory
+ * Purpose:    Allocate memory to store tables
+ * Parameters: db -> database handle
+ * Returns:    1 on success, 0 on failure
+ *----------------------------------------------------------------------*/
+static int allocate_memory(Acc2TaxDB* db)
+{
+    db->memory_required+=(MAX_NAMES * sizeof(int*));
+    log_message(db->log_fp, "Allocating memory for nodes list (%d entries)\n", MAX_NAMES);
+    db->nodes = calloc(MAX_NAMES, sizeof(int*));
+    if (!db->nodes) {
+        log_message(db->log_fp, "Error: couldn't allocate memory.\n");
+        return 0;
+    }
+    db->nodes_size = MAX_NAMES;
+
+    db->memory_required += MAX_NAMES;
+    db->node_ranks = calloc(MAX_NAMES, sizeof(uint8_t));
+    if (!db->node_ranks) {
+        log_message(db->log_fp, "Error: couldn't allocate memory.\n");
+        return 0;
+    }
+    db->rank_count = 1;
+
+    log_message(db->log_fp, "Total memory required %ld Mb\n", db->memory_required / (1024*1025));
+
+    return 1;
+}
+
+/*----------------------------------------------------------------------*
+ * Function:   allocate_lineage_cache
+ * Purpose:    Allocate lineage cache once the node table size is known
+ * Parameters: db -> database handle
+ * Returns:    1 on success, 0 on failure
+ *----------------------------------------------------------------------*/
+static int allocate_lineage_cache(Acc2TaxDB* db)
+{
+    db->memory_required+=(db->nodes_size * sizeof(Lineage*));
+    log_message(db->log_fp, "Allocating memory for lineage cache (%u entries)\n", db->nodes_size);
+    db->lineages = calloc(db->nodes_size + 1, sizeof(Lineage*));
+    if (!db->lineages) {
+        log_message(db->log_fp, "Error: couldn't allocate memory.\n");
+        return 0;
+    }
+
+    return 1;
+}
+
+/*----------------------------------------------------------------------*
+ * Function:   allocate_lookup_cache
+ * Purpose:    Allocate the accession lookup cache, rounded up to a power
+ *             of two sets
+ * Parameters: db -> database handle
+ *             entries = number of results to remember
+ * Returns:    1 on success, 0 on failure
+ *----------------------------------------------------------------------*/
+static int allocate_lookup_cache(Acc2TaxDB* db, unsigned int entries)
+{
+    uint64_t sets = 1;
+
+    while (sets * CACHE_WAYS < entries) {
+        sets *= 2;
+    }
+
+    db->memory_required += sets * sizeof(CacheSet);
+    log_message(db->log_fp, "Allocating memory for lookup cache (%lu entries)\n", (unsigned long)(sets * CACHE_WAYS));
+    db->cache_sets = calloc(sets, sizeof(CacheSet));
+    if (!db->cache_sets) {
+        log_message(db->log_fp, "Error: couldn't allocate memory.\n");
+        return 0;
+    }
+    db->cache_mask = sets - 1;
+
+    return 1;
+}
+
+/*----------------------------------------------------------------------*
+ * Function:   parse_id_list
+ * Purpose:    Parse a sysfs list of IDs, such as 0-3,8-11
+ * Parameters: list -> list
+ *             ids -> array to store IDs in
+ *             max_ids = size of ids array
+ * Returns:    Number of IDs stored
+ *----------------------------------------------------------------------*/
+static int parse_id_list(const char* list, int* ids, int max_ids)
+{
+    const char* cursor = list;
+    int n = 0;
+
+    while (*cursor) {
+        char* end;
+        long int first = strtol(cursor, &end, 10);
+        long int last = first;
+        long int id;
+
+        if (end == cursor) {
+            break;
+        }
+        if (*end == '-') {
+            cursor = end + 1;
+            last = strtol(cursor, &end, 10);
+        }
+        for (id=first; (id<=last) && (n<max_ids); id++) {
+            ids[n++] = id;
+        }
+        cursor = (*end == ',') ? end + 1 : end;
+    }
+
+    return n;
+}
+
+/*----------------------------------------------------------------------*
+ * Function:   read_numa_topology
+ * Purpose:    Find the NUMA nodes with memory, and which of them each CPU
+ *             is on, from sysfs. Without sysfs there is one node.
+ * Parameters: db -> database handle
+ * Returns:    None
+ *----------------------------------------------------------------------*/
+static void read_numa_topology(Acc2TaxDB* db)
+{
+    char filename[128];
+    char list[4096];
+    int* cpus;
+    FILE* fp;
+    int i;
+
+    db->numa_nodes = 0;
+    fp = fopen("/sys/devices/system/node/has_memory", "r");
+    if (fp) {
+        if (fgets(list, sizeof(list), fp)) {
+            int ids[MAX_NUMA_NODES];
+            int n = parse_id_list(list, ids, MAX_NUMA_NODES);
+
+            // Node masks for mbind only go up to MAX_NUMA_NODE_ID
+            for (i=0; i<n; i++) {
+                if ((ids[i] >= 0) && (ids[i] < MAX_NUMA_NODE_ID)) {
+                    db->memory_nodes[db->numa_nodes++] = ids[i];
+                }
+            }
+        }
+        fclose(fp);
+    }
+    if (db->numa_nodes < 1) {
+        db->numa_nodes = 1;
+        db->memory_nodes[0] = 0;
+    }
+
+    db->cpu_count = sysconf(_SC_NPROCESSORS_CONF);
+    if (db->cpu_count < 1) {
+        db->cpu_count = 1;
+    }
+    db->cpu_replicas = calloc(db->cpu_count, sizeof(int));
+    cpus = malloc(db->cpu_count * sizeof(int));
+    if ((!db->cpu_replicas) || (!cpus)) {
+        free(cpus);
+        return;
+    }
+
+    // CPUs of nodes without memory stay with the first node
+    for (i=0; i<db->numa_nodes; i++) {
+        sprintf(filename, "/sys/devices/system/node/node%d/cpulist", db->memory_nodes[i]);
+        fp = fopen(filename, "r");
+        if (fp) {
+            if (fgets(list, sizeof(list), fp)) {
+                int n = parse_id_list(list, cpus, db->cpu_count);
+                int j;
+
+                for (j=0; j<n; j++) {
+                    if ((cpus[j] >= 0) && (cpus[j] < db->cpu_count)) {
+                        db->cpu_replicas[cpus[j]] = i;
+                    }
+                }
+            }
+            fclose(fp);
+        }
+    }
+
+    free(cpus);
+}
+
+/*----------------------------------------------------------------------*
+ * Function:   get_replica
+ * Purpose:    Find which replica of a replicated table is on the NUMA
+ *             node of the calling thread's CPU
+ * Parameters: db -> database handle
+ * Returns:    Replica number
+ *----------------------------------------------------------------------*/
+static inline int get_replica(Acc2TaxDB* db)
+{
+    int cpu = sched_getcpu();
+
+    return ((cpu >= 0) && (cpu < db->cpu_count) && (db->cpu_replicas)) ? db->cpu_replicas[cpu] : 0;
+}
+
+/*----------------------------------------------------------------------*
+ * Function:   bind_memory
+ * Purpose:    Set the NUMA policy of a mapping before it is touched
+ * Parameters: data -> start of mapping
+ *             size = size of mapping
+ *             mode = MPOL_INTERLEAVE or MPOL_PREFERRED
+ *             nodes -> nodes to use
+ *             n_nodes = number of nodes
+ * Returns:    1 on success, 0 on failure
+ *----------------------------------------------------------------------*/
+static int bind_memory(void* data, size_t size, int mode, const int* nodes, int n_nodes)
+{
+#ifdef SYS_mbind
+    unsigned long mask[MAX_NUMA_NODE_ID / NODE_MASK_BITS];
+    int max_node = -1;
+    int i;
+
+    memset(mask, 0, sizeof(mask));
+    for (i=0; i<n_nodes; i++) {
+        if ((nodes[i] >= 0) && (nodes[i] < MAX_NUMA_NODE_ID)) {
+            mask[nodes[i] / NODE_MASK_BITS] |= 1UL << (nodes[i] % NODE_MASK_BITS);
+            if (nodes[i] > max_node) {
+                max_node = nodes[i];
+            }
+        }
+    }
+    if (max_node < 0) {
+        return 0;
+    }
+
+    // The kernel takes one more than the number of bits in the mask
+    return syscall(SYS_mbind, data, size, mode, mask, max_node + 2, 0) == 0;
+#else
+    return 0;
+#endif
+}
+
+/*----------------------------------------------------------------------*
+ * Function:   allocate_placed
+ * Purpose:    Map memory for a table with the page size and NUMA policy
+ *             of the handle. The stats record what was actually got -
+ *             explicit huge pages fall back to transparent ones, and a
+ *             failed NUMA policy to the default.
+ * Parameters: db -> database handle
+ *             size = bytes needed
+ *             replica = replica number to place on its NUMA node, or -1
+ *                       to interleave (if chosen)
+ * Returns:    Pointer to zeroed memory, or NULL on failure
+ *----------------------------------------------------------------------*/
+static void* allocate_placed(Acc2TaxDB* db, size_t size, int replica)
+{
+    size_t rounded = (size + HUGE_PAGE_SIZE - 1) & ~(size_t)(HUGE_PAGE_SIZE - 1);
+    void* data = MAP_FAILED;
+    int bound = 1;
+
+    if (db->placed_count == MAX_PLACED_TABLES) {
+        return NULL;
+    }
+
+    if (db->stats.huge_pages == ACC2TAX_PAGES_EXPLICIT) {
+        data = mmap(NULL, rounded, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        if (data == MAP_FAILED) {
+            log_message(db->log_fp, "Warning: not enough explicit huge pages reserved for %lu Mb, using transparent huge pages\n", (unsigned long)(rounded / (1024 * 1024)));
+            db->stats.huge_pages = ACC2TAX_PAGES_TRANSPARENT;
+        }
+    }
+
+    if (data == MAP_FAILED) {
+        data = mmap(NULL, rounded, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (data == MAP_FAILED) {
+            return NULL;
+        }
+        if (db->huge_pages != ACC2TAX_PAGES_DEFAULT) {
+            madvise(data, rounded, MADV_HUGEPAGE);
+        }
+    }
+
+    if (replica >= 0) {
+        bound = bind_memory(data, rounded, MPOL_PREFERRED, &db->memory_nodes[replica], 1);
+    } else if (db->stats.numa_placement != ACC2TAX_NUMA_DEFAULT) {
+        bound = bind_memory(data, rounded, MPOL_INTERLEAVE, db->memory_nodes, db->numa_nodes);
+    }
+    if ((!bound) && (db->stats.numa_placement != ACC2TAX_NUMA_DEFAULT)) {
+        log_message(db->log_fp, "Warning: couldn't set NUMA policy, using default placement\n");
+        db->stats.numa_placement = ACC2TAX_NUMA_DEFAULT;
+    }
+
+    db->placed_tables[db->placed_count].data = data;
+    db->placed_tables[db->placed_count].size = rounded;
+    db->placed_count++;
+    db->stats.placed_bytes += size;
+
+    return data;
+}
+
+/*----------------------------------------------------------------------*
+ * Function:   is_placed
+ * Purpose:    Check whether a table is in placed memory, or in the
+ *             snapshot mapping, rather than allocated with malloc
+ * Parameters: db -> database handle
+ *             table -> table
+ * Returns:    1 if the table mustn't be freed, 0 otherwise
+ *----------------------------------------------------------------------*/
+static int is_placed(Acc2TaxDB* db, void* table)
+{
+    char* address = table;
+    int i;
+
+    if ((db->snapshot_map) && (address >= (char*)db->snapshot_map) && (address < (char*)db->snapshot_map + db->snapshot_size)) {
+        return 1;
+    }
+
+    for (i=0; i<db->placed_count; i++) {
+        char* data = db->placed_tables[i].data;
+
+        if ((address >= data) && (address < data + db->placed_tables[i].size)) {
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+/*----------------------------------------------------------------------*
+ * Function:   release_table
+ * Purpose:    Free a table unless it is placed or in the snapshot, which
+ *             are unmapped as a whole
+ * Parameters: db -> database handle
+ *             table -> table, or NULL
+ * Returns:    None
+ *----------------------------------------------------------------------*/
+static void release_table(Acc2TaxDB* db, void* table)
+{
+    if ((table) && (!is_placed(db, table))) {
+        free(table);
+    }
+}
+
+/*----------------------------------------------------------------------*
+ * Function:   place_table
+ * Purpose:    Copy a table into placed memory, releasing the original.
+ *             If memory can't be mapped, the original is kept.
+ * Parameters: db -> database handle
+ *             table -> table, or NULL
+ *             size = size of table
+ * Returns:    Pointer to table to use
+ *----------------------------------------------------------------------*/
+static void* place_table(Acc2TaxDB* db, void* table, size_t size)
+{
+    void* placed;
+
+    if ((!table) || (size == 0)) {
+        return table;
+    }
+
+    placed = allocate_placed(db, size, -1);
+    if (!placed) {
+        log_message(db->log_fp, "Warning: couldn't map %lu bytes for placement, leaving table as it is\n", (unsigned long)size);
+        return table;
+    }
+
+    memcpy(placed, table, size);
+    release_table(db, table);
+
+    return placed;
+}
+
+/*----------------------------------------------------------------------*
+ * Function:   place_gi_table
+ * Purpose:    Copy the GI directory and its pages into one placed block,
+ *             or one per NUMA node when replicating
+ * Parameters: db -> database handle
+ * Returns:    None
+ *----------------------------------------------------------------------*/
+static void place_gi_table(Acc2TaxDB* db)
+{
+    size_t directory_size = (((size_t)db->gi_directory_size * sizeof(unsigned int*)) + 63) & ~(size_t)63;
+    size_t pages_size = (size_t)db->gi_pages_used * GI_PAGE_SIZE * sizeof(unsigned int);
+    int replicas = db->stats.numa_placement == ACC2TAX_NUMA_REPLICATE ? db->numa_nodes : 1;
+    unsigned int** old = db->gi_pages;
+    unsigned int page;
+    int r;
+
+    if ((!db->gi_pages) || (db->gi_pages_used == 0)) {
+        return;
+    }
+
+    for (r=0; r<replicas; r++) {
+        char* block = allocate_placed(db, directory_size + pages_size, replicas > 1 ? r : -1);
+        unsigned int** directory = (unsigned int**)block;
+        unsigned int* pages = (unsigned int*)(block + directory_size);
+
+        if (!block) {
+            log_message(db->log_fp, "Warning: couldn't map memory for GI table replica %d\n", r);
+            break;
+        }
+
+        for (page=0; page<db->gi_directory_size; page++) {
+            if (old[page]) {
+                memcpy(pages, old[page], GI_PAGE_SIZE * sizeof(unsigned int));
+                directory[page] = pages;
+                pages += GI_PAGE_SIZE;
+            }
+        }
+        db->gi_replicas[r] = directory;
+    }
+
+    if (r == 0) {
+        return;
+    }
+
+    // CPUs on nodes that didn't get a replica read the first one
+    if ((r < replicas) && (db->cpu_replicas)) {
+        int cpu;
+
+        for (cpu=0; cpu<db->cpu_count; cpu++) {
+            if (db->cpu_replicas[cpu] >= r) {
+                db->cpu_replicas[cpu] = 0;
+            }
+        }
+        log_message(db->log_fp, "Warning: only %d of %d GI table replicas made, CPUs on the other nodes will use replica 0\n", r, replicas);
+    }
+
+    for (page=0; page<db->gi_directory_size; page++) {
+        release_table(db, old[page]);
+    }
+    release_table(db, old);
+
+    db->gi_pages = db->gi_replicas[0];
+    db->gi_replica_count = r;
+    __atomic_add_fetch(&db->memory_required, (r - 1) * (directory_size + pages_size), __ATOMIC_RELAXED);
+}
+
+/*----------------------------------------------------------------------*
+ * Function:   place_tables
+ * Purpose:    Move the large randomly accessed tables owned by a handle
+ *             into memory with the chosen page size and NUMA placement
+ * Parameters: db -> database handle
+ * Returns:    None
+ *----------------------------------------------------------------------*/
+static void place_tables(Acc2TaxDB* db)
+{
+    const char* page_names[] = {"default", "transparent", "explicit"};
+    const char* numa_names[] = {"default", "interleave", "replicate"};
+
+    if ((db->huge_pages == ACC2TAX_PAGES_DEFAULT) && (db->numa_placement == ACC2TAX_NUMA_DEFAULT)) {
+        return;
+    }
+
+    if (!db->cpu_replicas) {
+        read_numa_topology(db);
+    }
+    db->stats.huge_pages = db->huge_pages;
+    db->stats.numa_placement = db->numa_nodes > 1 ? db->numa_placement : ACC2TAX_NUMA_DEFAULT;
+    db->stats.numa_nodes = db->numa_nodes;
+
+    if (!db->shares_taxonomy) {
+        db->nodes = place_table(db, db->nodes, (size_t)db->nodes_size * sizeof(unsigned int));
+        db->node_ranks = place_table(db, db->node_ranks, db->nodes_size);
+        db->name_offsets = place_table(db, db->name_offsets, (size_t)db->name_offsets_size * sizeof(uint32_t));
+        db->name_arena = place_table(db, db->name_arena, db->name_arena_used);
+        db->name_arena_size = db->name_arena_used;
+        db->rank_ancestors = place_table(db, db->rank_ancestors, (size_t)db->rank_ancestors_size * STANDARD_RANK_COUNT * sizeof(uint32_t));
+        db->euler_nodes = place_table(db, db->euler_nodes, db->euler_size * sizeof(uint32_t));
+        db->euler_depths = place_table(db, db->euler_depths, db->euler_size * sizeof(uint16_t));
+        db->euler_masks = place_table(db, db->euler_masks, db->euler_size * sizeof(uint32_t));
+        db->euler_first = place_table(db, db->euler_first, (size_t)db->euler_first_size * sizeof(uint32_t));
+        db->block_minima = place_table(db, db->block_minima, db->block_count * db->block_levels * sizeof(uint32_t));
+    }
+    place_gi_table(db);
+    if (db->hash_entries) {
+        db->hash_entries = place_table(db, db->hash_entries, (db->hash_mask + 1) * sizeof(HashEntry));
+    }
+
+    log_message(db->log_fp, "Placed %lu Mb of tables - huge pages %s, NUMA placement %s over %d node%s\n",
+                (unsigned long)(db->stats.placed_bytes / (1024 * 1024)), page_names[db->stats.huge_pages],
+                numa_names[db->stats.numa_placement], db->numa_nodes, db->numa_nodes == 1 ? "" : "s");
+}
+
+/*----------------------------------------------------------------------*
+ * Function:   set_gi_node
+ * Purpose:    Store node for a GI in the paged GI table. The directory
+ *             covers every 32-bit GI and pages are allocated on first
+ *             use, so ranges of GIs with no entries cost no memory.
+ *             Safe to call from several threads loading disjoint GIs.
+ * Parameters: db -> database handle
+ *             gi = GI
+ *             node = node ID
+ * Returns:    1 on success, 0 on failure
+ *----------------------------------------------------------------------*/
+static int set_gi_node(Acc2TaxDB* db, unsigned int gi, unsigned int node)
+{
+    unsigned int page = gi >> GI_PAGE_BITS;
+    unsigned int* entries = __atomic_load_n(&db->gi_pages[page], __ATOMIC_ACQUIRE);
+
+    if (!entries) {
+        unsigned int* expected = NULL;
+
+        entries = calloc(GI_PAGE_SIZE, sizeof(unsigned int));
+        if (!entries) {
+            log_message(db->log_fp, "Error: couldn't allocate memory.\n");
+            return 0;
+        }
+
+        // Another thread may have allocated the page first
+        if (__atomic_compare_exchange_n(&db->gi_pages[page], &expected, entries, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+            __atomic_add_fetch(&db->gi_pages_used, 1, __ATOMIC_RELAXED);
+        } else {
+            free(entries);
+            entries = expected;
+        }
+    }
+
+    entries[gi & (GI_PAGE_SIZE - 1)] = node;
+
+    return 1;
+}
+
+/*----------------------------------------------------------------------*
+ * Function:   get_gi_node
+ * Purpose:    Look up node for a GI in the paged GI table
+ * Parameters: db -> database handle
+ *             gi = GI
+ * Returns:    Node, or 0 if GI not in table
+ *----------------------------------------------------------------------*/
+static unsigned int get_gi_node(Acc2TaxDB* db, unsigned int gi)
+{
+    unsigned int page = gi >> GI_PAGE_BITS;
+    unsigned int** gi_pages = db->gi_replica_count > 1 ? db->gi_replicas[get_replica(db)] : db->gi_pages;
+
+    if ((page >= db->gi_directory_size) || (!gi_pages[page])) {
+        return 0;
+    }
+
+    return gi_pages[page][gi & (GI_PAGE_SIZE - 1)];
+}
+
+/*----------------------------------------------------------------------*
+ * Function:   open_dmp_reader
+ * Purpose:    Open a .dmp file for reading a block at a time
+ * Parameters: reader -> reader to initialise
+ *             filename -> file to open
+ *             log_fp -> log file, or NULL
+ * Returns:    1 on success, 0 on failure
+ *----------------------------------------------------------------------*/
+static int open_dmp_reader(DmpReader* reader, const char* filename, FILE* log_fp)
+{
+    memset(reader, 0, sizeof(DmpReader));
+
+    reader->fd = open(filename, O_RDONLY);
+    if (reader->fd < 0) {
+        log_message(log_fp, "Error: can't open %s\n", filename);
+        return 0;
+    }
+    posix_fadvise(reader->fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+    reader->limit = UINT64_MAX;
+    reader->size = DMP_BLOCK_SIZE;
+    reader->buffer = malloc(reader->size + 1);
+    if (!reader->buffer) {
+        log_message(log_fp, "Error: couldn't allocate memory.\n");
+        close(reader->fd);
+        return 0;
+    }
+
+    return 1;
+}
+
+/*----------------------------------------------------------------------*
+ * Function:   set_dmp_range
+ * Purpose:    Limit a reader to the lines that start within a byte range
+ *             of the file, so that ranges can be read independently
+ * Parameters: reader -> newly opened reader
+ *             begin = offset of start of range
+ *             end = offset of end of range
+ * Returns:    None
+ *----------------------------------------------------------------------*/
+static void set_dmp_range(DmpReader* reader, uint64_t begin, uint64_t end)
+{
+    // Read from the byte before the range and drop up to its first
+    // newline, which belongs to the line before
+    if (begin > 0) {
+        reader->buffer_offset = begin - 1;
+        reader->skip_partial = 1;
+    }
+    reader->limit = end;
+}
+
+/*----------------------------------------------------------------------*
+ * Function:   close_dmp_reader
+ * Purpose:    Close a .dmp file reader
+ * Parameters: reader -> reader
+ * Returns:    None
+ *----------------------------------------------------------------------*/
+static void close_dmp_reader(DmpReader* reader)
+{
+    close(reader->fd);
+    free(reader->buffer);
+}
+
+/*----------------------------------------------------------------------*
+ * Function:   next_dmp_line
+ * Purpose:    Return the next line of a .dmp file. The line stays in the
+ *             reader's buffer, NUL terminated in place of its newline,
+ *             until the next call.
+ * Parameters: reader -> reader
+ *             end -> to store pointer to end of line
+ * Returns:    Pointer to line, or NULL at end of file or on error
+ *----------------------------------------------------------------------*/
+static char* next_dmp_line(DmpReader* reader, char** end)
+{
+    for (;;) {
+        char* line = reader->buffer + reader->start;
+        char* newline = memchr(line, '\n', reader->end - reader->start);
+        ssize_t got;
+
+        if ((!newline) && (reader->eof) && (reader->start < reader->end)) {
+            // Last line has no newline - there is always room for the NUL
+            newline = reader->buffer + reader->end;
+        }
+
+        if (newline) {
+            if (reader->buffer_offset + reader->start >= reader->limit) {
+                return NULL;
+            }
+            reader->start = newline - reader->buffer + 1;
+            if (reader->skip_partial) {
+                reader->skip_partial = 0;
+                continue;
+            }
+            if ((newline > line) && (newline[-1] == '\r')) {
+                newline--;
+            }
+            *newline = 0;
+            *end = newline;
+            return line;
+        }
+
+        if (reader->eof) {
+            return NULL;
+        }
+
+        // Keep the partial line and refill, growing for very long lines
+        if (reader->start > 0) {
+            memmove(reader->buffer, line, reader->end - reader->start);
+            reader->buffer_offset += reader->start;
+            reader->end -= reader->start;
+            reader->start = 0;
+        } else if (reader->end == reader->size) {
+            char* new_buffer = realloc(reader->buffer, reader->size * 2 + 1);
+
+            if (!new_buffer) {
+                reader->error = 1;
+                return NULL;
+            }
+            reader->buffer = new_buffer;
+            reader->size *= 2;
+        }
+
+        got = pread(reader->fd, reader->buffer + reader->end, reader->size - reader->end, reader->buffer_offset + reader->end);
+        if (got < 0) {
+            reader->error = 1;
+            return NULL;
+        } else if (got == 0) {
+            reader->eof = 1;
+        }
+        reader->end += got;
+    }
+}
+
+/*----------------------------------------------------------------------*
+ * Function:   next_dmp_field
+ * Purpose:    Split the next field from a .dmp line. Fields are separated
+ *             by tab, | and tab (or just tab in the GI files), and may
+ *             be empty. The field is NUL terminated in place.
+ * Parameters: cursor -> position in line, advanced past the separator
+ *             end -> end of line
+ * Returns:    Pointer to field, or NULL if no fields remain
+ *----------------------------------------------------------------------*/
+static char* next_dmp_field(char** cursor, char* end)
+{
+    char* field = *cursor;
+    char* tab;
+
+    if (field > end) {
+        return NULL;
+    }
+
+    tab = memchr(field, '\t', end - field);
+    if (!tab) {
+        *cursor = end + 1;
+        return field;
+    }
+
+    *tab = 0;
+    tab++;
+    if ((tab < end) && (*tab == '|')) {
+        tab++;
+        if ((tab < end) && (*tab == '\t')) {
+            tab++;
+        } else if (tab == end) {
+            // Trailing separator ends the line
+            tab = end + 1;
+        }
+    }
+    *cursor = tab;
+
+    return field;
+}
+
+/*----------------------------------------------------------------------*
+ * Function:   parse_dmp_uint
+ * Purpose:    Parse an unsigned integer field
+ * Parameters: field -> NUL terminated field
+ *             value -> to store value
+ * Returns:    1 if field is a number, 0 otherwise
+ *----------------------------------------------------------------------*/
+static int parse_dmp_uint(const char* field, unsigned int* value)
+{
+    unsigned int n = 0;
+
+    if ((*field < '0') || (*field > '9')) {
+        return 0;
+    }
+    while ((*field >= '0') && (*field <= '9')) {
+        n = (n * 10) + (*field++ - '0');
+    }
+    *value = n;
+
+    return 1;
+}
+
+/*----------------------------------------------------------------------*
+ * Function:   load_gi_chunk
+ * Purpose:    Thread to parse one byte range of the GI file
+ * Parameters: arg -> GiChunk
+ * Returns:    NULL
+ *----------------------------------------------------------------------*/
+static void* load_gi_chunk(void* arg)
+{
+    GiChunk* chunk = arg;
+    Acc2TaxDB* db = chunk->db;
+    DmpReader reader;
+    char* line;
+    char* end;
+
+    chunk->result = 0;
+    if (!open_dmp_reader(&reader, chunk->filename, db->log_fp)) {
+        return NULL;
+    }
+    set_dmp_range(&reader, chunk->begin, chunk->end);
+
+    while ((line = next_dmp_line(&reader, &end))) {
+        char* cursor = line;
+        char* gi_str = next_dmp_field(&cursor, end);
+        char* node_id_str = next_dmp_field(&cursor, end);
+        unsigned int gi;
+        unsigned int node_id;
+
+        if ((!node_id_str) || (!parse_dmp_uint(gi_str, &gi)) || (!parse_dmp_uint(node_id_str, &node_id))) {
+            log_message(db->log_fp, "Error: bad line in GI file\n");
+        } else if (!set_gi_node(db, gi, node_id)) {
+            close_dmp_reader(&reader);
+            return NULL;
+        }
+    }
+
+    close_dmp_reader(&reader);
+    if (reader.error) {
+        log_message(db->log_fp, "Error: failed reading %s\n", chunk->filename);
+        return NULL;
+    }
+
+    chunk->result = 1;
+
+    return NULL;
+}
+
+/*----------------------------------------------------------------------*
+ * Function:   load_gi_node_list
+ * Purpose:    Load GI to node list translation file. The file is split
+ *             into byte ranges that are parsed in parallel - each GI has
+ *             its own slot of the table, so threads don't conflict.
+ * Parameters: db -> database handle
+ * Returns:    1 on success, 0 on failure
+ *----------------------------------------------------------------------*/
+static int load_gi_to_node_list(Acc2TaxDB* db)
+{
+    char filename[MAX_FILENAME];
+    GiChunk chunks[MAX_LOAD_THREADS];
+    pthread_t threads[MAX_LOAD_THREADS];
+    int started[MAX_LOAD_THREADS];
+    struct stat st;
+    int n_chunks = db->load_threads;
+    int loaded = 1;
+    int i;
+
+    if (!db->is_protein) {
+        sprintf(filename, "%s/gi_taxid_nucl.dmp", db->database_dir);
+    } else {
+        sprintf(filename, "%s/gi_taxid_prot.dmp", db->database_dir);
+    }
+    log_message(db->log_fp, "Opening database file %s\n", filename);
+    if (stat(filename, &st) != 0) {
+        log_message(db->log_fp, "Error: can't open %s\n", filename);
+        return 0;
+    }
+
+    // Directory covers all GIs, so pages can be added without locking
+    db->gi_directory_size = GI_DIRECTORY_SIZE;
+    db->gi_pages = calloc(db->gi_directory_size, sizeof(unsigned int*));
+    if (!db->gi_pages) {
+        log_message(db->log_fp, "Error: couldn't allocate memory.\n");
+        db->gi_directory_size = 0;
+        return 0;
+    }
+
+    if ((uint64_t)st.st_size < (uint64_t)n_chunks * MIN_GI_CHUNK_SIZE) {
+        n_chunks = (st.st_size / MIN_GI_CHUNK_SIZE) + 1;
+    }
+    for (i=0; i<n_chunks; i++) {
+        chunks[i].db = db;
+        chunks[i].filename = filename;
+        chunks[i].begin = ((uint64_t)st.st_size * i) / n_chunks;
+        chunks[i].end = i == n_chunks - 1 ? UINT64_MAX : ((uint64_t)st.st_size * (i + 1)) / n_chunks;
+        started[i] = (i > 0) && (pthread_create(&threads[i], NULL, load_gi_chunk, &chunks[i]) == 0);
+    }
+
+    // First chunk, and any that couldn't get a thread, run here
+    for (i=0; i<n_chunks; i++) {
+        if (!started[i]) {
+            load_gi_chunk(&chunks[i]);
+        }
+    }
+    for (i=0; i<n_chunks; i++) {
+        if (started[i]) {
+            pthread_join(threads[i], NULL);
+        }
+        loaded = loaded && chunks[i].result;
+    }
+    if (!loaded) {
+        return 0;
+    }
+
+    // Only count directory entries up to the last populated page
+    while ((db->gi_directory_size > 0) && (!db->gi_pages[db->gi_directory_size - 1])) {
+        db->gi_directory_size--;
+    }
+
+    db->has_gi = 1;
+    __atomic_add_fetch(&db->memory_required, (db->gi_directory_size * sizeof(unsigned int*)) + ((size_t)db->gi_pages_used * GI_PAGE_SIZE * sizeof(unsigned int)), __ATOMIC_RELAXED);
+    log_message(db->log_fp, "GI table: %u of %u pages populated (%lu Mb), %d threads\n", db->gi_pages_used, db->gi_directory_size, ((unsigned long)db->gi_pages_used * GI_PAGE_SIZE * sizeof(unsigned int)) / (1024 * 1024), n_chunks);
+
+    return 1;
+}
+
+/*----------------------------------------------------------------------*
+ * Function:   get_rank_code
+ * Purpose:    Find the code of a rank name, adding it if it's new. Code
+ *             0 is kept for nodes with no known rank.
+ * Parameters: db -> database handle
+ *             rank -> rank name
+ * Returns:    Rank code, or 0 if the rank table is full
+ *----------------------------------------------------------------------*/
+static uint8_t get_rank_code(Acc2TaxDB* db, const char* rank)
+{
+    unsigned int i;
+
+    for (i=1; i<db->rank_count; i++) {
+        if (strcmp(db->rank_names[i], rank) == 0) {
+            return i;
+        }
+    }
+
+    if ((db->rank_count >= MAX_RANKS) || (strlen(rank) >= MAX_RANK_NAME)) {
+        log_message(db->log_fp, "Warning: can't store rank %s\n", rank);
+        return 0;
+    }
+    strcpy(db->rank_names[db->rank_count], rank);
+
+    return db->rank_count++;
+}
+
+/*----------------------------------------------------------------------*
+ * Function:   load_node_list
+ * Purpose:    Load the list of nodes and parent nodes
+ * Parameters: db -> database handle
+ * Returns:    1 on success, 0 on failure
+ *----------------------------------------------------------------------*/
+static int load_node_list(Acc2TaxDB* db)
+{
+    char filename[MAX_FILENAME];
+    DmpReader reader;
+    char* line;
+    char* end;
+
+    uint8_t rank_code = 0;
+
+    sprintf(filename, "%s/nodes.dmp", db->database_dir);
+    log_message(db->log_fp, "Opening database file %s\n", filename);
+    if (!open_dmp_reader(&reader, filename, db->log_fp)) {
+        return 0;
+    }
+
+    while ((line = next_dmp_line(&reader, &end))) {
+        char* cursor = line;
+        char* child_str = next_dmp_field(&cursor, end);
+        char* parent_str = next_dmp_field(&cursor, end);
+        char* rank = next_dmp_field(&cursor, end);
+        unsigned int child;
+        unsigned int parent;
+
+        if ((!rank) || (!parse_dmp_uint(child_str, &child)) || (!parse_dmp_uint(parent_str, &parent))) {
+            log_message(db->log_fp, "Error: bad line in nodes file\n");
+        } else if (child >= db->nodes_size) {
+            log_message(db->log_fp, "Error: id (%u) is greater than maximum currently allowed (%u)\n", child, db->nodes_size);
+            close_dmp_reader(&reader);
+            return 0;
+        } else {
+            db->nodes[child] = parent;
+
+            // Nodes tend to repeat the rank of the node before
+            if (strcmp(rank, db->rank_names[rank_code]) != 0) {
+                rank_code = get_rank_code(db, rank);
+            }
+            db->node_ranks[child] = rank_code;
+        }
+    }
+
+    close_dmp_reader(&reader);
+    if (reader.error) {
+        log_message(db->log_fp, "Error: failed reading %s\n", filename);
+        return 0;
+    }
+
+    return 1;
+}
+
+/*----------------------------------------------------------------------*
+ * Function:   store_name
+ * Purpose:    Copy a name into the name arena and record its offset.
+ *             Both the arena and offset table grow to fit the data.
+ *             Offset 0 is reserved to mean no name.
+ * Parameters: db -> database handle
+ *             id = node ID
+ *             name -> name to store
+ * Returns:    1 on success, 0 on failure
+ *----------------------------------------------------------------------*/
+static int store_name(Acc2TaxDB* db, unsigned int id, char* name)
+{
+    size_t length = strlen(name) + 1;
+
+    if (id >= db->name_offsets_size) {
+        unsigned int new_size = db->name_offsets_size ? db->name_offsets_size : 1024;
+        uint32_t* new_offsets;
+
+        while (new_size <= id) {
+            new_size *= 2;
+        }
+        new_offsets = realloc(db->name_offsets, new_size * sizeof(uint32_t));
+        if (!new_offsets) {
+            log_message(db->log_fp, "Error: couldn't allocate memory.\n");
+            return 0;
+        }
+        db->name_offsets = new_offsets;
+        memset(db->name_offsets + db->name_offsets_size, 0, (new_size - db->name_offsets_size) * sizeof(uint32_t));
+        db->name_offsets_size = new_size;
+    }
+
+    if (db->name_arena_used == 0) {
+        db->name_arena_used = 1;
+    }
+
+    if (db->name_arena_used + length > db->name_arena_size) {
+        size_t new_size = db->name_arena_size ? db->name_arena_size : 1024 * 1024;
+        char* new_arena;
+
+        while (new_size < db->name_arena_used + length) {
+            new_size *= 2;
+        }
+        if (new_size > UINT32_MAX) {
+            log_message(db->log_fp, "Error: names exceed maximum arena size\n");
+            return 0;
+        }
+        new_arena = realloc(db->name_arena, new_size);
+        if (!new_arena) {
+            log_message(db->log_fp, "Error: couldn't allocate memory.\n");
+            return 0;
+        }
+        db->name_arena = new_arena;
+        db->name_arena[0] = 0;
+        db->name_arena_size = new_size;
+    }
+
+    memcpy(db->name_arena + db->name_arena_used, name, length);
+    db->name_offsets[id] = db->name_arena_used;
+    db->name_arena_used += length;
+
+    return 1;
+}
+
+/*----------------------------------------------------------------------*
+ * Function:   get_name
+ * Purpose:    Look up scientific name of a node
+ * Parameters: db -> database handle
+ *             id = node ID
+ * Returns:    Pointer to name, or NULL if node has no name
+ *----------------------------------------------------------------------*/
+static char* get_name(Acc2TaxDB* db, unsigned int id)
+{
+    if ((id >= db->name_offsets_size) || (db->name_offsets[id] == 0)) {
+        return NULL;
+    }
+
+    return db->name_arena + db->name_offsets[id];
+}
+
+/*----------------------------------------------------------------------*
+ * Function:   load_name_list
+ * Purpose:    Load the name list - converts between node IDs and names
+ * Parameters: db -> database handle
+ * Returns:    1 on success, 0 on failure
+ *----------------------------------------------------------------------*/
+static int load_name_list(Acc2TaxDB* db)
+{
+    char filename[MAX_FILENAME];
+    DmpReader reader;
+    char* line;
+    char* end;
+
+    sprintf(filename, "%s/names.dmp", db->database_dir);
+    log_message(db->log_fp, "Opening database file %s\n", filename);
+    if (!open_dmp_reader(&reader, filename, db->log_fp)) {
+        return 0;
+    }
+
+    while ((line = next_dmp_line(&reader, &end))) {
+        char* cursor = line;
+        char* id_str = next_dmp_field(&cursor, end);
+        char* name = next_dmp_field(&cursor, end);
+        char* class;
+        unsigned int id;
+
+        next_dmp_field(&cursor, end);
+        class = next_dmp_field(&cursor, end);
+
+        if ((class) && (strcmp(class, "scientific name") == 0) && (parse_dmp_uint(id_str, &id))) {
+            if (!store_name(db, id, name)) {
+                close_dmp_reader(&reader);
+                return 0;
+            }
+        }
+    }
+
+    close_dmp_reader(&reader);
+    if (reader.error) {
+        log_message(db->log_fp, "Error: failed reading %s\n", filename);
+        return 0;
+    }
+
+    // Return unused growth space
+    if (db->name_arena_used > 0) {
+        db->name_arena = realloc(db->name_arena, db->name_arena_used);
+        db->name_arena_size = db->name_arena_used;
+    }
+    __atomic_add_fetch(&db->memory_required, db->name_arena_size + (db->name_offsets_size * sizeof(uint32_t)), __ATOMIC_RELAXED);
+    log_message(db->log_fp, "Name table: %u slots, %lu bytes of names\n", db->name_offsets_size, (unsigned long)db->name_arena_size);
+
+    return 1;
+}
+
+/*----------------------------------------------------------------------*
+ * Function:   run_load_task
+ * Purpose:    Thread to load one database file
+ * Parameters: arg -> LoadTask
+ * Returns:    NULL
+ *----------------------------------------------------------------------*/
+static void* run_load_task(void* arg)
+{
+    LoadTask* task = arg;
+    double start = get_seconds();
+
+    task->result = task->load(task->db);
+    *task->seconds = get_seconds() - start;
+
+    return NULL;
+}
+
+/*----------------------------------------------------------------------*
+ * Function:   load_dmp_files
+ * Purpose:    Load the GI, nodes and names files at the same time. Each
+ *             loader fills its own tables.
+ * Parameters: db -> database handle
+ *             load_gi = 1 to load the GI file
+ * Returns:    1 on success, 0 on failure
+ *----------------------------------------------------------------------*/
+static int load_dmp_files(Acc2TaxDB* db, int load_gi)
+{
+    LoadTask tasks[3];
+    int n_tasks = 0;
+    int loaded = 1;
+    int i;
+
+    if (load_gi) {
+        tasks[n_tasks].seconds = &db->stats.load_gi_seconds;
+        tasks[n_tasks++].load = load_gi_to_node_list;
+    }
+    tasks[n_tasks].seconds = &db->stats.load_nodes_seconds;
+    tasks[n_tasks++].load = load_node_list;
+    tasks[n_tasks].seconds = &db->stats.load_names_seconds;
+    tasks[n_tasks++].load = load_name_list;
+
+    for (i=0; i<n_tasks; i++) {
+        tasks[i].db = db;
+        tasks[i].started = pthread_create(&tasks[i].thread, NULL, run_load_task, &tasks[i]) == 0;
+        if (!tasks[i].started) {
+            run_load_task(&tasks[i]);
+        }
+    }
+
+    for (i=0; i<n_tasks; i++) {
+        if (tasks[i].started) {
+            pthread_join(tasks[i].thread, NULL);
+        }
+        loaded = loaded && tasks[i].result;
+    }
+
+    return loaded;
+}
+
+/*----------------------------------------------------------------------*
+ * Function:   write_snapshot_section
+ * Purpose:    Append a section to a snapshot file, padded to 8 bytes
+ * Parameters: fp -> snapshot file
+ *             data -> section data
+ *             size = size of section in bytes
+ * Returns:    Offset of section in file
+ *----------------------------------------------------------------------*/
+static uint64_t write_snapshot_section(FILE* fp, void* data, uint64_t size)
+{
+    char padding[8] = {0};
+    uint64_t offset = ftell(fp);
+
+    if (size > 0) {
+        fwrite(data, size, 1, fp);
+    }
+    if (size % 8) {
+        fwrite(padding, 8 - (size % 8), 1, fp);
+    }
+
+    return offset;
+}
+
+/*----------------------------------------------------------------------*
+ * Function:   acc2tax_write_snapshot
+ * Purpose:    Write loaded nodes, names and GI table to a snapshot file.
+ *             Tables are trimmed to their highest populated entry.
+ * Parameters: db -> database handle
+ *             filename -> snapshot filename
+ * Returns:    1 on success, 0 on failure
+ *----------------------------------------------------------------------*/
+int acc2tax_write_snapshot(Acc2TaxDB* db, const char* filename)
+{
+    SnapshotHeader header;
+    FILE* fp;
+    uint64_t count;
+    uint64_t i;
+
+    log_message(db->log_fp, "Writing snapshot %s\n", filename);
+    fp = fopen(filename, "w");
+    if (!fp) {
+        log_message(db->log_fp, "Error: can't open %s\n", filename);
+        return 0;
+    }
+
+    memset(&header, 0, sizeof(SnapshotHeader));
+    strcpy(header.magic, SNAPSHOT_MAGIC);
+    header.version = SNAPSHOT_VERSION;
+    header.flags = (db->has_gi ? SNAPSHOT_HAS_GI : 0) | (db->is_protein ? SNAPSHOT_PROTEIN : 0);
+    write_snapshot_section(fp, &header, sizeof(SnapshotHeader));
+
+    for (count = db->nodes_size; (count > 0) && (db->nodes[count - 1] == 0); count--);
+    header.nodes_count = count;
+    header.nodes_offset = write_snapshot_section(fp, db->nodes, count * sizeof(unsigned int));
+
+    for (count = db->name_offsets_size; (count > 0) && (db->name_offsets[count - 1] == 0); count--);
+    header.name_offsets_count = count;
+    header.name_offsets_offset = write_snapshot_section(fp, db->name_offsets, count * sizeof(uint32_t));
+
+    header.names_size = db->name_arena_used;
+    header.names_offset = write_snapshot_section(fp, db->name_arena, db->name_arena_used);
+
+    header.ranks_count = header.nodes_count;
+    header.ranks_offset = write_snapshot_section(fp, db->node_ranks, header.nodes_count);
+    header.rank_names_count = db->rank_count;
+    header.rank_names_offset = write_snapshot_section(fp, db->rank_names, db->rank_count * MAX_RANK_NAME);
+
+    if (db->has_gi) {
+        uint32_t* directory;
+        uint32_t page_number = 0;
+
+        for (count = db->gi_directory_size; (count > 0) && (db->gi_pages[count - 1] == 0); count--);
+        directory = calloc(count + 1, sizeof(uint32_t));
+        if (!directory) {
+            log_message(db->log_fp, "Error: couldn't allocate memory.\n");
+            fclose(fp);
+            return 0;
+        }
+        for (i=0; i<count; i++) {
+            if (db->gi_pages[i]) {
+                directory[i] = ++page_number;
+            }
+        }
+        header.gi_directory_count = count;
+        header.gi_directory_offset = write_snapshot_section(fp, directory, count * sizeof(uint32_t));
+        header.gi_pages_count = page_number;
+        header.gi_pages_offset = ftell(fp);
+        for (i=0; i<count; i++) {
+            if (db->gi_pages[i]) {
+                write_snapshot_section(fp, db->gi_pages[i], GI_PAGE_SIZE * sizeof(unsigned int));
+            }
+        }
+        free(directory);
+    }
+
+    rewind(fp);
+    fwrite(&header, sizeof(SnapshotHeader), 1, fp);
+    if ((ferror(fp)) || (fclose(fp) != 0)) {
+        log_message(db->log_fp, "Error: failed writing snapshot\n");
+        return 0;
+    }
+
+    log_message(db->log_fp, "Done. Snapshot holds %lu nodes, %lu names, %lu GI pages.\n", (unsigned long)header.nodes_count, (unsigned long)header.name_offsets_count, (unsigned long)header.gi_pages_count);
+
+    return 1;
+}
+
+/*----------------------------------------------------------------------*
+ * Function:   section_fits
+ * Purpose:    Check that a section of a snapshot lies within the file,
+ *             without overflow from values read from the file
+ * Parameters: offset = offset of section
+ *             count = number of items
+ *             item_size = bytes per item
+ *             length = length of file
+ * Returns:    1 if it fits, 0 if not
+ *----------------------------------------------------------------------*/
+static int section_fits(uint64_t offset, uint64_t count, uint64_t item_size, uint64_t length)
+{
+    return (offset <= length) && (count <= (length - offset) / item_size);
+}
+
+/*----------------------------------------------------------------------*
+ * Function:   load_snapshot
+ * Purpose:    Map a snapshot file read-only and point the node, name and
+ *             GI tables into the mapping.
+ * Parameters: db -> database handle
+ *             filename -> snapshot filename
+ *             load_gi = 1 if the GI table is required
+ * Returns:    1 on success, 0 on failure
+ *----------------------------------------------------------------------*/
+static int load_snapshot(Acc2TaxDB* db, const char* filename, int load_gi)
+{
+    SnapshotHeader* header;
+    struct stat st;
+    char* base;
+    unsigned int i;
+    int fd;
+
+    log_message(db->log_fp, "Opening snapshot %s\n", filename);
+    fd = open(filename, O_RDONLY);
+    if ((fd < 0) || (fstat(fd, &st) != 0)) {
+        log_message(db->log_fp, "Error: can't open %s\n", filename);
+        if (fd >= 0) close(fd);
+        return 0;
+    }
+
+    if (st.st_size < sizeof(SnapshotHeader)) {
+        log_message(db->log_fp, "Error: %s is not an acc2tax snapshot\n", filename);
+        close(fd);
+        return 0;
+    }
+
+    db->snapshot_map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (db->snapshot_map == MAP_FAILED) {
+        log_message(db->log_fp, "Error: couldn't map %s\n", filename);
+        db->snapshot_map = 0;
+        return 0;
+    }
+    db->snapshot_size = st.st_size;
+
+    base = db->snapshot_map;
+    header = db->snapshot_map;
+    if (memcmp(header->magic, SNAPSHOT_MAGIC, sizeof(header->magic)) != 0) {
+        log_message(db->log_fp, "Error: %s is not an acc2tax snapshot\n", filename);
+        return 0;
+    }
+    if (header->version != SNAPSHOT_VERSION) {
+        log_message(db->log_fp, "Error: %s is snapshot version %u, expected %d - rewrite with --write-snapshot\n", filename, header->version, SNAPSHOT_VERSION);
+        return 0;
+    }
+    if ((!section_fits(header->nodes_offset, header->nodes_count, sizeof(unsigned int), db->snapshot_size)) ||
+        (!section_fits(header->name_offsets_offset, header->name_offsets_count, sizeof(uint32_t), db->snapshot_size)) ||
+        (!section_fits(header->names_offset, header->names_size, 1, db->snapshot_size)) ||
+        (!section_fits(header->gi_directory_offset, header->gi_directory_count, sizeof(uint32_t), db->snapshot_size)) ||
+        (!section_fits(header->gi_pages_offset, header->gi_pages_count, GI_PAGE_SIZE * sizeof(unsigned int), db->snapshot_size)) ||
+        (header->nodes_count > UINT32_MAX) || (header->name_offsets_count > UINT32_MAX) ||
+        (header->gi_directory_count > UINT32_MAX) ||
+        (header->ranks_count != header->nodes_count) ||
+        (!section_fits(header->ranks_offset, header->ranks_count, 1, db->snapshot_size)) ||
+        (header->rank_names_count < 1) || (header->rank_names_count > MAX_RANKS) ||
+        (!section_fits(header->rank_names_offset, header->rank_names_count, MAX_RANK_NAME, db->snapshot_size))) {
+        log_message(db->log_fp, "Error: %s is truncated\n", filename);
+        return 0;
+    }
+
+    if (load_gi) {
+        uint32_t* directory = (uint32_t*)(base + header->gi_directory_offset);
+        unsigned int* pages = (unsigned int*)(base + header->gi_pages_offset);
+        uint64_t page;
+
+        if (!(header->flags & SNAPSHOT_HAS_GI) || ((header->flags & SNAPSHOT_PROTEIN) ? !db->is_protein : db->is_protein)) {
+            log_message(db->log_fp, "Error: %s has no %s GI table\n", filename, db->is_protein ? "protein" : "nucleotide");
+            return 0;
+        }
+
+        db->gi_directory_size = header->gi_directory_count;
+        db->gi_pages = calloc(db->gi_directory_size + 1, sizeof(unsigned int*));
+        if (!db->gi_pages) {
+            log_message(db->log_fp, "Error: couldn't allocate memory.\n");
+            return 0;
+        }
+        for (page=0; page<db->gi_directory_size; page++) {
+            if ((directory[page] > 0) && (directory[page] <= header->gi_pages_count)) {
+                db->gi_pages[page] = pages + ((uint64_t)(directory[page] - 1) * GI_PAGE_SIZE);
+                db->gi_pages_used++;
+            }
+        }
+        db->has_gi = 1;
+    }
+
+    db->nodes = (unsigned int*)(base + header->nodes_offset);
+    db->nodes_size = header->nodes_count;
+    db->name_offsets = (uint32_t*)(base + header->name_offsets_offset);
+    db->name_offsets_size = header->name_offsets_count;
+    db->name_arena = base + header->names_offset;
+    db->name_arena_used = header->names_size;
+    db->name_arena_size = header->names_size;
+    db->node_ranks = (uint8_t*)(base + header->ranks_offset);
+    db->rank_count = header->rank_names_count;
+    memcpy(db->rank_names, base + header->rank_names_offset, db->rank_count * MAX_RANK_NAME);
+    for (i=0; i<db->rank_count; i++) {
+        db->rank_names[i][MAX_RANK_NAME - 1] = 0;
+    }
+
+    log_message(db->log_fp, "Snapshot holds %u nodes, %u names, %lu GI pages\n", db->nodes_size, db->name_offsets_size, (unsigned long)header->gi_pages_count);
+
+    return 1;
+}
+
+/*----------------------------------------------------------------------*
+ * Function:   map_standard_ranks
+ * Purpose:    Note which rank codes are standard ranks
+ * Parameters: db -> database handle
+ * Returns:    None
+ *----------------------------------------------------------------------*/
+static void map_standard_ranks(Acc2TaxDB* db)
+{
+    unsigned int i;
+
+    for (i=0; i<MAX_RANKS; i++) {
+        db->standard_rank_of[i] = i < db->rank_count ? acc2tax_find_rank(db->rank_names[i]) : -1;
+    }
+}
+
+/*----------------------------------------------------------------------*
+ * Function:   build_rank_table
+ * Purpose:    Build a table of the ancestor of each node at each standard
+ *             rank, in one pass over the nodes. Each node's row is its
+ *             parent's row with the node itself added at its own rank,
+ *             so the path to an unfilled node is filled from the top.
+ * Parameters: db -> database handle
+ * Returns:    1 on success, 0 on failure
+ *----------------------------------------------------------------------*/
+static int build_rank_table(Acc2TaxDB* db)
+{
+    unsigned int path[MAX_LINEAGE_DEPTH];
+    uint8_t* filled;
+    unsigned int count;
+    unsigned int node;
+
+    for (count = db->nodes_size; (count > 0) && (db->nodes[count - 1] == 0); count--);
+
+    log_message(db->log_fp, "Building rank table (%lu Mb)\n", ((unsigned long)count * STANDARD_RANK_COUNT * sizeof(uint32_t)) / (1024 * 1024));
+    db->rank_ancestors = calloc((size_t)count * STANDARD_RANK_COUNT, sizeof(uint32_t));
+    filled = calloc(count + 1, sizeof(uint8_t));
+    if ((!db->rank_ancestors) || (!filled)) {
+        log_message(db->log_fp, "Error: couldn't allocate memory.\n");
+        free(db->rank_ancestors);
+        db->rank_ancestors = 0;
+        free(filled);
+        return 0;
+    }
+    db->rank_ancestors_size = count;
+    db->memory_required += (size_t)count * STANDARD_RANK_COUNT * sizeof(uint32_t);
+
+    for (node=1; node<count; node++) {
+        unsigned int current = node;
+        uint32_t* row = NULL;
+        int depth = 0;
+
+        while ((current >= 1) && (current < count) && (!filled[current]) && (depth < MAX_LINEAGE_DEPTH)) {
+            path[depth++] = current;
+            current = db->nodes[current] == current ? 0 : db->nodes[current];
+        }
+        if ((current >= 1) && (current < count) && (filled[current])) {
+            row = db->rank_ancestors + ((size_t)current * STANDARD_RANK_COUNT);
+        }
+
+        while (depth > 0) {
+            unsigned int child = path[--depth];
+            uint32_t* child_row = db->rank_ancestors + ((size_t)child * STANDARD_RANK_COUNT);
+            int rank = db->standard_rank_of[db->node_ranks[child]];
+
+            if (row) {
+                memcpy(child_row, row, STANDARD_RANK_COUNT * sizeof(uint32_t));
+            }
+            if (rank >= 0) {
+                child_row[rank] = child;
+            }
+            filled[child] = 1;
+            row = child_row;
+        }
+    }
+
+    free(filled);
+
+    return 1;
+}
+
+/*----------------------------------------------------------------------*
+ * Function:   euler_min
+ * Purpose:    Pick whichever of two Euler tour positions is shallower
+ * Parameters: db -> database handle
+ *             a, b = positions in tour
+ * Returns:    Position of shallower entry
+ *----------------------------------------------------------------------*/
+static inline uint32_t euler_min(Acc2TaxDB* db, uint32_t a, uint32_t b)
+{
+    return db->euler_depths[b] < db->euler_depths[a] ? b : a;
+}
+
+/*----------------------------------------------------------------------*
+ * Function:   euler_block_min
+ * Purpose:    Find the shallowest entry between two positions of the
+ *             same block. Each position's mask marks the positions of
+ *             its block, up to it, that are shallower than everything
+ *             after them, so the lowest marked position from the start
+ *             of the range is the minimum.
+ * Parameters: db -> database handle
+ *             left, right = positions in tour, left <= right
+ * Returns:    Position of shallowest entry
+ *----------------------------------------------------------------------*/
+static inline uint32_t euler_block_min(Acc2TaxDB* db, uint32_t left, uint32_t right)
+{
+    uint32_t mask = db->euler_masks[right] & (UINT32_MAX << (left & (LCA_BLOCK_SIZE - 1)));
+
+    return (right & ~(uint32_t)(LCA_BLOCK_SIZE - 1)) + __builtin_ctz(mask);
+}
+
+/*----------------------------------------------------------------------*
+ * Function:   build_lca_table
+ * Purpose:    Build an Euler tour of the tree from the root, with a
+ *             sparse table of block minima and in-block masks, so the
+ *             lowest common ancestor of any two nodes is a range
+ *             minimum query answered in constant time
+ * Parameters: db -> database handle
+ * Returns:    1 on success, 0 on failure
+ *----------------------------------------------------------------------*/
+static int build_lca_table(Acc2TaxDB* db)
+{
+    uint32_t* child_start = NULL;
+    uint32_t* children = NULL;
+    uint32_t* stack = NULL;
+    uint32_t* next_child = NULL;
+    uint32_t* minima;
+    unsigned int count;
+    unsigned int node;
+    uint64_t size = 0;
+    uint64_t i;
+    int depth = 0;
+    int level;
+    int loaded = 0;
+
+    for (count = db->nodes_size; (count > 0) && (db->nodes[count - 1] == 0); count--);
+    if (count < 2) {
+        return 1;
+    }
+
+    // Children of each node, as offsets into one list
+    child_start = calloc(count + 1, sizeof(uint32_t));
+    children = malloc(count * sizeof(uint32_t));
+    stack = malloc(count * sizeof(uint32_t));
+    next_child = malloc(count * sizeof(uint32_t));
+    db->euler_first = malloc(count * sizeof(uint32_t));
+    db->euler_nodes = malloc(2 * (size_t)count * sizeof(uint32_t));
+    db->euler_depths = malloc(2 * (size_t)count * sizeof(uint16_t));
+    if ((!child_start) || (!children) || (!stack) || (!next_child) || (!db->euler_first) || (!db->euler_nodes) || (!db->euler_depths)) {
+        log_message(db->log_fp, "Error: couldn't allocate memory.\n");
+        goto done;
+    }
+    db->euler_first_size = count;
+
+    for (node=2; node<count; node++) {
+        if ((db->nodes[node] != 0) && (db->nodes[node] != node) && (db->nodes[node] < count)) {
+            child_start[db->nodes[node] + 1]++;
+        }
+    }
+    for (node=0; node<count; node++) {
+        child_start[node + 1] += child_start[node];
+        next_child[node] = child_start[node];
+        db->euler_first[node] = LCA_NONE;
+    }
+    for (node=2; node<count; node++) {
+        if ((db->nodes[node] != 0) && (db->nodes[node] != node) && (db->nodes[node] < count)) {
+            children[next_child[db->nodes[node]]++] = node;
+        }
+    }
+    for (node=0; node<count; node++) {
+        next_child[node] = child_start[node];
+    }
+
+    // Tour from the root, without recursion
+    stack[0] = 1;
+    db->euler_first[1] = 0;
+    db->euler_nodes[size] = 1;
+    db->euler_depths[size++] = 0;
+    while (depth >= 0) {
+        node = stack[depth];
+        if (next_child[node] < child_start[node + 1]) {
+            unsigned int child = children[next_child[node]++];
+
+            if ((db->euler_first[child] != LCA_NONE) || (depth + 1 >= UINT16_MAX)) {
+                continue;
+            }
+            stack[++depth] = child;
+            db->euler_first[child] = size;
+            db->euler_nodes[size] = child;
+            db->euler_depths[size++] = depth;
+        } else if (--depth >= 0) {
+            db->euler_nodes[size] = stack[depth];
+            db->euler_depths[size++] = depth;
+        }
+    }
+    db->euler_size = size;
+
+    // In-block masks - a stack of positions of increasing depth
+    db->euler_masks = malloc(size * sizeof(uint32_t));
+    if (!db->euler_masks) {
+        log_message(db->log_fp, "Error: couldn't allocate memory.\n");
+        goto done;
+    }
+    for (i=0; i<size; i++) {
+        uint32_t mask = (i & (LCA_BLOCK_SIZE - 1)) ? db->euler_masks[i - 1] : 0;
+        uint64_t block_start = i & ~(uint64_t)(LCA_BLOCK_SIZE - 1);
+
+        while ((mask) && (db->euler_depths[block_start + 31 - __builtin_clz(mask)] > db->euler_depths[i])) {
+            mask &= ~(1u << (31 - __builtin_clz(mask)));
+        }
+        db->euler_masks[i] = mask | (1u << (i & (LCA_BLOCK_SIZE - 1)));
+    }
+
+    // Sparse table of block minima - level k covers 2^k blocks
+    db->block_count = (size + LCA_BLOCK_SIZE - 1) >> LCA_BLOCK_BITS;
+    for (db->block_levels = 1; ((uint64_t)1 << db->block_levels) <= db->block_count; db->block_levels++);
+    db->block_minima = malloc(db->block_count * db->block_levels * sizeof(uint32_t));
+    if (!db->block_minima) {
+        log_message(db->log_fp, "Error: couldn't allocate memory.\n");
+        goto done;
+    }
+    minima = db->block_minima;
+    for (i=0; i<db->block_count; i++) {
+        uint64_t last = ((i + 1) << LCA_BLOCK_BITS) - 1;
+
+        minima[i] = euler_block_min(db, i << LCA_BLOCK_BITS, last < size ? last : size - 1);
+    }
+    for (level=1; level<db->block_levels; level++) {
+        uint32_t* previous = db->block_minima + ((level - 1) * db->block_count);
+
+        minima = db->block_minima + (level * db->block_count);
+        for (i=0; i + ((uint64_t)1 << level) <= db->block_count; i++) {
+            minima[i] = euler_min(db, previous[i], previous[i + ((uint64_t)1 << (level - 1))]);
+        }
+    }
+
+    db->memory_required += size * (sizeof(uint32_t) * 2 + sizeof(uint16_t)) + (count * sizeof(uint32_t)) + (db->block_count * db->block_levels * sizeof(uint32_t));
+    log_message(db->log_fp, "LCA table: Euler tour of %lu entries, %lu blocks\n", (unsigned long)size, (unsigned long)db->block_count);
+    loaded = 1;
+
+done:
+    free(child_start);
+    free(children);
+    free(stack);
+    free(next_child);
+
+    return loaded;
+}
+
+/*----------------------------------------------------------------------*
+ * Function:   find_lca_by_walking
+ * Purpose:    Find the lowest common ancestor of two nodes by walking up
+ *             the tree, used when no LCA table was built
+ * Parameters: db -> database handle
+ *             a, b = node IDs
+ * Returns:    Node ID of common ancestor, or 0 if there is none
+ *----------------------------------------------------------------------*/
+static unsigned int find_lca_by_walking(Acc2TaxDB* db, unsigned int a, unsigned int b)
+{
+    unsigned int path[MAX_LINEAGE_DEPTH];
+    int n = 0;
+    int i;
+
+    while ((a >= 1) && (a < db->nodes_size) && (db->nodes[a] != 0) && (n < MAX_LINEAGE_DEPTH)) {
+        path[n++] = a;
+        a = db->nodes[a] == a ? 0 : db->nodes[a];
+    }
+
+    for (i=0; (b >= 1) && (b < db->nodes_size) && (db->nodes[b] != 0) && (i < MAX_LINEAGE_DEPTH); i++) {
+        int j;
+
+        for (j=0; j<n; j++) {
+            if (path[j] == b) {
+                return b;
+            }
+        }
+        b = db->nodes[b] == b ? 0 : db->nodes[b];
+    }
+
+    return 0;
+}
+
+/*----------------------------------------------------------------------*
+ * Function:   get_taxonomy_from_node
+ * Purpose:    Given a node, build taxonomy string. The walk up the tree
+ *             stops at the root, at any node that is its own parent and
+ *             after MAX_LINEAGE_DEPTH nodes, and the string is sized to
+ *             fit however long the names are.
+ * Parameters: db -> database handle
+ *             current_node = node
+ * Returns:    Pointer to lineage, to be freed by caller, or NULL if out
+ *             of memory
+ *----------------------------------------------------------------------*/
+static Lineage* get_taxonomy_from_node(Acc2TaxDB* db, unsigned int current_node)
+{
+    unsigned int node_list[MAX_LINEAGE_DEPTH];
+    Lineage* lineage;
+    size_t length = 0;
+    int n = 0;
+    int i;
+
+    while ((current_node > 1) && (current_node < db->nodes_size) && (n < MAX_LINEAGE_DEPTH)) {
+        char* name = get_name(db, current_node);
+
+        node_list[n++] = current_node;
+        length += (name ? strlen(name) : strlen("Unknown")) + 1;
+        if (db->nodes[current_node] == current_node) {
+            break;
+        }
+        current_node = db->nodes[current_node];
+    }
+
+    lineage = malloc(sizeof(Lineage) + length + 1);
+    if (!lineage) {
+        return NULL;
+    }
+
+    length = 0;
+    for (i=n-1; i>=0; i--) {
+        char* name = get_name(db, node_list[i]);
+        size_t name_length;
+
+        if (!name) {
+            name = "Unknown";
+            log_message(db->log_fp, "\nError: no name for node %d\n", node_list[i]);
+        }
+        name_length = strlen(name);
+        memcpy(lineage->string + length, name, name_length);
+        length += name_length;
+        if (i > 0) {
+            lineage->string[length++] = ',';
+        }
+    }
+    lineage->string[length] = 0;
+    lineage->length = length;
+
+    return lineage;
+}
+
+/*----------------------------------------------------------------------*
+ * Function:   get_lineage
+ * Purpose:    Return cached lineage for a node, building and caching it
+ *             on first use. Safe to call from several threads - if two
+ *             threads build the same lineage, one copy is discarded.
+ * Parameters: db -> database handle
+ *             node = taxid
+ * Returns:    Pointer to lineage, or NULL if node out of range
+ *----------------------------------------------------------------------*/
+static Lineage* get_lineage(Acc2TaxDB* db, unsigned int node)
+{
+    Lineage* lineage;
+    Lineage* expected = NULL;
+
+    if ((node < 1) || (node >= db->nodes_size)) {
+        return NULL;
+    }
+
+    lineage = __atomic_load_n(&db->lineages[node], __ATOMIC_ACQUIRE);
+    if (lineage) {
+        return lineage;
+    }
+
+    lineage = get_taxonomy_from_node(db, node);
+    if (!lineage) {
+        log_message(db->log_fp, "Error: can't allocate memory for lineage\n");
+        return NULL;
+    }
+
+    if (!__atomic_compare_exchange_n(&db->lineages[node], &expected, lineage, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+        free(lineage);
+        lineage = expected;
+    }
+
+    return lineage;
+}
+
+/*----------------------------------------------------------------------*
+ * Function:   precompute_all_lineages
+ * Purpose:    Fill the lineage cache for every named node
+ * Parameters: db -> database handle
+ * Returns:    None
+ *----------------------------------------------------------------------*/
+static void precompute_all_lineages(Acc2TaxDB* db)
+{
+    long int count = 0;
+    unsigned int i;
+
+    log_message(db->log_fp, "Precomputing lineages\n");
+    for (i=2; i<db->nodes_size; i++) {
+        if ((db->nodes[i] != 0) && (get_name(db, i))) {
+            Lineage* lineage = get_lineage(db, i);
+            if (lineage) {
+                db->memory_required += sizeof(Lineage) + lineage->length + 1;
+                count++;
+            }
+        }
+    }
+    log_message(db->log_fp, "Precomputed %ld lineages\n", count);
+}
+
+/*----------------------------------------------------------------------*
+ * Function:   get_closest_record
+ * Purpose:    Read the record containing a byte offset of the accession
+ *             file. Uses pread, so is safe to call from several threads.
+ * Parameters: db -> database handle
+ *             pos = byte offset
+ *             line -> string of at least 1024 bytes to put record into
+ * Returns:    Number of bytes read
+ *----------------------------------------------------------------------*/
+static uint64_t get_closest_record(Acc2TaxDB* db, long int pos, char* line) {
+    char block[1024];
+    long int start = pos + 1;
+    long int line_start = 0;
+    uint64_t bytes_read = 0;
+    ssize_t got;
+
+    // Step back through the file a block at a time looking for the
+    // newline that ends the previous record
+    while (start > 0) {
+        long int block_start = start > sizeof(block) ? start - sizeof(block) : 0;
+        char* newline;
+
+        got = pread(fileno(db->acc_fp), block, start - block_start, block_start);
+        if (got <= 0) {
+            break;
+        }
+        bytes_read += got;
+
+        newline = memrchr(block, '\n', got);
+        if (newline) {
+            line_start = block_start + (newline - block) + 1;
+            break;
+        }
+        start = block_start;
+    }
+
+    got = pread(fileno(db->acc_fp), line, 1023, line_start);
+    if (got < 0) {
+        got = 0;
+    }
+    bytes_read += got;
+    line[got] = 0;
+
+    start = 0;
+    while ((start < got) && (line[start] != '\n')) {
+        start++;
+    }
+    if (start < got) {
+        line[start + 1] = 0;
+    }
+
+#ifdef DEBUG
+    printf("Got line: %s\n", line);
+#endif
+
+    return bytes_read;
+}
+
+/*----------------------------------------------------------------------*
+ * Function:   split_fields
+ * Purpose:    Split a line of the accession file into its fields
+ * Parameters: line -> line to split (modified)
+ *             accession, version -> to point at fields
+ *             taxid, gi -> to store numeric fields
+ * Returns:    None
+ *----------------------------------------------------------------------*/
+static void split_fields(char* line, char** accession, char** version, long int* taxid, long int* gi) {
+    char* taxid_str;
+    char* gi_str;
+    char* saveptr;
+
+    *accession = strtok_r(line, "\t", &saveptr);
+    *version = strtok_r(NULL, "\t", &saveptr);
+    taxid_str = strtok_r(NULL, "\t", &saveptr);
+    gi_str = strtok_r(NULL, "\t", &saveptr);
+
+    if (taxid_str != NULL) {
+        *taxid = atoi(taxid_str);
+    } else {
+        *taxid = 0;
+    }
+
+    if (gi_str != NULL) {
+        *gi = atoi(gi_str);
+    } else {
+        *gi = 0;
+    }
+
+#ifdef DEBUG
+    printf("Accession: %s\n", *accession);
+    printf("Version: %s\n", *version);
+    printf("Tax ID: %ld\n", *taxid);
+    printf("GI: %ld\n", *gi);
+#endif
+}
+
+/*----------------------------------------------------------------------*
+ * Function:   find_accession
+ * Purpose:    Binary search the accession text file by byte offset
+ * Parameters: db -> database handle
+ *             search_accession -> accession to find
+ *             line -> buffer of at least 1024 bytes for records
+ *             accession, version, taxid, gi -> fields of found record
+ * Returns:    1 if found, 0 otherwise
+ *----------------------------------------------------------------------*/
+static int find_accession(Acc2TaxDB* db, const char* search_accession, char* line, char** accession, char** version, long int* taxid, long int* gi) {
+    long int min = 0;
+    long int max = db->acc_file_size;
+    uint64_t probes = 0;
+    uint64_t bytes_read = 0;
+    int similarity;
+    int found = 0;
+
+#ifdef DEBUG
+    printf("Finding %s\n", search_accession);
+#endif
+
+    while (found == 0) {
+        long int current_pos = min + ((max-min) / 2);
+#ifdef DEBUG
+        printf("Min: %ld Max: %ld\n", min, max);
+#endif
+        bytes_read += get_closest_record(db, current_pos, line);
+        probes++;
+        split_fields(line, accession, version, taxid, gi);
+        if (*accession == NULL) {
+            break;
+        }
+
+        similarity = strcmp(*accession, search_accession);
+        if (similarity == 0) {
+            found = 1;
+        } else if (similarity > 0) {
+            max = current_pos;
+        } else if (similarity < 0) {
+            min = current_pos;
+        }
+
+        if (labs(max - min) < 20) {
+            break;
+        }
+    }
+
+    add_stat(db, &db->stats.probes, probes);
+    add_stat(db, &db->stats.bytes_read, bytes_read);
+
+    return found;
+}
+
+/*----------------------------------------------------------------------*
+ * Function:   find_buffered_accession
+ * Purpose:    Binary search sorted accession records held in memory.
+ *             Record boundaries are found with memrchr/memchr and keys
+ *             compared in place, so nothing is copied out of the buffer.
+ * Parameters: acc_map -> records, starting at a record boundary
+ *             size = size of records in bytes
+ *             search_accession -> accession to find
+ *             taxid -> to store taxid of accession
+ *             probes -> to add number of records compared to
+ * Returns:    1 if found, 0 otherwise
+ *----------------------------------------------------------------------*/
+static int find_buffered_accession(const char* acc_map, long int size, const char* search_accession, long int* taxid, uint64_t* probes)
+{
+    size_t search_length = strlen(search_accession);
+    long int min = 0;
+    long int max = size;
+
+    // min and max are always at line starts
+    while (min < max) {
+        long int current_pos = min + ((max - min) / 2);
+        const char* start = memrchr(acc_map + min, '\n', current_pos - min);
+        const char* end;
+        const char* tab;
+        size_t key_length;
+        int similarity;
+
+        start = start ? start + 1 : acc_map + min;
+        end = memchr(start, '\n', (acc_map + size) - start);
+        if (!end) {
+            end = acc_map + size;
+        }
+
+        tab = memchr(start, '\t', end - start);
+        key_length = tab ? tab - start : end - start;
+        (*probes)++;
+        similarity = memcmp(start, search_accession, key_length < search_length ? key_length : search_length);
+        if (similarity == 0) {
+            similarity = (key_length > search_length) - (key_length < search_length);
+        }
+
+        if (similarity == 0) {
+            const char* p = tab ? memchr(tab + 1, '\t', end - tab - 1) : 0;
+
+            *taxid = 0;
+            if (p) {
+                for (p++; (p < end) && (*p >= '0') && (*p <= '9'); p++) {
+                    *taxid = (*taxid * 10) + (*p - '0');
+                }
+            }
+            return 1;
+        } else if (similarity < 0) {
+            min = (end - acc_map) + 1;
+        } else {
+            max = start - acc_map;
+        }
+    }
+
+    return 0;
+}
+
+/*----------------------------------------------------------------------*
+ * Function:   find_mapped_accession
+ * Purpose:    Binary search the memory mapped accession file
+ * Parameters: db -> database handle
+ *             search_accession -> accession to find
+ *             taxid -> to store taxid of accession
+ * Returns:    1 if found, 0 otherwise
+ *----------------------------------------------------------------------*/
+static int find_mapped_accession(Acc2TaxDB* db, const char* search_accession, long int* taxid)
+{
+    uint64_t probes = 0;
+    int found = find_buffered_accession(db->acc_map, db->acc_file_size, search_accession, taxid, &probes);
+
+    add_stat(db, &db->stats.probes, probes);
+
+    return found;
+}
+
+/*----------------------------------------------------------------------*
+ * Function:   add_fence
+ * Purpose:    Add a sampled key and its record offset to the fence table
+ * Parameters: db -> database handle
+ *             offset = file offset of record
+ *             key -> accession of record (not NUL terminated)
+ *             key_length = length of accession
+ * Returns:    1 on success, 0 on failure
+ *----------------------------------------------------------------------*/
+static int add_fence(Acc2TaxDB* db, uint64_t offset, const char* key, size_t key_length)
+{
+    if (db->fence_count == db->fences_size) {
+        size_t new_size = db->fences_size ? db->fences_size * 2 : 1024;
+        FenceEntry* new_fences = realloc(db->fences, new_size * sizeof(FenceEntry));
+
+        if (!new_fences) {
+            log_message(db->log_fp, "Error: couldn't allocate memory.\n");
+            return 0;
+        }
+        db->fences = new_fences;
+        db->fences_size = new_size;
+    }
+
+    if (db->fence_keys_used + key_length + 1 > db->fence_keys_size) {
+        size_t new_size = db->fence_keys_size ? db->fence_keys_size * 2 : 64 * 1024;
+        char* new_keys;
+
+        while (new_size < db->fence_keys_used + key_length + 1) {
+            new_size *= 2;
+        }
+        if (new_size > UINT32_MAX) {
+            log_message(db->log_fp, "Error: fence keys exceed maximum size - use a larger fence interval\n");
+            return 0;
+        }
+        new_keys = realloc(db->fence_keys, new_size);
+        if (!new_keys) {
+            log_message(db->log_fp, "Error: couldn't allocate memory.\n");
+            return 0;
+        }
+        db->fence_keys = new_keys;
+        db->fence_keys_size = new_size;
+    }
+
+    db->fences[db->fence_count].offset = offset;
+    db->fences[db->fence_count].key = db->fence_keys_used;
+    db->fence_count++;
+    memcpy(db->fence_keys + db->fence_keys_used, key, key_length);
+    db->fence_keys[db->fence_keys_used + key_length] = 0;
+    db->fence_keys_used += key_length + 1;
+
+    return 1;
+}
+
+/*----------------------------------------------------------------------*
+ * Function:   build_fences
+ * Purpose:    Sample the key of the first record at or after every
+ *             fence_interval bytes of the accession file. Only a small
+ *             read is needed per fence, not a scan of the whole file.
+ * Parameters: db -> database handle
+ * Returns:    1 on success, 0 on failure
+ *----------------------------------------------------------------------*/
+static int build_fences(Acc2TaxDB* db)
+{
+    char block[1024];
+    int fd = fileno(db->acc_fp);
+    uint64_t pos;
+
+    log_message(db->log_fp, "Sampling accession file every %u bytes\n", db->fence_interval);
+
+    for (pos = 0; pos < db->acc_file_size; pos += db->fence_interval) {
+        uint64_t start = 0;
+        ssize_t got;
+        char* tab;
+
+        // Find the first record starting at or after pos
+        if (pos > 0) {
+            uint64_t search = pos - 1;
+
+            while ((got = pread(fd, block, sizeof(block), search)) > 0) {
+                char* newline = memchr(block, '\n', got);
+
+                if (newline) {
+                    start = search + (newline - block) + 1;
+                    break;
+                }
+                search += got;
+            }
+            if ((start == 0) || (start >= db->acc_file_size)) {
+                break;
+            }
+            if ((db->fence_count > 0) && (start <= db->fences[db->fence_count - 1].offset)) {
+                continue;
+            }
+        }
+
+        got = pread(fd, block, MAX_KEY_WIDTH + 1, start);
+        tab = got > 0 ? memchr(block, '\t', got) : 0;
+        if (tab) {
+            if (!add_fence(db, start, block, tab - block)) {
+                return 0;
+            }
+        }
+    }
+
+    return 1;
+}
+
+/*----------------------------------------------------------------------*
+ * Function:   check_fences
+ * Purpose:    Check a fence table read from a sidecar file, so a damaged
+ *             file can't send lookups outside the table or the accession
+ *             file. Terminates the key arena.
+ * Parameters: fences -> fence entries
+ *             count = number of entries
+ *             keys -> key arena, with room for keys_size + 1 bytes
+ *             keys_size = bytes of keys read
+ *             file_size = size of accession file
+ * Returns:    1 if the table is usable, 0 if not
+ *----------------------------------------------------------------------*/
+static int check_fences(const FenceEntry* fences, uint64_t count, char* keys, uint64_t keys_size, uint64_t file_size)
+{
+    uint64_t i;
+
+    keys[keys_size] = 0;
+    if ((count > 0) && ((keys_size == 0) || (keys[keys_size - 1] != 0))) {
+        return 0;
+    }
+
+    // Keys are stored in order, each after the last one's NUL
+    for (i=0; i<count; i++) {
+        if ((fences[i].key >= keys_size) || (fences[i].offset > file_size)) {
+            return 0;
+        }
+        if ((i > 0) && ((fences[i].offset <= fences[i - 1].offset) || (fences[i].key <= fences[i - 1].key) || (keys[fences[i].key - 1] != 0))) {
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
+/*----------------------------------------------------------------------*
+ * Function:   read_fence_file
+ * Purpose:    Load the fence table from its sidecar file, if it was
+ *             built from the current accession file with the same
+ *             interval
+ * Parameters: db -> database handle
+ *             filename -> sidecar filename
+ *             mtime = modification time of accession file
+ * Returns:    1 if loaded, 0 if missing or out of date
+ *----------------------------------------------------------------------*/
+static int read_fence_file(Acc2TaxDB* db, char* filename, uint64_t mtime)
+{
+    FenceHeader header;
+    FILE* fp = fopen(filename, "r");
+    int loaded = 0;
+
+    if (!fp) {
+        return 0;
+    }
+
+    // There is at most one fence per interval of the file
+    if ((fread(&header, sizeof(FenceHeader), 1, fp) == 1) &&
+        (memcmp(header.magic, FENCE_MAGIC, sizeof(header.magic)) == 0) &&
+        (header.version == FENCE_VERSION) &&
+        (header.interval == db->fence_interval) &&
+        (header.file_size == db->acc_file_size) &&
+        (header.file_mtime == mtime) &&
+        (header.count <= (db->acc_file_size / db->fence_interval) + 2) &&
+        (header.keys_size <= UINT32_MAX)) {
+        db->fences = malloc((header.count + 1) * sizeof(FenceEntry));
+        db->fence_keys = malloc(header.keys_size + 1);
+        if ((db->fences) && (db->fence_keys) &&
+            (fread(db->fences, sizeof(FenceEntry), header.count, fp) == header.count) &&
+            (fread(db->fence_keys, 1, header.keys_size, fp) == header.keys_size) &&
+            (check_fences(db->fences, header.count, db->fence_keys, header.keys_size, db->acc_file_size))) {
+            db->fence_count = header.count;
+            db->fences_size = header.count;
+            db->fence_keys_used = header.keys_size;
+            db->fence_keys_size = header.keys_size;
+            loaded = 1;
+        } else {
+            free(db->fences);
+            free(db->fence_keys);
+            db->fences = 0;
+            db->fence_keys = 0;
+            log_message(db->log_fp, "Warning: fence file %s is damaged, rebuilding it\n", filename);
+        }
+    }
+
+    fclose(fp);
+
+    return loaded;
+}
+
+/*----------------------------------------------------------------------*
+ * Function:   write_fence_file
+ * Purpose:    Save the fence table to its sidecar file
+ * Parameters: db -> database handle
+ *             filename -> sidecar filename
+ *             mtime = modification time of accession file
+ * Returns:    1 on success, 0 on failure
+ *----------------------------------------------------------------------*/
+static int write_fence_file(Acc2TaxDB* db, char* filename, uint64_t mtime)
+{
+    FenceHeader header;
+    FILE* fp = fopen(filename, "w");
+
+    if (!fp) {
+        return 0;
+    }
+
+    memset(&header, 0, sizeof(FenceHeader));
+    strcpy(header.magic, FENCE_MAGIC);
+    header.version = FENCE_VERSION;
+    header.interval = db->fence_interval;
+    header.file_size = db->acc_file_size;
+    header.file_mtime = mtime;
+    header.count = db->fence_count;
+    header.keys_size = db->fence_keys_used;
+    fwrite(&header, sizeof(FenceHeader), 1, fp);
+    fwrite(db->fences, sizeof(FenceEntry), db->fence_count, fp);
+    fwrite(db->fence_keys, 1, db->fence_keys_used, fp);
+
+    if ((ferror(fp)) | (fclose(fp) != 0)) {
+        unlink(filename);
+        return 0;
+    }
+
+    return 1;
+}
+
+/*----------------------------------------------------------------------*
+ * Function:   load_fences
+ * Purpose:    Load the fence table from its sidecar file, or build it
+ *             and try to save it for next time
+ * Parameters: db -> database handle
+ * Returns:    1 on success, 0 on failure
+ *----------------------------------------------------------------------*/
+static int load_fences(Acc2TaxDB* db)
+{
+    char filename[MAX_FILENAME];
+    struct stat st;
+    uint64_t mtime = 0;
+
+    sprintf(filename, "%s/acc2tax_%s_all.fence", db->database_dir, db->is_protein ? "prot" : "nucl");
+    if (fstat(fileno(db->acc_fp), &st) == 0) {
+        mtime = st.st_mtime;
+    }
+
+    if (read_fence_file(db, filename, mtime)) {
+        log_message(db->log_fp, "Opened fence file %s\n", filename);
+    } else {
+        if (!build_fences(db)) {
+            return 0;
+        }
+        if (write_fence_file(db, filename, mtime)) {
+            log_message(db->log_fp, "Wrote fence file %s\n", filename);
+        } else {
+            log_message(db->log_fp, "Warning: couldn't write fence file %s\n", filename);
+        }
+    }
+
+    db->memory_required += (db->fence_count * sizeof(FenceEntry)) + db->fence_keys_used;
+    log_message(db->log_fp, "Fence table: %lu entries (%lu Kb)\n", (unsigned long)db->fence_count, (unsigned long)(((db->fence_count * sizeof(FenceEntry)) + db->fence_keys_used) / 1024));
+
+    return 1;
+}
+
+/*----------------------------------------------------------------------*
+ * Function:   find_fence_block
+ * Purpose:    Binary search the fence table in memory for the block of
+ *             the accession file that would hold an accession
+ * Parameters: db -> database handle
+ *             search_accession -> accession to find
+ *             start, end -> to store byte range of block
+ *             probes -> to add number of fences compared to
+ * Returns:    1 if there is a block, 0 if the accession sorts before the
+ *             first fence
+ *----------------------------------------------------------------------*/
+static int find_fence_block(Acc2TaxDB* db, const char* search_accession, uint64_t* start, uint64_t* end, uint64_t* probes)
+{
+    int64_t min = 0;
+    int64_t max = (int64_t)db->fence_count - 1;
+    int64_t fence = -1;
+
+    // Last fence with key <= accession
+    while (min <= max) {
+        int64_t current = min + ((max - min) / 2);
+
+        (*probes)++;
+        if (strcmp(db->fence_keys + db->fences[current].key, search_accession) <= 0) {
+            fence = current;
+            min = current + 1;
+        } else {
+            max = current - 1;
+        }
+    }
+
+    if (fence < 0) {
+        return 0;
+    }
+
+    *start = db->fences[fence].offset;
+    *end = fence + 1 < db->fence_count ? db->fences[fence + 1].offset : db->acc_file_size;
+
+    return 1;
+}
+
+/*----------------------------------------------------------------------*
+ * Function:   find_fenced_accession
+ * Purpose:    Find an accession by binary searching the fence table in
+ *             memory, then reading and searching the one block of the
+ *             accession file between two fences
+ * Parameters: db -> database handle
+ *             search_accession -> accession to find
+ *             taxid -> to store taxid of accession
+ * Returns:    1 if found, 0 otherwise
+ *----------------------------------------------------------------------*/
+static int find_fenced_accession(Acc2TaxDB* db, const char* search_accession, long int* taxid)
+{
+    uint64_t probes = 0;
+    uint64_t start;
+    uint64_t end;
+    char* block;
+    ssize_t got;
+    int found = 0;
+
+    if (!find_fence_block(db, search_accession, &start, &end, &probes)) {
+        add_stat(db, &db->stats.probes, probes);
+        return 0;
+    }
+
+    block = malloc(end - start + 1);
+    if (!block) {
+        log_message(db->log_fp, "Error: couldn't allocate memory.\n");
+        return 0;
+    }
+
+    got = pread(fileno(db->acc_fp), block, end - start, start);
+    if (got > 0) {
+        found = find_buffered_accession(block, got, search_accession, taxid, &probes);
+        add_stat(db, &db->stats.bytes_read, got);
+    }
+    free(block);
+    add_stat(db, &db->stats.probes, probes);
+
+    return found;
+}
+
+/*----------------------------------------------------------------------*
+ * Function:   get_accession_filenames
+ * Purpose:    Build names of the sorted accession file and its index
+ * Parameters: database_dir -> database directory
+ *             is_protein = 1 for protein files
+ *             text_filename -> string to put text filename into
+ *             index_filename -> string to put index filename into
+ * Returns:    None
+ *----------------------------------------------------------------------*/
+static void get_accession_filenames(const char* database_dir, int is_protein, char* text_filename, char* index_filename)
+{
+    const char* type = is_protein ? "prot" : "nucl";
+
+    sprintf(text_filename, "%s/acc2tax_%s_all.txt", database_dir, type);
+    sprintf(index_filename, "%s/acc2tax_%s_all.idx", database_dir, type);
+}
+
+/*----------------------------------------------------------------------*
+ * Function:   get_manifest_filename
+ * Purpose:    Make filename of the shard manifest of the accession index
+ * Parameters: database_dir -> database directory
+ *             is_protein = 1 for protein
+ *             filename -> string to put manifest filename into
+ * Returns:    None
+ *----------------------------------------------------------------------*/
+static void get_manifest_filename(const char* database_dir, int is_protein, char* filename)
+{
+    sprintf(filename, "%s/acc2tax_%s_all.shards", database_dir, is_protein ? "prot" : "nucl");
+}
+
+/*----------------------------------------------------------------------*
+ * Function:   packed_code
+ * Purpose:    Give the 6-bit code of an accession character. Codes rise
+ *             in ASCII order, so packed keys sort as strcmp would.
+ * Parameters: c = character
+ * Returns:    Code 1 to 63, or 0 if the character can't be packed
+ *----------------------------------------------------------------------*/
+static uint64_t packed_code(char c)
+{
+    if ((c >= '0') && (c <= '9')) {
+        return 1 + (c - '0');
+    } else if ((c >= 'A') && (c <= 'Z')) {
+        return 11 + (c - 'A');
+    } else if (c == '_') {
+        return 37;
+    } else if ((c >= 'a') && (c <= 'z')) {
+        return 38 + (c - 'a');
+    }
+
+    return 0;
+}
+
+/*----------------------------------------------------------------------*
+ * Function:   pack_accession
+ * Purpose:    Pack an accession into a 128-bit key, 6 bits a character
+ *             from the top bit down, with unused characters left 0. The
+ *             packing is reversible and comparing keys as integers gives
+ *             the same order as strcmp on the accessions.
+ * Parameters: accession -> accession to pack
+ *             key -> to store key
+ * Returns:    1 if packed, 0 if the accession is too long or has a
+ *             character outside [0-9A-Z_a-z]
+ *----------------------------------------------------------------------*/
+static int pack_accession(const char* accession, PackedKey* key)
+{
+    int i;
+
+    key->hi = 0;
+    key->lo = 0;
+
+    for (i=0; accession[i] != 0; i++) {
+        uint64_t code = packed_code(accession[i]);
+        int shift = 122 - (6 * i);
+
+        if ((code == 0) || (i == PACKED_KEY_CHARS)) {
+            return 0;
+        }
+
+        if (shift >= 64) {
+            key->hi |= code << (shift - 64);
+        } else if (shift > 58) {
+            key->hi |= code >> (64 - shift);
+            key->lo |= code << shift;
+        } else {
+            key->lo |= code << shift;
+        }
+    }
+
+    return 1;
+}
+
+/*----------------------------------------------------------------------*
+ * Function:   compare_packed_keys
+ * Purpose:    Compare two packed keys
+ * Parameters: a, b -> keys
+ * Returns:    <0, 0 or >0
+ *----------------------------------------------------------------------*/
+static inline int compare_packed_keys(const PackedKey* a, const PackedKey* b)
+{
+    int hi = (a->hi > b->hi) - (a->hi < b->hi);
+    int lo = (a->lo > b->lo) - (a->lo < b->lo);
+
+    return hi ? hi : lo;
+}
+
+/*----------------------------------------------------------------------*
+ * Function:   get_filter_filename
+ * Purpose:    Make filename of the Bloom filter of an index - the index
+ *             filename with .bloom in place of .idx
+ * Parameters: index_filename -> filename of index
+ *             filter_filename -> string to put filter filename into
+ * Returns:    None
+ *----------------------------------------------------------------------*/
+static void get_filter_filename(const char* index_filename, char* filter_filename)
+{
+    size_t length = strlen(index_filename);
+
+    strcpy(filter_filename, index_filename);
+    if ((length > 4) && (strcmp(index_filename + length - 4, ".idx") == 0)) {
+        filter_filename[length - 4] = 0;
+    }
+    strcat(filter_filename, ".bloom");
+}
+
+/*----------------------------------------------------------------------*
+ * Function:   hash_accession
+ * Purpose:    Hash an accession for the Bloom filter (FNV-1a, then mixed)
+ * Parameters: accession -> accession
+ * Returns:    64-bit hash
+ *----------------------------------------------------------------------*/
+static inline uint64_t hash_accession(const char* accession)
+{
+    uint64_t h = 0xCBF29CE484222325ULL;
+
+    while (*accession) {
+        h = (h ^ (uint8_t)*accession++) * 0x100000001B3ULL;
+    }
+    h ^= h >> 33;
+    h *= 0xFF51AFD7ED558CCDULL;
+    h ^= h >> 33;
+
+    return h;
+}
+
+/*----------------------------------------------------------------------*
+ * Function:   test_filter_bits
+ * Purpose:    Test, and optionally set, the bits of an accession in a
+ *             Bloom filter. The high part of the hash picks a block, and
+ *             a remix of it gives 9 bits for each position in the block.
+ * Parameters: blocks -> filter blocks
+ *             block_count = number of blocks
+ *             hashes = bits per key
+ *             accession -> accession
+ *             set = 1 to set the bits
+ * Returns:    1 if all the bits were set, 0 otherwise
+ *----------------------------------------------------------------------*/
+static inline int test_filter_bits(uint64_t* blocks, uint64_t block_count, uint32_t hashes, const char* accession, int set)
+{
+    uint64_t h = hash_accession(accession);
+    uint64_t* block = blocks + (uint64_t)(((unsigned __int128)h * block_count) >> 64) * FILTER_BLOCK_WORDS;
+    uint64_t positions = h * 0x9E3779B97F4A7C15ULL;
+    int present = 1;
+    uint32_t i;
+
+    positions ^= positions >> 29;
+    for (i=0; i<hashes; i++) {
+        unsigned int bit = (positions >> (i * 9)) & 511;
+        uint64_t mask = 1ULL << (bit & 63);
+
+        present &= (block[bit >> 6] & mask) != 0;
+        if (set) {
+            block[bit >> 6] |= mask;
+        }
+    }
+
+    return present;
+}
+
+/*----------------------------------------------------------------------*
+ * Function:   filter_may_contain
+ * Purpose:    Check the Bloom filter of a handle for an accession
+ * Parameters: db -> database handle
+ *             accession -> accession
+ * Returns:    0 if the accession is definitely not in the index, 1 if it
+ *             may be (or there is no filter)
+ *----------------------------------------------------------------------*/
+static inline int filter_may_contain(Acc2TaxDB* db, const char* accession)
+{
+    if (!db->filter_blocks) {
+        return 1;
+    }
+
+    if (test_filter_bits(db->filter_blocks, db->filter_block_count, db->filter_hashes, accession, 0)) {
+        return 1;
+    }
+
+    add_stat(db, &db->stats.filter_rejects, 1);
+
+    return 0;
+}
+
+/*----------------------------------------------------------------------*
+ * Function:   get_filter_bits
+ * Purpose:    Decide the bits per key of the filter to build with an
+ *             index - as requested, or else as the index's existing
+ *             filter, so a rebuilt index keeps its filter
+ * Parameters: requested = bits per key asked for, or 0
+ *             filter_filename -> filename of filter
+ * Returns:    Bits per key, or 0 for no filter
+ *----------------------------------------------------------------------*/
+static unsigned int get_filter_bits(unsigned int requested, const char* filter_filename)
+{
+    FilterHeader header;
+    FILE* fp;
+
+    if (requested > 0) {
+        return requested;
+    }
+
+    fp = fopen(filter_filename, "r");
+    if (!fp) {
+        return 0;
+    }
+    if ((fread(&header, sizeof(FilterHeader), 1, fp) != 1) ||
+        (strcmp(header.magic, FILTER_MAGIC) != 0) ||
+        (header.bits_per_key > MAX_FILTER_BITS)) {
+        header.bits_per_key = 0;
+    }
+    fclose(fp);
+
+    return header.bits_per_key;
+}
+
+/*----------------------------------------------------------------------*
+ * Function:   write_filter_file
+ * Purpose:    Write a Bloom filter, recording the size and modification
+ *             time of the index just written
+ * Parameters: log_fp -> log file, or NULL
+ *             filter_filename -> filename of filter
+ *             index_filename -> filename of index
+ *             header -> header, with all but the index fields filled in
+ *             blocks -> filter blocks
+ * Returns:    1 on success, 0 on failure
+ *----------------------------------------------------------------------*/
+static int write_filter_file(FILE* log_fp, const char* filter_filename, const char* index_filename, FilterHeader* header, uint64_t* blocks)
+{
+    struct stat st;
+    int failed;
+    FILE* fp;
+
+    if (stat(index_filename, &st) != 0) {
+        log_message(log_fp, "Error: can't stat %s\n", index_filename);
+        return 0;
+    }
+    header->index_size = st.st_size;
+    header->index_mtime = st.st_mtime;
+
+    log_message(log_fp, "Writing Bloom filter %s, %u bits per key\n", filter_filename, header->bits_per_key);
+    fp = fopen(filter_filename, "w");
+    if (!fp) {
+        log_message(log_fp, "Error: can't open %s\n", filter_filename);
+        return 0;
+    }
+
+    fwrite(header, sizeof(FilterHeader), 1, fp);
+    fwrite(blocks, FILTER_BLOCK_WORDS * sizeof(uint64_t), header->block_count, fp);
+    failed = ferror(fp);
+    failed |= fclose(fp) != 0;
+    if (failed) {
+        log_message(log_fp, "Error: failed writing %s\n", filter_filename);
+        unlink(filter_filename);
+        return 0;
+    }
+
+    return 1;
+}
+
+/*----------------------------------------------------------------------*
+ * Function:   build_index_range
+ * Purpose:    Write a binary index of the records of the sorted text file
+ *             from offset start up to the first accession at or after
+ *             end_key. Accessions that can be packed go into a table of
+ *             128-bit keys, any others into a fallback table of fixed
+ *             width strings; each table has a parallel taxid array. Two
+ *             passes are made over the range - the first sizes the
+ *             tables, the second writes them out.
+ * Parameters: log_fp -> log file, or NULL
+ *             fp -> open text file
+ *             text_filename -> filename of text file, for messages
+ *             start = offset of first record to index
+ *             end_key -> first accession not to index, or NULL for all
+ *             index_filename -> filename of index to write
+ *             end -> to store offset of end of range
+ * Returns:    1 on success, 0 on failure
+ *----------------------------------------------------------------------*/
+static int build_index_range(FILE* log_fp, FILE* fp, const char* text_filename, uint64_t start, const char* end_key, const char* index_filename, unsigned int filter_bits, uint64_t* end)
+{
+    char line[MAX_LINE_LENGTH];
+    char previous[MAX_KEY_WIDTH + 1];
+    char key[MAX_KEY_WIDTH];
+    char filter_filename[MAX_FILENAME + 32];
+    char *accession;
+    char *version;
+    long int taxid;
+    long int gi;
+    uint64_t count = 0;
+    uint64_t fallback_count = 0;
+    uint64_t offset = start;
+    uint32_t key_width = 1;
+    IndexHeader header;
+    FilterHeader filter_header;
+    uint64_t* filter_blocks = NULL;
+    PackedKey packed;
+    FILE* region_fp[4];
+    uint64_t region_offset[4];
+    int failed = 0;
+    int i;
+
+    // First pass - count records, find widest fallback key, check sort
+    // order and find the end of the range
+    previous[0] = 0;
+    fseek(fp, start, SEEK_SET);
+    *end = start;
+    while (fgets(line, MAX_LINE_LENGTH, fp)) {
+        offset += strlen(line);
+        split_fields(line, &accession, &version, &taxid, &gi);
+        if ((accession == NULL) || (version == NULL)) {
+            *end = offset;
+            continue;
+        }
+        if ((end_key) && (strcmp(accession, end_key) >= 0)) {
+            break;
+        }
+        *end = offset;
+        if (strlen(accession) > MAX_KEY_WIDTH) {
+            log_message(log_fp, "Error: accession %s longer than maximum key width (%d)\n", accession, MAX_KEY_WIDTH);
+            return 0;
+        }
+        if (strcmp(previous, accession) > 0) {
+            log_message(log_fp, "Error: %s is not sorted (%s follows %s)\n", text_filename, accession, previous);
+            return 0;
+        }
+        strcpy(previous, accession);
+        if (pack_accession(accession, &packed)) {
+            count++;
+        } else {
+            if (strlen(accession) > key_width) {
+                key_width = strlen(accession);
+            }
+            fallback_count++;
+        }
+    }
+
+    log_message(log_fp, "Found %lu packed and %lu fallback records, fallback key width %u\n", (unsigned long)count, (unsigned long)fallback_count, key_width);
+
+    // Keys are added to the filter as they are written
+    get_filter_filename(index_filename, filter_filename);
+    filter_bits = get_filter_bits(filter_bits, filter_filename);
+    if (filter_bits > 0) {
+        memset(&filter_header, 0, sizeof(FilterHeader));
+        strcpy(filter_header.magic, FILTER_MAGIC);
+        filter_header.version = FILTER_VERSION;
+        filter_header.bits_per_key = filter_bits;
+        filter_header.hashes = (filter_bits * 69 + 50) / 100;
+        if (filter_header.hashes < 1) {
+            filter_header.hashes = 1;
+        } else if (filter_header.hashes > MAX_FILTER_HASHES) {
+            filter_header.hashes = MAX_FILTER_HASHES;
+        }
+        filter_header.key_count = count + fallback_count;
+        filter_header.block_count = (filter_header.key_count * filter_bits + 511) / 512;
+        if (filter_header.block_count == 0) {
+            filter_header.block_count = 1;
+        }
+        filter_blocks = calloc(filter_header.block_count * FILTER_BLOCK_WORDS, sizeof(uint64_t));
+        if (!filter_blocks) {
+            log_message(log_fp, "Error: couldn't allocate memory for Bloom filter.\n");
+            return 0;
+        }
+    }
+
+    memset(&header, 0, sizeof(IndexHeader));
+    strcpy(header.magic, INDEX_MAGIC);
+    header.version = INDEX_VERSION;
+    header.key_width = key_width;
+    header.count = count;
+    header.fallback_count = fallback_count;
+
+    // Packed keys, packed taxids, fallback keys and fallback taxids are
+    // each written through their own handle on the file
+    region_offset[0] = sizeof(IndexHeader);
+    region_offset[1] = region_offset[0] + (count * sizeof(PackedKey));
+    region_offset[2] = region_offset[1] + (count * sizeof(uint32_t));
+    region_offset[3] = region_offset[2] + (fallback_count * key_width);
+
+    log_message(log_fp, "Writing index file %s\n", index_filename);
+    region_fp[0] = fopen(index_filename, "w");
+    if (!region_fp[0]) {
+        log_message(log_fp, "Error: can't open %s\n", index_filename);
+        free(filter_blocks);
+        return 0;
+    }
+    fwrite(&header, sizeof(IndexHeader), 1, region_fp[0]);
+    fflush(region_fp[0]);
+
+    for (i=1; i<4; i++) {
+        region_fp[i] = fopen(index_filename, "r+");
+        if (!region_fp[i]) {
+            log_message(log_fp, "Error: can't open %s\n", index_filename);
+            while (--i >= 0) {
+                fclose(region_fp[i]);
+            }
+            free(filter_blocks);
+            return 0;
+        }
+        fseek(region_fp[i], region_offset[i], SEEK_SET);
+    }
+
+    // Second pass - write keys and taxids
+    fseek(fp, start, SEEK_SET);
+    offset = start;
+    while ((offset < *end) && (fgets(line, MAX_LINE_LENGTH, fp))) {
+        uint32_t taxid32;
+
+        offset += strlen(line);
+        split_fields(line, &accession, &version, &taxid, &gi);
+        if ((accession == NULL) || (version == NULL)) {
+            continue;
+        }
+        taxid32 = taxid;
+        if (filter_blocks) {
+            test_filter_bits(filter_blocks, filter_header.block_count, filter_header.hashes, accession, 1);
+        }
+        if (pack_accession(accession, &packed)) {
+            fwrite(&packed, sizeof(PackedKey), 1, region_fp[0]);
+            fwrite(&taxid32, sizeof(uint32_t), 1, region_fp[1]);
+        } else {
+            memset(key, 0, key_width);
+            memcpy(key, accession, strlen(accession));
+            fwrite(key, key_width, 1, region_fp[2]);
+            fwrite(&taxid32, sizeof(uint32_t), 1, region_fp[3]);
+        }
+    }
+
+    for (i=0; i<4; i++) {
+        failed |= ferror(region_fp[i]);
+        failed |= fclose(region_fp[i]) != 0;
+    }
+    if (failed) {
+        log_message(log_fp, "Error: failed writing %s\n", index_filename);
+        free(filter_blocks);
+        return 0;
+    }
+
+    if (filter_blocks) {
+        failed = !write_filter_file(log_fp, filter_filename, index_filename, &filter_header, filter_blocks);
+        free(filter_blocks);
+        if (failed) {
+            return 0;
+        }
+    }
+
+    log_message(log_fp, "Indexed %lu accessions.\n", (unsigned long)(count + fallback_count));
+
+    return 1;
+}
+
+/*----------------------------------------------------------------------*
+ * Function:   acc2tax_build_index
+ * Purpose:    Convert the sorted accession text file into a binary index
+ * Parameters: options -> database directory, type and log file
+ * Returns:    1 on success, 0 on failure
+ *----------------------------------------------------------------------*/
+int acc2tax_build_index(const Acc2TaxOptions* options)
+{
+    FILE* log_fp = options->log_fp;
+    char text_filename[MAX_FILENAME];
+    char index_filename[MAX_FILENAME];
+    uint64_t end;
+    FILE* fp;
+    int built;
+
+    get_accession_filenames(options->database_dir, options->protein, text_filename, index_filename);
+    log_message(log_fp, "Opening database file %s\n", text_filename);
+    fp = fopen(text_filename, "r");
+    if (!fp) {
+        log_message(log_fp, "Error: can't open %s\n", text_filename);
+        return 0;
+    }
+
+    built = build_index_range(log_fp, fp, text_filename, 0, NULL, index_filename, options->filter_bits, &end);
+    fclose(fp);
+
+    if (built) {
+        log_message(log_fp, "Done.\n");
+    }
+
+    return built;
+}
+
+/*----------------------------------------------------------------------*
+ * Function:   read_shard_manifest
+ * Purpose:    Read a shard manifest. After a SHARD_MAGIC and version
+ *             line, each line gives the first accession of a shard (empty
+ *             for the first shard), a tab and the shard's index file.
+ *             Filenames not starting with / are relative to the database
+ *             directory. Lines starting with # are ignored.
+ * Parameters: log_fp -> log file, or NULL
+ *             database_dir -> database directory
+ *             filename -> filename of manifest
+ *             shards -> to store allocated array of shards
+ *             count -> to store number of shards
+ * Returns:    1 if read, 0 if there is no manifest, -1 if it is bad
+ *----------------------------------------------------------------------*/
+static int read_shard_manifest(FILE* log_fp, const char* database_dir, const char* filename, ShardEntry** shards, int* count)
+{
+    char line[MAX_LINE_LENGTH];
+    char magic[8];
+    ShardEntry* entries = NULL;
+    int entries_size = 0;
+    int version;
+    int written;
+    int n = 0;
+    FILE* fp = fopen(filename, "r");
+
+    if (!fp) {
+        return 0;
+    }
+
+    if ((!fgets(line, MAX_LINE_LENGTH, fp)) ||
+        (sscanf(line, "%7s %d", magic, &version) != 2) ||
+        (strcmp(magic, SHARD_MAGIC) != 0)) {
+        log_message(log_fp, "Error: %s is not an acc2tax shard manifest\n", filename);
+        fclose(fp);
+        return -1;
+    }
+
+    if (version != SHARD_VERSION) {
+        log_message(log_fp, "Error: %s is shard manifest version %d, expected %d\n", filename, version, SHARD_VERSION);
+        fclose(fp);
+        return -1;
+    }
+
+    while (fgets(line, MAX_LINE_LENGTH, fp)) {
+        char* key = line;
+        char* name;
+
+        line[strcspn(line, "\r\n")] = 0;
+        if ((line[0] == 0) || (line[0] == '#')) {
+            continue;
+        }
+
+        name = strchr(line, '\t');
+        if ((!name) || (name[1] == 0)) {
+            log_message(log_fp, "Error: %s has a line without a shard filename\n", filename);
+            break;
+        }
+        *name++ = 0;
+
+        if (strlen(key) > MAX_KEY_WIDTH) {
+            log_message(log_fp, "Error: %s has a first key longer than %d characters\n", filename, MAX_KEY_WIDTH);
+            break;
+        } else if ((n == 0) && (key[0] != 0)) {
+            log_message(log_fp, "Error: first shard in %s must have an empty first key\n", filename);
+            break;
+        } else if ((n > 0) && (strcmp(entries[n - 1].first_key, key) >= 0)) {
+            log_message(log_fp, "Error: shards in %s are not in order (%s follows %s)\n", filename, key, entries[n - 1].first_key);
+            break;
+        } else if (n == MAX_SHARDS) {
+            log_message(log_fp, "Error: %s lists more than %d shards\n", filename, MAX_SHARDS);
+            break;
+        }
+
+        if (n == entries_size) {
+            ShardEntry* grown;
+
+            entries_size = entries_size ? entries_size * 2 : 16;
+            grown = realloc(entries, entries_size * sizeof(ShardEntry));
+            if (!grown) {
+                log_message(log_fp, "Error: couldn't allocate memory.\n");
+                break;
+            }
+            entries = grown;
+        }
+
+        memset(&entries[n], 0, sizeof(ShardEntry));
+        strcpy(entries[n].first_key, key);
+        if (name[0] == '/') {
+            written = snprintf(entries[n].filename, sizeof(entries[n].filename), "%s", name);
+        } else {
+            written = snprintf(entries[n].filename, sizeof(entries[n].filename), "%s/%s", database_dir, name);
+        }
+        if ((written < 0) || ((size_t)written >= sizeof(entries[n].filename))) {
+            log_message(log_fp, "Error: shard filename %s too long\n", name);
+            break;
+        }
+        n++;
+    }
+
+    if ((feof(fp)) && (n == 0)) {
+        log_message(log_fp, "Error: %s lists no shards\n", filename);
+    }
+    if ((!feof(fp)) || (n == 0)) {
+        free(entries);
+        fclose(fp);
+        return -1;
+    }
+
+    fclose(fp);
+    *shards = entries;
+    *count = n;
+
+    return 1;
+}
+
+/*----------------------------------------------------------------------*
+ * Function:   write_shard_indexes
+ * Purpose:    Write the index file of each shard from consecutive ranges
+ *             of the sorted text file
+ * Parameters: log_fp -> log file, or NULL
+ *             text_filename -> filename of sorted text file
+ *             shards -> shards, in order of first key
+ *             count = number of shards
+ *             filter_bits = bits per key of Bloom filters, or 0
+ * Returns:    1 on success, 0 on failure
+ *----------------------------------------------------------------------*/
+static int write_shard_indexes(FILE* log_fp, const char* text_filename, ShardEntry* shards, int count, unsigned int filter_bits)
+{
+    uint64_t start = 0;
+    uint64_t end;
+    FILE* fp;
+    int built = 1;
+    int i;
+
+    log_message(log_fp, "Opening database file %s\n", text_filename);
+    fp = fopen(text_filename, "r");
+    if (!fp) {
+        log_message(log_fp, "Error: can't open %s\n", text_filename);
+        return 0;
+    }
+
+    for (i=0; (built) && (i<count); i++) {
+        log_message(log_fp, "Shard %d of %d, from %s\n", i + 1, count, shards[i].first_key[0] ? shards[i].first_key : "start");
+        built = build_index_range(log_fp, fp, text_filename, start, i + 1 < count ? shards[i + 1].first_key : NULL, shards[i].filename, filter_bits, &end);
+        start = end;
+    }
+
+    fclose(fp);
+
+    return built;
+}
+
+/*----------------------------------------------------------------------*
+ * Function:   acc2tax_build_shards
+ * Purpose:    Split the binary index by accession prefix range into
+ *             shard index files, listed in a manifest alongside the text
+ *             file. Shard files can be moved (eg. to faster storage) by
+ *             editing their filenames in the manifest. With no first
+ *             keys, rebuilds the shards of an existing manifest, if any.
+ * Parameters: options -> database directory, type and log file
+ *             first_keys -> first accession of each shard but the first,
+ *                           in order
+ *             n_keys = number of first keys
+ * Returns:    1 on success, 0 on failure
+ *----------------------------------------------------------------------*/
+int acc2tax_build_shards(const Acc2TaxOptions* options, char** first_keys, int n_keys)
+{
+    FILE* log_fp = options->log_fp;
+    char text_filename[MAX_FILENAME];
+    char index_filename[MAX_FILENAME];
+    char manifest_filename[MAX_FILENAME];
+    char temp_filename[MAX_FILENAME + 32];
+    ShardEntry* shards;
+    int count;
+    int opened;
+    int built;
+    int failed;
+    FILE* fp;
+    int i;
+
+    get_accession_filenames(options->database_dir, options->protein, text_filename, index_filename);
+    get_manifest_filename(options->database_dir, options->protein, manifest_filename);
+
+    if (n_keys == 0) {
+        opened = read_shard_manifest(log_fp, options->database_dir, manifest_filename, &shards, &count);
+        if (opened <= 0) {
+            return opened == 0;
+        }
+        log_message(log_fp, "Rebuilding %d shards listed in %s\n", count, manifest_filename);
+        built = write_shard_indexes(log_fp, text_filename, shards, count, options->filter_bits);
+        free(shards);
+        if (built) {
+            log_message(log_fp, "Done.\n");
+        }
+        return built;
+    }
+
+    if ((n_keys < 0) || (n_keys + 1 > MAX_SHARDS)) {
+        log_message(log_fp, "Error: can't have more than %d shards\n", MAX_SHARDS);
+        return 0;
+    }
+    for (i=0; i<n_keys; i++) {
+        if ((first_keys[i][0] == 0) || (strlen(first_keys[i]) > MAX_KEY_WIDTH) || (strpbrk(first_keys[i], "\t\r\n"))) {
+            log_message(log_fp, "Error: bad shard first key '%s'\n", first_keys[i]);
+            return 0;
+        }
+        if ((i > 0) && (strcmp(first_keys[i - 1], first_keys[i]) >= 0)) {
+            log_message(log_fp, "Error: shard first keys must be in sorted order (%s follows %s)\n", first_keys[i], first_keys[i - 1]);
+            return 0;
+        }
+    }
+
+    count = n_keys + 1;
+    shards = calloc(count, sizeof(ShardEntry));
+    if (!shards) {
+        log_message(log_fp, "Error: couldn't allocate memory.\n");
+        return 0;
+    }
+
+    // Shard n of acc2tax_nucl_all.idx is acc2tax_nucl_all.n.idx
+    index_filename[strlen(index_filename) - 4] = 0;
+    for (i=0; i<count; i++) {
+        if (i > 0) {
+            strcpy(shards[i].first_key, first_keys[i - 1]);
+        }
+        sprintf(shards[i].filename, "%s.%d.idx", index_filename, i);
+    }
+
+    built = write_shard_indexes(log_fp, text_filename, shards, count, options->filter_bits);
+
+    if (built) {
+        sprintf(temp_filename, "%s.tmp", manifest_filename);
+        log_message(log_fp, "Writing shard manifest %s\n", manifest_filename);
+        fp = fopen(temp_filename, "w");
+        if (!fp) {
+            log_message(log_fp, "Error: can't open %s\n", temp_filename);
+            built = 0;
+        } else {
+            fprintf(fp, "%s %d\n", SHARD_MAGIC, SHARD_VERSION);
+            for (i=0; i<count; i++) {
+                fprintf(fp, "%s\t%s\n", shards[i].first_key, strrchr(shards[i].filename, '/') + 1);
+            }
+            failed = ferror(fp);
+            failed |= fclose(fp) != 0;
+            if (failed) {
+                log_message(log_fp, "Error: failed writing %s\n", temp_filename);
+                unlink(temp_filename);
+                built = 0;
+            } else if (rename(temp_filename, manifest_filename) != 0) {
+                log_message(log_fp, "Error: can't rename %s to %s\n", temp_filename, manifest_filename);
+                built = 0;
+            }
+        }
+    }
+
+    free(shards);
+
+    if (built) {
+        log_message(log_fp, "Done. Wrote %d shards.\n", count);
+    }
+
+    return built;
+}
+
+/*----------------------------------------------------------------------*
+ * Function:   compare_accession_fields
+ * Purpose:    Compare the accession fields of two records (or bare
+ *             accessions) exactly as strcmp would compare the accessions
+ * Parameters: a, b -> records
+ * Returns:    <0, 0 or >0
+ *----------------------------------------------------------------------*/
+static int compare_accession_fields(const char* a, const char* b)
+{
+    int char_a;
+    int char_b;
+
+    while ((*a == *b) && (*a != '\t') && (*a != 0)) {
+        a++;
+        b++;
+    }
+
+    char_a = ((*a == '\t') || (*a == '\n')) ? 0 : (unsigned char)*a;
+    char_b = ((*b == '\t') || (*b == '\n')) ? 0 : (unsigned char)*b;
+
+    return char_a - char_b;
+}
+
+/*----------------------------------------------------------------------*
+ * Function:   compare_records
+ * Purpose:    Compare two accession file records. Records are ordered by
+ *             accession exactly as strcmp orders the accession field,
+ *             then by the rest of the line.
+ * Parameters: a, b -> records
+ * Returns:    <0, 0 or >0
+ *----------------------------------------------------------------------*/
+static int compare_records(const char* a, const char* b)
+{
+    int similarity = compare_accession_fields(a, b);
+
+    if (similarity == 0) {
+        similarity = strcmp(a, b);
+    }
+
+    return similarity;
+}
+
+/*----------------------------------------------------------------------*
+ * Function:   compare_record_pointers
+ * Purpose:    qsort comparator for an array of record pointers
+ * Parameters: a, b -> pointers to records
+ * Returns:    compare_records of the two records
+ *----------------------------------------------------------------------*/
+static int compare_record_pointers(const void* a, const void* b)
+{
+    return compare_records(*(char* const*)a, *(char* const*)b);
+}
+
+/*----------------------------------------------------------------------*
+ * Function:   sort_worker
+ * Purpose:    Thread to sort one slice of a run
+ * Parameters: arg -> SortSlice
+ * Returns:    NULL
+ *----------------------------------------------------------------------*/
+static void* sort_worker(void* arg)
+{
+    SortSlice* slice = arg;
+
+    qsort(slice->lines, slice->n, sizeof(char*), compare_record_pointers);
+
+    return NULL;
+}
+
+/*----------------------------------------------------------------------*
+ * Function:   advance_merge_source
+ * Purpose:    Move a merge source on to its next record
+ * Parameters: source -> merge source
+ * Returns:    1 if there is a record, 0 if the source is finished
+ *----------------------------------------------------------------------*/
+static int advance_merge_source(MergeSource* source)
+{
+    if (source->fp) {
+        if (fgets(source->buffer, MAX_LINE_LENGTH, source->fp)) {
+            source->buffer[strcspn(source->buffer, "\r\n")] = 0;
+            source->line = source->buffer;
+        } else {
+            source->line = 0;
+        }
+    } else {
+        source->line = source->next < source->end ? *source->next++ : 0;
+    }
+
+    return source->line != 0;
+}
+
+/*----------------------------------------------------------------------*
+ * Function:   sift_down
+ * Purpose:    Restore heap order of merge sources below an entry
+ * Parameters: heap -> heap of sources, smallest record first
+ *             n = number of sources in heap
+ *             i = entry to move down
+ * Returns:    None
+ *----------------------------------------------------------------------*/
+static void sift_down(MergeSource** heap, int n, int i)
+{
+    while (1) {
+        int smallest = i;
+        int left = (2 * i) + 1;
+        int right = left + 1;
+        MergeSource* swap;
+
+        if ((left < n) && (compare_records(heap[left]->line, heap[smallest]->line) < 0)) {
+            smallest = left;
+        }
+        if ((right < n) && (compare_records(heap[right]->line, heap[smallest]->line) < 0)) {
+            smallest = right;
+        }
+        if (smallest == i) {
+            break;
+        }
+        swap = heap[i];
+        heap[i] = heap[smallest];
+        heap[smallest] = swap;
+        i = smallest;
+    }
+}
+
+/*----------------------------------------------------------------------*
+ * Function:   merge_sources
+ * Purpose:    Merge sorted sources into one sorted file
+ * Parameters: sources -> array of sources
+ *             n = number of sources
+ *             fp_out -> file to write records to
+ * Returns:    Number of records written
+ *----------------------------------------------------------------------*/
+static uint64_t merge_sources(MergeSource* sources, int n, FILE* fp_out)
+{
+    MergeSource** heap = malloc((n + 1) * sizeof(MergeSource*));
+    uint64_t count = 0;
+    int heap_size = 0;
+    int i;
+
+    if (!heap) {
+        return 0;
+    }
+
+    for (i=0; i<n; i++) {
+        if (advance_merge_source(&sources[i])) {
+            heap[heap_size++] = &sources[i];
+        }
+    }
+    for (i=(heap_size / 2) - 1; i>=0; i--) {
+        sift_down(heap, heap_size, i);
+    }
+
+    while (heap_size > 0) {
+        fputs(heap[0]->line, fp_out);
+        fputc('\n', fp_out);
+        count++;
+        if (!advance_merge_source(heap[0])) {
+            heap[0] = heap[--heap_size];
+        }
+        sift_down(heap, heap_size, 0);
+    }
+
+    free(heap);
+
+    return count;
+}
+
+/*----------------------------------------------------------------------*
+ * Function:   sort_records
+ * Purpose:    Sort records held in memory by splitting them into slices
+ *             sorted by separate threads. Each slice becomes a merge
+ *             source.
+ * Parameters: lines -> array of records
+ *             n = number of records
+ *             threads = number of sort threads
+ *             sources -> array of at least threads sources to fill in
+ * Returns:    Number of sources filled in
+ *----------------------------------------------------------------------*/
+static int sort_records(char** lines, size_t n, int threads, MergeSource* sources)
+{
+    SortSlice slices[MAX_SORT_THREADS];
+    pthread_t workers[MAX_SORT_THREADS];
+    int started[MAX_SORT_THREADS];
+    size_t slice_size;
+    int i;
+
+    if (threads > MAX_SORT_THREADS) {
+        threads = MAX_SORT_THREADS;
+    }
+    if (threads > (n / 1024) + 1) {
+        threads = (n / 1024) + 1;
+    }
+    slice_size = (n + threads - 1) / threads;
+
+    for (i=0; i<threads; i++) {
+        size_t start = i * slice_size;
+
+        slices[i].lines = lines + start;
+        slices[i].n = start < n ? (n - start < slice_size ? n - start : slice_size) : 0;
+        started[i] = (i < threads - 1) && (pthread_create(&workers[i], NULL, sort_worker, &slices[i]) == 0);
+        if (!started[i]) {
+            sort_worker(&slices[i]);
+        }
+    }
+
+    for (i=0; i<threads; i++) {
+        if (started[i]) {
+            pthread_join(workers[i], NULL);
+        }
+        memset(&sources[i], 0, sizeof(MergeSource));
+        sources[i].next = slices[i].lines;
+        sources[i].end = slices[i].lines + slices[i].n;
+    }
+
+    return threads;
+}
+
+/*----------------------------------------------------------------------*
+ * Function:   write_sorted_run
+ * Purpose:    Sort records held in memory and write them to a file
+ * Parameters: lines -> array of records
+ *             n = number of records
+ *             threads = number of sort threads
+ *             fp_out -> file to write to
+ * Returns:    Number of records written
+ *----------------------------------------------------------------------*/
+static uint64_t write_sorted_run(char** lines, size_t n, int threads, FILE* fp_out)
+{
+    MergeSource sources[MAX_SORT_THREADS];
+    int n_sources = sort_records(lines, n, threads, sources);
+
+    return merge_sources(sources, n_sources, fp_out);
+}
+
+/*----------------------------------------------------------------------*
+ * Function:   acc2tax_build_database
+ * Purpose:    Build the sorted accession file from NCBI accession2taxid
+ *             files (gzipped or plain). Records are read into a buffer
+ *             of at most memory_limit bytes, each full buffer is sorted
+ *             with several threads and written as a run, and the runs
+ *             are then merged. If everything fits in one buffer no runs
+ *             are written.
+ * Parameters: options -> database directory, type and log file
+ *             filenames -> accession2taxid files to read
+ *             n_files = number of files
+ *             memory_limit = bytes to use for sorting
+ *             threads = number of sort threads
+ * Returns:    1 on success, 0 on failure
+ *----------------------------------------------------------------------*/
+int acc2tax_build_database(const Acc2TaxOptions* options, char** filenames, int n_files, size_t memory_limit, int threads)
+{
+    FILE* log_fp = options->log_fp;
+    char text_filename[MAX_FILENAME];
+    char index_filename[MAX_FILENAME];
+    char temp_filename[MAX_FILENAME + 32];
+    char run_filename[MAX_FILENAME + 32];
+    char line[MAX_LINE_LENGTH];
+    size_t text_size = (memory_limit / 4) * 3;
+    size_t lines_size = (memory_limit / 4) / sizeof(char*);
+    char* text = malloc(text_size);
+    char** lines = malloc(lines_size * sizeof(char*));
+    size_t text_used = 0;
+    size_t n_lines = 0;
+    uint64_t records = 0;
+    uint64_t written = 0;
+    int run_count = 0;
+    int failed = 0;
+    FILE* fp_out;
+    int i;
+
+    if ((!text) || (!lines)) {
+        log_message(log_fp, "Error: couldn't allocate %lu Mb for sorting.\n", (unsigned long)(memory_limit / (1024 * 1024)));
+        free(text);
+        free(lines);
+        return 0;
+    }
+
+    get_accession_filenames(options->database_dir, options->protein, text_filename, index_filename);
+    sprintf(temp_filename, "%s.tmp", text_filename);
+
+    for (i=0; (i<n_files) && (!failed); i++) {
+        gzFile gz = gzopen(filenames[i], "rb");
+
+        log_message(log_fp, "Reading %s\n", filenames[i]);
+        if (!gz) {
+            log_message(log_fp, "Error: can't open %s\n", filenames[i]);
+            failed = 1;
+            break;
+        }
+        gzbuffer(gz, 1024 * 1024);
+
+        while (gzgets(gz, line, MAX_LINE_LENGTH)) {
+            size_t length;
+
+            line[strcspn(line, "\r\n")] = 0;
+            if ((line[0] == 0) || (strncmp(line, "accession\t", 10) == 0)) {
+                continue;
+            }
+            length = strlen(line) + 1;
+
+            // Buffer full - sort it and write it out as a run
+            if ((text_used + length > text_size) || (n_lines == lines_size)) {
+                FILE* fp_run;
+                int run_failed;
+
+                if (run_count == MAX_SORT_RUNS) {
+                    log_message(log_fp, "Error: too many sort runs - allow more memory for sorting\n");
+                    failed = 1;
+                    break;
+                }
+                sprintf(run_filename, "%s.run%d", text_filename, run_count);
+                log_message(log_fp, "Sorting %lu records into %s\n", (unsigned long)n_lines, run_filename);
+                fp_run = fopen(run_filename, "w");
+                if (!fp_run) {
+                    log_message(log_fp, "Error: can't open %s\n", run_filename);
+                    failed = 1;
+                    break;
+                }
+                run_count++;
+                run_failed = (write_sorted_run(lines, n_lines, threads, fp_run) != n_lines) || (ferror(fp_run));
+                if ((fclose(fp_run) != 0) || (run_failed)) {
+                    log_message(log_fp, "Error: failed writing %s\n", run_filename);
+                    failed = 1;
+                    break;
+                }
+                text_used = 0;
+                n_lines = 0;
+            }
+
+            memcpy(text + text_used, line, length);
+            lines[n_lines++] = text + text_used;
+            text_used += length;
+            records++;
+        }
+
+        if ((gzclose(gz) != Z_OK) && (!failed)) {
+            log_message(log_fp, "Error: failed reading %s\n", filenames[i]);
+            failed = 1;
+        }
+    }
+
+    if (!failed) {
+        log_message(log_fp, "Writing %lu records to %s\n", (unsigned long)records, text_filename);
+        fp_out = fopen(temp_filename, "w");
+        if (!fp_out) {
+            log_message(log_fp, "Error: can't open %s\n", temp_filename);
+            failed = 1;
+        } else {
+            setvbuf(fp_out, NULL, _IOFBF, 1024 * 1024);
+            if (run_count == 0) {
+                // Everything fitted in memory
+                written = write_sorted_run(lines, n_lines, threads, fp_out);
+            } else {
+                MergeSource* sources = calloc(run_count + MAX_SORT_THREADS, sizeof(MergeSource));
+                char* buffers = malloc((size_t)run_count * MAX_LINE_LENGTH);
+                int n_sources = run_count;
+
+                if ((!sources) || (!buffers)) {
+                    log_message(log_fp, "Error: couldn't allocate memory.\n");
+                    failed = 1;
+                }
+
+                // Runs on disc are merged with the records still in memory
+                log_message(log_fp, "Merging %d runs\n", run_count + 1);
+                for (i=0; (i<run_count) && (!failed); i++) {
+                    sprintf(run_filename, "%s.run%d", text_filename, i);
+                    sources[i].fp = fopen(run_filename, "r");
+                    if (!sources[i].fp) {
+                        log_message(log_fp, "Error: can't open %s\n", run_filename);
+                        failed = 1;
+                    } else {
+                        setvbuf(sources[i].fp, NULL, _IOFBF, 256 * 1024);
+                    }
+                    sources[i].buffer = buffers + ((size_t)i * MAX_LINE_LENGTH);
+                }
+                if (!failed) {
+                    n_sources += sort_records(lines, n_lines, threads, sources + run_count);
+                    written = merge_sources(sources, n_sources, fp_out);
+                }
+                for (i=0; (sources) && (i<run_count); i++) {
+                    if (sources[i].fp) {
+                        fclose(sources[i].fp);
+                    }
+                }
+                free(sources);
+                free(buffers);
+            }
+
+            if ((ferror(fp_out)) || (fclose(fp_out) != 0) || (written != records)) {
+                log_message(log_fp, "Error: failed writing %s\n", temp_filename);
+                failed = 1;
+            }
+        }
+    }
+
+    for (i=0; i<run_count; i++) {
+        sprintf(run_filename, "%s.run%d", text_filename, i);
+        unlink(run_filename);
+    }
+    free(text);
+    free(lines);
+
+    if (failed) {
+        unlink(temp_filename);
+        return 0;
+    }
+
+    if (rename(temp_filename, text_filename) != 0) {
+        log_message(log_fp, "Error: can't rename %s to %s\n", temp_filename, text_filename);
+        return 0;
+    }
+
+    log_message(log_fp, "Done. Wrote %lu records.\n", (unsigned long)records);
+
+    return 1;
+}
+
+/*----------------------------------------------------------------------*
+ * Function:   delta_line_key
+ * Purpose:    Return the accession of a delta line, skipping the - that
+ *             marks a removal and any spaces or tabs after it
+ * Parameters: line -> delta line
+ * Returns:    Pointer to accession field
+ *----------------------------------------------------------------------*/
+static const char* delta_line_key(const char* line)
+{
+    return line[0] == '-' ? line + 1 + strspn(line + 1, " \t") : line;
+}
+
+/*----------------------------------------------------------------------*
+ * Function:   delta_key
+ * Purpose:    Return the accession of a delta record
+ * Parameters: record -> delta record
+ * Returns:    Pointer to accession field
+ *----------------------------------------------------------------------*/
+static const char* delta_key(const DeltaRecord* record)
+{
+    return delta_line_key(record->line);
+}
+
+/*----------------------------------------------------------------------*
+ * Function:   compare_delta_records
+ * Purpose:    qsort comparator ordering delta records by accession, then
+ *             by their position in the delta files
+ * Parameters: a, b -> pointers to DeltaRecord
+ * Returns:    <0, 0 or >0
+ *----------------------------------------------------------------------*/
+static int compare_delta_records(const void* a, const void* b)
+{
+    const DeltaRecord* record_a = a;
+    const DeltaRecord* record_b = b;
+    int similarity = compare_accession_fields(delta_key(record_a), delta_key(record_b));
+
+    if (similarity == 0) {
+        similarity = (record_a->sequence > record_b->sequence) - (record_a->sequence < record_b->sequence);
+    }
+
+    return similarity;
+}
+
+/*----------------------------------------------------------------------*
+ * Function:   free_delta
+ * Purpose:    Free the delta text and records read so far
+ * Parameters: text -> record text
+ *             records -> records
+ * Returns:    None
+ *----------------------------------------------------------------------*/
+static void free_delta(char** text, DeltaRecord** records)
+{
+    free(*text);
+    free(*records);
+    *text = NULL;
+    *records = NULL;
+}
+
+/*----------------------------------------------------------------------*
+ * Function:   load_delta
+ * Purpose:    Read delta files into memory, sort them and keep only the
+ *             last record given for each accession
+ * Parameters: log_fp -> log file, or NULL
+ *             filenames -> delta files (gzipped or plain)
+ *             n_files = number of files
+ *             text -> to store record text, to be freed by caller
+ *             records -> to store records, to be freed by caller
+ *             n_records -> to store number of records
+ * Returns:    1 on success, 0 on failure
+ *----------------------------------------------------------------------*/
+static int load_delta(FILE* log_fp, char** filenames, int n_files, char** text, DeltaRecord** records, size_t* n_records)
+{
+    char line[MAX_LINE_LENGTH];
+    size_t text_size = 0;
+    size_t text_used = 0;
+    size_t records_size = 0;
+    size_t n = 0;
+    size_t i;
+    size_t kept = 0;
+    size_t rejected = 0;
+    int f;
+
+    *text = 0;
+    *records = 0;
+
+    for (f=0; f<n_files; f++) {
+        gzFile gz = gzopen(filenames[f], "rb");
+        unsigned long line_number = 0;
+
+        log_message(log_fp, "Reading %s\n", filenames[f]);
+        if (!gz) {
+            log_message(log_fp, "Error: can't open %s\n", filenames[f]);
+            free_delta(text, records);
+            return 0;
+        }
+
+        while (gzgets(gz, line, MAX_LINE_LENGTH)) {
+            const char* key;
+            size_t length;
+
+            line_number++;
+            line[strcspn(line, "\r\n")] = 0;
+            if ((line[0] == 0) || (strncmp(line, "accession\t", 10) == 0)) {
+                continue;
+            }
+            key = delta_line_key(line);
+            if ((key[0] == 0) || (key[0] == ' ') || (key[0] == '\t')) {
+                log_message(log_fp, "Warning: ignoring line %lu of %s, which has no accession\n", line_number, filenames[f]);
+                rejected++;
+                continue;
+            }
+            length = strlen(line) + 1;
+
+            if (text_used + length > text_size) {
+                char* new_text;
+
+                text_size = (text_size + length) * 2;
+                new_text = realloc(*text, text_size);
+                if (!new_text) {
+                    log_message(log_fp, "Error: couldn't allocate memory.\n");
+                    gzclose(gz);
+                    free_delta(text, records);
+                    return 0;
+                }
+                *text = new_text;
+            }
+            if (n == records_size) {
+                DeltaRecord* new_records;
+
+                records_size = records_size ? records_size * 2 : 1024;
+                new_records = realloc(*records, records_size * sizeof(DeltaRecord));
+                if (!new_records) {
+                    log_message(log_fp, "Error: couldn't allocate memory.\n");
+                    gzclose(gz);
+                    free_delta(text, records);
+                    return 0;
+                }
+                *records = new_records;
+            }
+
+            memcpy(*text + text_used, line, length);
+            (*records)[n].offset = text_used;
+            (*records)[n].sequence = n;
+            text_used += length;
+            n++;
+        }
+
+        if (gzclose(gz) != Z_OK) {
+            log_message(log_fp, "Error: failed reading %s\n", filenames[f]);
+            free_delta(text, records);
+            return 0;
+        }
+    }
+
+    // Text is complete, so offsets can become pointers
+    for (i=0; i<n; i++) {
+        (*records)[i].line = *text + (*records)[i].offset;
+    }
+    qsort(*records, n, sizeof(DeltaRecord), compare_delta_records);
+
+    for (i=0; i<n; i++) {
+        if ((i + 1 < n) && (compare_accession_fields(delta_key(&(*records)[i]), delta_key(&(*records)[i + 1])) == 0)) {
+            continue;
+        }
+        (*records)[kept++] = (*records)[i];
+    }
+    *n_records = kept;
+
+    log_message(log_fp, "Delta has %lu records for %lu accessions\n", (unsigned long)n, (unsigned long)kept);
+    if (rejected > 0) {
+        log_message(log_fp, "Warning: ignored %lu delta lines without an accession\n", (unsigned long)rejected);
+    }
+
+    return 1;
+}
+
+/*----------------------------------------------------------------------*
+ * Function:   acc2tax_update_database
+ * Purpose:    Apply delta files to the sorted accession file in one
+ *             sequential pass. Delta lines are accession file records,
+ *             which add an accession or replace all records for it, or
+ *             a - followed by an accession (optionally after spaces or
+ *             a tab), which removes it. Later
+ *             lines win. The delta is sorted in memory, so the cost is
+ *             the size of the delta plus one copy of the file. An
+ *             existing binary index is rebuilt from the new file.
+ * Parameters: options -> database directory, type and log file
+ *             filenames -> delta files (gzipped or plain)
+ *             n_files = number of files
+ * Returns:    1 on success, 0 on failure
+ *----------------------------------------------------------------------*/
+int acc2tax_update_database(const Acc2TaxOptions* options, char** filenames, int n_files)
+{
+    FILE* log_fp = options->log_fp;
+    char text_filename[MAX_FILENAME];
+    char index_filename[MAX_FILENAME];
+    char temp_filename[MAX_FILENAME + 32];
+    char line[MAX_LINE_LENGTH];
+    char* text;
+    DeltaRecord* records;
+    size_t n_records;
+    size_t d = 0;
+    uint64_t added = 0;
+    uint64_t changed = 0;
+    uint64_t removed = 0;
+    int have_line;
+    int matched = 0;
+    int failed;
+    FILE* fp_in;
+    FILE* fp_out;
+
+    if (!load_delta(log_fp, filenames, n_files, &text, &records, &n_records)) {
+        free(text);
+        free(records);
+        return 0;
+    }
+
+    get_accession_filenames(options->database_dir, options->protein, text_filename, index_filename);
+    sprintf(temp_filename, "%s.tmp", text_filename);
+
+    log_message(log_fp, "Updating %s\n", text_filename);
+    fp_in = fopen(text_filename, "r");
+    if (!fp_in) {
+        log_message(log_fp, "Error: can't open %s\n", text_filename);
+        free(text);
+        free(records);
+        return 0;
+    }
+    fp_out = fopen(temp_filename, "w");
+    if (!fp_out) {
+        log_message(log_fp, "Error: can't open %s\n", temp_filename);
+        fclose(fp_in);
+        free(text);
+        free(records);
+        return 0;
+    }
+    setvbuf(fp_in, NULL, _IOFBF, 1024 * 1024);
+    setvbuf(fp_out, NULL, _IOFBF, 1024 * 1024);
+
+    have_line = fgets(line, MAX_LINE_LENGTH, fp_in) != NULL;
+    while ((have_line) || (d < n_records)) {
+        int similarity = !have_line ? -1 : (d == n_records ? 1 : compare_accession_fields(delta_key(&records[d]), line));
+
+        if (similarity < 0) {
+            // Base has passed this delta accession
+            if (records[d].line[0] != '-') {
+                fputs(records[d].line, fp_out);
+                fputc('\n', fp_out);
+                if (matched) {
+                    changed++;
+                } else {
+                    added++;
+                }
+            } else if (matched) {
+                removed++;
+            }
+            matched = 0;
+            d++;
+        } else {
+            if (similarity == 0) {
+                // Replaced or removed - drop the base record
+                matched = 1;
+            } else {
+                fputs(line, fp_out);
+            }
+            have_line = fgets(line, MAX_LINE_LENGTH, fp_in) != NULL;
+        }
+    }
+
+    failed = ferror(fp_in);
+    fclose(fp_in);
+    failed |= ferror(fp_out);
+    failed |= fclose(fp_out) != 0;
+    free(text);
+    free(records);
+
+    if (failed) {
+        log_message(log_fp, "Error: failed writing %s\n", temp_filename);
+        unlink(temp_filename);
+        return 0;
+    }
+
+    if (rename(temp_filename, text_filename) != 0) {
+        log_message(log_fp, "Error: can't rename %s to %s\n", temp_filename, text_filename);
+        return 0;
+    }
+
+    log_message(log_fp, "Done. Added %lu, changed %lu, removed %lu accessions.\n", (unsigned long)added, (unsigned long)changed, (unsigned long)removed);
+
+    // An index or shards built from the old file would now be stale
+    if (!acc2tax_build_shards(options, NULL, 0)) {
+        return 0;
+    }
+    if (access(index_filename, F_OK) == 0) {
+        return acc2tax_build_index(options);
+    }
+
+    return 1;
+}
+
+/*----------------------------------------------------------------------*
+ * Function:   open_index_file
+ * Purpose:    Open binary accession index and check its header
+ * Parameters: db -> database handle
+ *             filename -> filename of index
+ * Returns:    1 if opened, 0 if no index exists, -1 if index is bad
+ *----------------------------------------------------------------------*/
+static int open_index_file(Acc2TaxDB* db, char* filename)
+{
+    IndexHeader* header = &db->index_header;
+
+    db->index_fp = fopen(filename, "r");
+    if (!db->index_fp) {
+        return 0;
+    }
+
+    if ((fread(header, sizeof(IndexHeader), 1, db->index_fp) != 1) ||
+        (strcmp(header->magic, INDEX_MAGIC) != 0)) {
+        log_message(db->log_fp, "Error: %s is not an acc2tax index\n", filename);
+        return -1;
+    }
+
+    if (header->version != INDEX_VERSION) {
+        log_message(db->log_fp, "Error: %s is index version %u, expected %d - rebuild with --build-index\n", filename, header->version, INDEX_VERSION);
+        return -1;
+    }
+
+    if ((header->key_width < 1) || (header->key_width > MAX_KEY_WIDTH)) {
+        log_message(db->log_fp, "Error: %s has bad key width %u\n", filename, header->key_width);
+        return -1;
+    }
+
+    db->index_tables[0].packed = 1;
+    db->index_tables[0].key_size = sizeof(PackedKey);
+    db->index_tables[0].count = header->count;
+    db->index_tables[0].keys_offset = sizeof(IndexHeader);
+    db->index_tables[0].taxids_offset = db->index_tables[0].keys_offset + (header->count * sizeof(PackedKey));
+    db->index_tables[1].packed = 0;
+    db->index_tables[1].key_size = header->key_width;
+    db->index_tables[1].count = header->fallback_count;
+    db->index_tables[1].keys_offset = db->index_tables[0].taxids_offset + (header->count * sizeof(uint32_t));
+    db->index_tables[1].taxids_offset = db->index_tables[1].keys_offset + (header->fallback_count * header->key_width);
+
+    log_message(db->log_fp, "Index entries: %lu packed, %lu fallback\n", (unsigned long)header->count, (unsigned long)header->fallback_count);
+
+    return 1;
+}
+
+/*----------------------------------------------------------------------*
+ * Function:   load_accession_filter
+ * Purpose:    Load the Bloom filter of an open index, if it has one that
+ *             was built with it
+ * Parameters: db -> database handle
+ *             index_filename -> filename of index
+ * Returns:    1 on success (with or without a filter), 0 on failure
+ *----------------------------------------------------------------------*/
+static int load_accession_filter(Acc2TaxDB* db, const char* index_filename)
+{
+    char filename[MAX_FILENAME + 32];
+    FilterHeader header;
+    struct stat st;
+    size_t size;
+    FILE* fp;
+
+    get_filter_filename(index_filename, filename);
+    fp = fopen(filename, "r");
+    if (!fp) {
+        return 1;
+    }
+
+    if ((fread(&header, sizeof(FilterHeader), 1, fp) != 1) ||
+        (strcmp(header.magic, FILTER_MAGIC) != 0) ||
+        (header.version != FILTER_VERSION) ||
+        (header.hashes < 1) || (header.hashes > MAX_FILTER_HASHES) ||
+        (header.block_count < 1)) {
+        log_message(db->log_fp, "Warning: %s is not an acc2tax Bloom filter, ignoring it\n", filename);
+        fclose(fp);
+        return 1;
+    }
+
+    if ((fstat(fileno(db->index_fp), &st) != 0) ||
+        (header.index_size != (uint64_t)st.st_size) ||
+        (header.index_mtime != (uint64_t)st.st_mtime) ||
+        (header.key_count != db->index_header.count + db->index_header.fallback_count)) {
+        log_message(db->log_fp, "Warning: %s wasn't built with %s, ignoring it - rebuild the index to update it\n", filename, index_filename);
+        fclose(fp);
+        return 1;
+    }
+
+    size = header.block_count * FILTER_BLOCK_WORDS * sizeof(uint64_t);
+    db->filter_blocks = malloc(size);
+    if (!db->filter_blocks) {
+        log_message(db->log_fp, "Error: couldn't allocate %lu bytes for Bloom filter\n", (unsigned long)size);
+        fclose(fp);
+        return 0;
+    }
+
+    if (fread(db->filter_blocks, size, 1, fp) != 1) {
+        log_message(db->log_fp, "Warning: couldn't read %s, ignoring it\n", filename);
+        free(db->filter_blocks);
+        db->filter_blocks = NULL;
+        fclose(fp);
+        return 1;
+    }
+    fclose(fp);
+
+    db->filter_block_count = header.block_count;
+    db->filter_hashes = header.hashes;
+    __atomic_add_fetch(&db->memory_required, size, __ATOMIC_RELAXED);
+    log_message(db->log_fp, "Loaded Bloom filter %s, %lu Kb\n", filename, (unsigned long)(size / 1024));
+
+    return 1;
+}
+
+/*----------------------------------------------------------------------*
+ * Function:   make_index_query
+ * Purpose:    Prepare an accession for searching the index - pack it if
+ *             possible, otherwise pad it to the fallback key width
+ * Parameters: db -> database handle
+ *             accession -> accession
+ *             query -> query to fill in
+ * Returns:    Index table to search
+ *----------------------------------------------------------------------*/
+static IndexTable* make_index_query(Acc2TaxDB* db, const char* accession, IndexQuery* query)
+{
+    uint32_t key_width = db->index_tables[1].key_size;
+
+    query->packed = pack_accession(accession, &query->packed_key);
+    if (query->packed) {
+        return &db->index_tables[0];
+    }
+
+    query->length = strlen(accession);
+    memset(query->key, 0, key_width);
+    memcpy(query->key, accession, query->length < key_width ? query->length : key_width);
+
+    return &db->index_tables[1];
+}
+
+/*----------------------------------------------------------------------*
+ * Function:   compare_index_query
+ * Purpose:    Compare a key from an index table with a query
+ * Parameters: table -> table key is from
+ *             key -> key
+ *             query -> query
+ * Returns:    <0, 0 or >0 as strcmp of the accessions would
+ *----------------------------------------------------------------------*/
+static inline int compare_index_query(const IndexTable* table, const char* key, const IndexQuery* query)
+{
+    int similarity;
+
+    if (table->packed) {
+        PackedKey packed_key;
+
+        memcpy(&packed_key, key, sizeof(PackedKey));
+        return compare_packed_keys(&packed_key, &query->packed_key);
+    }
+
+    similarity = memcmp(key, query->key, table->key_size);
+    if ((similarity == 0) && (query->length > table->key_size)) {
+        similarity = -1;
+    }
+
+    return similarity;
+}
+
+/*----------------------------------------------------------------------*
+ * Function:   find_indexed_accession
+ * Purpose:    Binary search the binary accession index
+ * Parameters: db -> database handle
+ *             search_accession -> accession to find
+ *             taxid -> to store taxid of accession
+ * Returns:    1 if found, 0 otherwise
+ *----------------------------------------------------------------------*/
+static int find_indexed_accession(Acc2TaxDB* db, const char* search_accession, long int* taxid)
+{
+    IndexQuery query;
+    IndexTable* table = make_index_query(db, search_accession, &query);
+    char probe[MAX_KEY_WIDTH];
+    int64_t min = 0;
+    int64_t max = (int64_t)table->count - 1;
+    uint32_t taxid32;
+    uint64_t probes = 0;
+    int fd = fileno(db->index_fp);
+    int found = 0;
+
+    while (min <= max) {
+        int64_t current = min + ((max - min) / 2);
+        int similarity;
+
+        if (pread(fd, probe, table->key_size, table->keys_offset + (current * table->key_size)) != table->key_size) {
+            break;
+        }
+        probes++;
+
+        similarity = compare_index_query(table, probe, &query);
+        if (similarity == 0) {
+            if (pread(fd, &taxid32, sizeof(uint32_t), table->taxids_offset + (current * sizeof(uint32_t))) == sizeof(uint32_t)) {
+                *taxid = taxid32;
+                found = 1;
+            }
+            break;
+        } else if (similarity > 0) {
+            max = current - 1;
+        } else {
+            min = current + 1;
+        }
+    }
+
+    add_stat(db, &db->stats.probes, probes);
+    add_stat(db, &db->stats.bytes_read, (probes * table->key_size) + (found ? sizeof(uint32_t) : 0));
+
+    return found;
+}
+
+/*----------------------------------------------------------------------*
+ * Function:   hash_packed_key
+ * Purpose:    Hash a packed key for the in-memory accession table
+ * Parameters: key -> key
+ * Returns:    Hash value
+ *----------------------------------------------------------------------*/
+static inline uint64_t hash_packed_key(const PackedKey* key)
+{
+    uint64_t h = (key->hi * 0x9E3779B97F4A7C15ULL) ^ (key->lo * 0xC2B2AE3D27D4EB4FULL);
+
+    h ^= h >> 31;
+    h *= 0xBF58476D1CE4E5B9ULL;
+    h ^= h >> 29;
+
+    return h;
+}
+
+/*----------------------------------------------------------------------*
+ * Function:   load_accession_hash
+ * Purpose:    Load the binary index into memory - packed keys into an
+ *             open addressing hash table, fallback keys into a sorted
+ *             array. The footprint is reported, and checked against
+ *             physical memory, before anything is allocated.
+ * Parameters: db -> database handle
+ * Returns:    1 on success, 0 on failure
+ *----------------------------------------------------------------------*/
+static int load_accession_hash(Acc2TaxDB* db)
+{
+    IndexTable* packed = &db->index_tables[0];
+    IndexTable* fallback = &db->index_tables[1];
+    PackedKey* keys;
+    uint32_t* chunk_taxids;
+    uint64_t capacity = 1024;
+    uint64_t fallback_bytes;
+    uint64_t footprint;
+    uint64_t physical = (uint64_t)sysconf(_SC_PHYS_PAGES) * sysconf(_SC_PAGESIZE);
+    uint64_t record;
+    int fd = fileno(db->index_fp);
+
+    // Keep the table at most 70% full
+    while (capacity * 7 < packed->count * 10) {
+        capacity *= 2;
+    }
+    fallback_bytes = fallback->count * (fallback->key_size + sizeof(uint32_t));
+    footprint = (capacity * sizeof(HashEntry)) + fallback_bytes;
+
+    log_message(db->log_fp, "In-memory accession table: %lu accessions, %lu slots, %lu Mb\n", (unsigned long)(packed->count + fallback->count), (unsigned long)capacity, (unsigned long)(footprint / (1024 * 1024)));
+    if ((physical > 0) && (footprint > physical)) {
+        log_message(db->log_fp, "Error: in-memory table needs more than the %lu Mb of physical memory\n", (unsigned long)(physical / (1024 * 1024)));
+        return 0;
+    }
+
+    db->hash_entries = calloc(capacity, sizeof(HashEntry));
+    db->fallback_keys = malloc(fallback->count * fallback->key_size + 1);
+    db->fallback_taxids = malloc((fallback->count + 1) * sizeof(uint32_t));
+    keys = malloc(BATCH_CHUNK * sizeof(PackedKey));
+    chunk_taxids = malloc(BATCH_CHUNK * sizeof(uint32_t));
+    if ((!db->hash_entries) || (!db->fallback_keys) || (!db->fallback_taxids) || (!keys) || (!chunk_taxids)) {
+        log_message(db->log_fp, "Error: couldn't allocate memory.\n");
+        free(keys);
+        free(chunk_taxids);
+        return 0;
+    }
+    db->hash_mask = capacity - 1;
+
+    for (record = 0; record < packed->count; record += BATCH_CHUNK) {
+        uint64_t chunk_size = packed->count - record < BATCH_CHUNK ? packed->count - record : BATCH_CHUNK;
+        uint64_t i;
+
+        if ((pread(fd, keys, chunk_size * sizeof(PackedKey), packed->keys_offset + (record * sizeof(PackedKey))) != chunk_size * sizeof(PackedKey)) ||
+            (pread(fd, chunk_taxids, chunk_size * sizeof(uint32_t), packed->taxids_offset + (record * sizeof(uint32_t))) != chunk_size * sizeof(uint32_t))) {
+            log_message(db->log_fp, "Error: short read from index\n");
+            free(keys);
+            free(chunk_taxids);
+            return 0;
+        }
+
+        for (i=0; i<chunk_size; i++) {
+            uint64_t slot = hash_packed_key(&keys[i]) & db->hash_mask;
+
+            while ((db->hash_entries[slot].key.hi != 0) && (compare_packed_keys(&db->hash_entries[slot].key, &keys[i]) != 0)) {
+                slot = (slot + 1) & db->hash_mask;
+            }
+
+            // Keep the first of any duplicate accessions
+            if (db->hash_entries[slot].key.hi == 0) {
+                db->hash_entries[slot].key = keys[i];
+                db->hash_entries[slot].taxid = chunk_taxids[i];
+            }
+        }
+    }
+
+    free(keys);
+    free(chunk_taxids);
+
+    if ((pread(fd, db->fallback_keys, fallback->count * fallback->key_size, fallback->keys_offset) != fallback->count * fallback->key_size) ||
+        (pread(fd, db->fallback_taxids, fallback->count * sizeof(uint32_t), fallback->taxids_offset) != fallback->count * sizeof(uint32_t))) {
+        log_message(db->log_fp, "Error: short read from index\n");
+        return 0;
+    }
+
+    db->memory_required += footprint;
+
+    return 1;
+}
+
+/*----------------------------------------------------------------------*
+ * Function:   find_hashed_accession
+ * Purpose:    Find an accession in the in-memory accession table
+ * Parameters: db -> database handle
+ *             search_accession -> accession to find
+ *             taxid -> to store taxid of accession
+ * Returns:    1 if found, 0 otherwise
+ *----------------------------------------------------------------------*/
+static int find_hashed_accession(Acc2TaxDB* db, const char* search_accession, long int* taxid)
+{
+    IndexQuery query;
+    IndexTable* table = make_index_query(db, search_accession, &query);
+    uint64_t probes = 0;
+    int found = 0;
+
+    if (table->packed) {
+        uint64_t slot = hash_packed_key(&query.packed_key) & db->hash_mask;
+
+        // Packed keys always have a non-zero top word, so 0 marks an empty slot
+        while (db->hash_entries[slot].key.hi != 0) {
+            probes++;
+            if (compare_packed_keys(&db->hash_entries[slot].key, &query.packed_key) == 0) {
+                *taxid = db->hash_entries[slot].taxid;
+                found = 1;
+                break;
+            }
+            slot = (slot + 1) & db->hash_mask;
+        }
+    } else {
+        int64_t min = 0;
+        int64_t max = (int64_t)table->count - 1;
+
+        while (min <= max) {
+            int64_t current = min + ((max - min) / 2);
+            int similarity = compare_index_query(table, db->fallback_keys + (current * table->key_size), &query);
+
+            probes++;
+            if (similarity == 0) {
+                *taxid = db->fallback_taxids[current];
+                found = 1;
+                break;
+            } else if (similarity > 0) {
+                max = current - 1;
+            } else {
+                min = current + 1;
+            }
+        }
+    }
+
+    add_stat(db, &db->stats.probes, probes);
+
+    return found;
+}
+
+/*----------------------------------------------------------------------*
+ * Function:   lock_cache_set, unlock_cache_set
+ * Purpose:    Take and release a cache set's spin lock. Sets are only
+ *             held for a few compares, so spinning beats a mutex.
+ *----------------------------------------------------------------------*/
+static inline void lock_cache_set(CacheSet* set)
+{
+    while (__atomic_test_and_set(&set->lock, __ATOMIC_ACQUIRE)) {
+        while (__atomic_load_n(&set->lock, __ATOMIC_RELAXED)) {
+        }
+    }
+}
+
+static inline void unlock_cache_set(CacheSet* set)
+{
+    __atomic_clear(&set->lock, __ATOMIC_RELEASE);
+}
+
+/*----------------------------------------------------------------------*
+ * Function:   find_cached_accession
+ * Purpose:    Look for an earlier lookup result in the cache
+ * Parameters: db -> database handle
+ *             key -> packed accession
+ *             taxid -> to store taxid
+ *             found -> to store 1 if the accession was found, 0 if not
+ * Returns:    1 if the result was cached, 0 otherwise
+ *----------------------------------------------------------------------*/
+static int find_cached_accession(Acc2TaxDB* db, const PackedKey* key, long int* taxid, int* found)
+{
+    CacheSet* set = &db->cache_sets[hash_packed_key(key) & db->cache_mask];
+    int cached = 0;
+    int i;
+
+    lock_cache_set(set);
+    for (i=0; i<CACHE_WAYS; i++) {
+        CacheEntry* entry = &set->entries[i];
+
+        if (compare_packed_keys(&entry->key, key) == 0) {
+            entry->referenced = 1;
+            *taxid = entry->taxid;
+            *found = entry->found;
+            cached = 1;
+            break;
+        }
+    }
+    unlock_cache_set(set);
+
+    return cached;
+}
+
+/*----------------------------------------------------------------------*
+ * Function:   add_cached_accession
+ * Purpose:    Remember a lookup result. The CLOCK hand passes over
+ *             entries used since it last came by, clearing their flags,
+ *             and replaces the first unused one. New entries start
+ *             unused, so IDs seen once go before repeated ones.
+ * Parameters: db -> database handle
+ *             key -> packed accession
+ *             taxid = taxid
+ *             found = 1 if the accession was found, 0 if not
+ * Returns:    None
+ *----------------------------------------------------------------------*/
+static void add_cached_accession(Acc2TaxDB* db, const PackedKey* key, long int taxid, int found)
+{
+    CacheSet* set = &db->cache_sets[hash_packed_key(key) & db->cache_mask];
+    CacheEntry* entry;
+    int i;
+
+    lock_cache_set(set);
+
+    // Another thread may have added it meanwhile
+    for (i=0; i<CACHE_WAYS; i++) {
+        if (compare_packed_keys(&set->entries[i].key, key) == 0) {
+            unlock_cache_set(set);
+            return;
+        }
+    }
+
+    while (1) {
+        entry = &set->entries[set->hand];
+        set->hand = (set->hand + 1) % CACHE_WAYS;
+        if ((entry->key.hi == 0) || (!entry->referenced)) {
+            break;
+        }
+        entry->referenced = 0;
+    }
+
+    entry->key = *key;
+    entry->taxid = taxid;
+    entry->found = found;
+    entry->referenced = 0;
+
+    unlock_cache_set(set);
+}
+
+/*----------------------------------------------------------------------*
+ * Function:   open_acc_file
+ * Purpose:    Open the sorted accession text file and map it
+ * Parameters: db -> database handle
+ *             filename -> filename of accession file
+ * Returns:    1 on success, 0 on failure
+ *----------------------------------------------------------------------*/
+static int open_acc_file(Acc2TaxDB* db, char* filename) {
+    db->acc_fp = fopen(filename, "r");
+    if (!db->acc_fp) {
+        log_message(db->log_fp, "Error: can't open %s\n", filename);
+        return 0;
+    }
+    fseek(db->acc_fp, 0, SEEK_END);
+    db->acc_file_size = ftell(db->acc_fp);
+    log_message(db->log_fp, "File size: %li\n", db->acc_file_size);
+
+    if (db->acc_file_size > 0) {
+        db->acc_map = mmap(NULL, db->acc_file_size, PROT_READ, MAP_SHARED, fileno(db->acc_fp), 0);
+        if (db->acc_map == MAP_FAILED) {
+            log_message(db->log_fp, "Warning: couldn't map %s, using stream lookups\n", filename);
+            db->acc_map = 0;
+        } else {
+            madvise(db->acc_map, db->acc_file_size, MADV_RANDOM);
+            if (db->huge_pages != ACC2TAX_PAGES_DEFAULT) {
+                madvise(db->acc_map, db->acc_file_size, MADV_HUGEPAGE);
+            }
+        }
+    }
+
+    return 1;
+}
+
+/*----------------------------------------------------------------------*
+ * Function:   close_acc_file
+ * Purpose:    Close accession file and index
+ * Parameters: db -> database handle
+ * Returns:    None
+ *----------------------------------------------------------------------*/
+static void close_acc_file(Acc2TaxDB* db) {
+    if (db->acc_map) {
+        munmap(db->acc_map, db->acc_file_size);
+    }
+    if (db->acc_fp) {
+        fclose(db->acc_fp);
+    }
+    if (db->index_fp) {
+        fclose(db->index_fp);
+    }
+    free(db->fences);
+    free(db->fence_keys);
+    release_table(db, db->hash_entries);
+    free(db->fallback_keys);
+    free(db->fallback_taxids);
+    free(db->cache_sets);
+    free(db->filter_blocks);
+
+    if (db->shards) {
+        int i;
+
+        for (i=0; i<db->shard_count; i++) {
+            acc2tax_close(db->shards[i].db);
+        }
+        free(db->shards);
+        pthread_mutex_destroy(&db->shard_mutex);
+    }
+}
+
+/*----------------------------------------------------------------------*
+ * Function:   load_accession_file
+ * Purpose:    Open the shard manifest if there is one, otherwise the
+ *             binary accession index if there is one, otherwise the
+ *             sorted accession text file. Shards are opened as needed.
+ * Parameters: db -> database handle
+ * Returns:    1 on success, 0 on failure
+ *----------------------------------------------------------------------*/
+static int load_accession_file(Acc2TaxDB* db)
+{
+    char index_filename[MAX_FILENAME];
+    char manifest_filename[MAX_FILENAME];
+    int opened;
+
+    get_accession_filenames(db->database_dir, db->is_protein, db->acc_filename, index_filename);
+    get_manifest_filename(db->database_dir, db->is_protein, manifest_filename);
+
+    opened = read_shard_manifest(db->log_fp, db->database_dir, manifest_filename, &db->shards, &db->shard_count);
+    if (opened < 0) {
+        return 0;
+    } else if (opened > 0) {
+        log_message(db->log_fp, "Opened shard manifest %s, %d shards\n", manifest_filename, db->shard_count);
+        pthread_mutex_init(&db->shard_mutex, NULL);
+        return 1;
+    }
+
+    opened = open_index_file(db, index_filename);
+    if (opened < 0) {
+        return 0;
+    } else if (opened > 0) {
+        log_message(db->log_fp, "Opened index file %s\n", index_filename);
+        return db->in_memory ? load_accession_hash(db) : load_accession_filter(db, index_filename);
+    } else if (db->in_memory) {
+        log_message(db->log_fp, "Error: in-memory lookups need a binary index - build one with --build-index\n");
+        return 0;
+    }
+
+    log_message(db->log_fp, "Opening database file %s\n", db->acc_filename);
+
+    if (!open_acc_file(db, db->acc_filename)) {
+        return 0;
+    }
+
+    if ((db->fence_interval > 0) && (db->acc_file_size > 0)) {
+        return load_fences(db);
+    }
+
+    return 1;
+}
+
+/*----------------------------------------------------------------------*
+ * Function:   compare_batch_queries
+ * Purpose:    qsort comparator ordering batch queries by accession
+ * Parameters: a, b -> pointers to BatchQuery
+ * Returns:    strcmp of the two accessions
+ *----------------------------------------------------------------------*/
+static int compare_batch_queries(const void* a, const void* b)
+{
+    return strcmp(((const BatchQuery*)a)->accession, ((const BatchQuery*)b)->accession);
+}
+
+/*----------------------------------------------------------------------*
+ * Function:   merge_batch_with_index
+ * Purpose:    Resolve sorted batch queries by reading each table of the
+ *             binary index from start to end in chunks. Queries sorted
+ *             by strcmp are also in key order within each table.
+ * Parameters: db -> database handle
+ *             queries -> queries sorted by accession
+ *             n = number of queries
+ *             taxids, found -> results, indexed by original position
+ * Returns:    1 on success, 0 on failure
+ *----------------------------------------------------------------------*/
+static int merge_batch_with_index(Acc2TaxDB* db, BatchQuery* queries, size_t n, unsigned int* taxids, int* found)
+{
+    char* keys = malloc((size_t)BATCH_CHUNK * MAX_KEY_WIDTH);
+    uint32_t* chunk_taxids = malloc(BATCH_CHUNK * sizeof(uint32_t));
+    int fd = fileno(db->index_fp);
+    int t;
+
+    if ((!keys) || (!chunk_taxids)) {
+        log_message(db->log_fp, "Error: couldn't allocate memory.\n");
+        free(keys);
+        free(chunk_taxids);
+        return 0;
+    }
+
+    for (t=0; t<2; t++) {
+        IndexTable* table = &db->index_tables[t];
+        uint32_t key_size = table->key_size;
+        uint64_t chunk_start = 0;
+        uint64_t chunk_size = 0;
+        uint64_t record = 0;
+        size_t q = 0;
+        IndexQuery query;
+
+        while ((q < n) && (record < table->count)) {
+            int similarity;
+
+            if (make_index_query(db, queries[q].accession, &query) != table) {
+                q++;
+                continue;
+            }
+
+            while (1) {
+                if (record >= chunk_start + chunk_size) {
+                    chunk_start = record;
+                    chunk_size = table->count - record;
+                    if (chunk_size > BATCH_CHUNK) {
+                        chunk_size = BATCH_CHUNK;
+                    }
+                    if ((pread(fd, keys, chunk_size * key_size, table->keys_offset + (chunk_start * key_size)) != chunk_size * key_size) ||
+                        (pread(fd, chunk_taxids, chunk_size * sizeof(uint32_t), table->taxids_offset + (chunk_start * sizeof(uint32_t))) != chunk_size * sizeof(uint32_t))) {
+                        log_message(db->log_fp, "Error: short read from index\n");
+                        free(keys);
+                        free(chunk_taxids);
+                        return 0;
+                    }
+                    add_stat(db, &db->stats.bytes_read, chunk_size * (key_size + sizeof(uint32_t)));
+                }
+
+                add_stat(db, &db->stats.probes, 1);
+                similarity = compare_index_query(table, keys + ((record - chunk_start) * key_size), &query);
+                if ((similarity >= 0) || (++record == table->count)) {
+                    break;
+                }
+            }
+
+            if (similarity == 0) {
+                found[queries[q].index] = 1;
+                taxids[queries[q].index] = chunk_taxids[record - chunk_start];
+            }
+            q++;
+        }
+    }
+
+    free(keys);
+    free(chunk_taxids);
+
+    return 1;
+}
+
+/*----------------------------------------------------------------------*
+ * Function:   merge_batch_with_text
+ * Purpose:    Resolve sorted batch queries by reading the sorted
+ *             accession text file from start to end. A separate stream
+ *             is opened so concurrent lookups are unaffected.
+ * Parameters: db -> database handle
+ *             queries -> queries sorted by accession
+ *             n = number of queries
+ *             taxids, found -> results, indexed by original position
+ * Returns:    1 on success, 0 on failure
+ *----------------------------------------------------------------------*/
+static int merge_batch_with_text(Acc2TaxDB* db, BatchQuery* queries, size_t n, unsigned int* taxids, int* found)
+{
+    char line[MAX_LINE_LENGTH];
+    char *accession = 0;
+    char *version;
+    long int taxid = 0;
+    long int gi;
+    size_t q = 0;
+    int have_record = 0;
+    FILE* fp;
+
+    fp = fopen(db->acc_filename, "r");
+    if (!fp) {
+        log_message(db->log_fp, "Error: can't open %s\n", db->acc_filename);
+        return 0;
+    }
+
+    while (q < n) {
+        int similarity;
+
+        if (!have_record) {
+            if (!fgets(line, MAX_LINE_LENGTH, fp)) {
+                break;
+            }
+            add_stat(db, &db->stats.bytes_read, strlen(line));
+            split_fields(line, &accession, &version, &taxid, &gi);
+            if (accession == NULL) {
+                continue;
+            }
+            have_record = 1;
+        }
+
+        add_stat(db, &db->stats.probes, 1);
+        similarity = strcmp(accession, queries[q].accession);
+        if (similarity < 0) {
+            have_record = 0;
+        } else {
+            if (similarity == 0) {
+                found[queries[q].index] = 1;
+                taxids[queries[q].index] = taxid;
+            }
+            q++;
+        }
+    }
+
+    fclose(fp);
+
+    return 1;
+}
+
+/*----------------------------------------------------------------------*
+ * Function:   search_index_async
+ * Purpose:    Binary search the index for a window of accessions at a
+ *             time. Each round asks the kernel to read ahead the next
+ *             probe of every search in the window, then makes the reads,
+ *             so a cold index sees many reads queued at once rather than
+ *             one search's reads one after another.
+ * Parameters: db -> database handle
+ *             accessions -> array of n accessions
+ *             n = number of accessions
+ *             taxids, found -> results
+ * Returns:    1 on success, 0 on failure
+ *----------------------------------------------------------------------*/
+static int search_index_async(Acc2TaxDB* db, const char** accessions, size_t n, unsigned int* taxids, int* found)
+{
+    AsyncSearch* searches = malloc(ASYNC_WINDOW * sizeof(AsyncSearch));
+    int fd = fileno(db->index_fp);
+    uint64_t probes = 0;
+    uint64_t bytes_read = 0;
+    size_t next = 0;
+    int active = 0;
+    int i;
+
+    if (!searches) {
+        log_message(db->log_fp, "Error: couldn't allocate memory.\n");
+        return 0;
+    }
+
+    while ((next < n) || (active > 0)) {
+        // Top up the window with new searches
+        while ((active < ASYNC_WINDOW) && (next < n)) {
+            AsyncSearch* search = &searches[active];
+
+            search->table = make_index_query(db, accessions[next], &search->query);
+            search->index = next++;
+            search->min = 0;
+            search->max = (int64_t)search->table->count - 1;
+            search->matched = 0;
+            search->prefetched = 0;
+            search->depth = 0;
+            if ((search->min <= search->max) && (filter_may_contain(db, accessions[search->index]))) {
+                active++;
+            }
+        }
+
+        for (i=0; i<active; i++) {
+            AsyncSearch* search = &searches[i];
+
+            IndexTable* table = search->table;
+            uint64_t span = (search->max - search->min + 1) * table->key_size;
+
+            if (search->matched) {
+                posix_fadvise(fd, table->taxids_offset + (search->current * sizeof(uint32_t)), sizeof(uint32_t), POSIX_FADV_WILLNEED);
+                continue;
+            }
+
+            // The first few probes are shared by every search so stay cached.
+            // Once the range left is small, read all of it ahead at once.
+            search->current = search->min + ((search->max - search->min) / 2);
+            if (search->depth++ < ASYNC_SHARED_PROBES) {
+                continue;
+            } else if (span <= ASYNC_READAHEAD) {
+                if (!search->prefetched) {
+                    posix_fadvise(fd, table->keys_offset + (search->min * table->key_size), span, POSIX_FADV_WILLNEED);
+                    search->prefetched = 1;
+                }
+            } else {
+                posix_fadvise(fd, table->keys_offset + (search->current * table->key_size), table->key_size, POSIX_FADV_WILLNEED);
+            }
+        }
+
+        // Advance each search by one read, removing those that finish
+        for (i=0; i<active; ) {
+            AsyncSearch* search = &searches[i];
+            IndexTable* table = search->table;
+            int done = 0;
+
+            if (search->matched) {
+                uint32_t taxid32;
+
+                if (pread(fd, &taxid32, sizeof(uint32_t), table->taxids_offset + (search->current * sizeof(uint32_t))) == sizeof(uint32_t)) {
+                    taxids[search->index] = taxid32;
+                    found[search->index] = 1;
+                    bytes_read += sizeof(uint32_t);
+                }
+                done = 1;
+            } else {
+                char probe[MAX_KEY_WIDTH];
+
+                if (pread(fd, probe, table->key_size, table->keys_offset + (search->current * table->key_size)) != table->key_size) {
+                    done = 1;
+                } else {
+                    int similarity = compare_index_query(table, probe, &search->query);
+
+                    probes++;
+                    bytes_read += table->key_size;
+                    if (similarity == 0) {
+                        search->matched = 1;
+                    } else if (similarity > 0) {
+                        search->max = search->current - 1;
+                    } else {
+                        search->min = search->current + 1;
+                    }
+                    done = search->min > search->max;
+                }
+            }
+
+            if (done) {
+                searches[i] = searches[--active];
+            } else {
+                i++;
+            }
+        }
+    }
+
+    free(searches);
+    add_stat(db, &db->stats.probes, probes);
+    add_stat(db, &db->stats.bytes_read, bytes_read);
+
+    return 1;
+}
+
+/*----------------------------------------------------------------------*
+ * Function:   search_fences_async
+ * Purpose:    Find a window of accessions at a time in the fenced text
+ *             file. The fence table gives each one's block, the kernel
+ *             is asked to read ahead all the window's blocks, then each
+ *             block is read and searched.
+ * Parameters: db -> database handle
+ *             accessions -> array of n accessions
+ *             n = number of accessions
+ *             taxids, found -> results
+ * Returns:    1 on success, 0 on failure
+ *----------------------------------------------------------------------*/
+static int search_fences_async(Acc2TaxDB* db, const char** accessions, size_t n, unsigned int* taxids, int* found)
+{
+    uint64_t starts[ASYNC_WINDOW];
+    uint64_t ends[ASYNC_WINDOW];
+    int has_block[ASYNC_WINDOW];
+    char* block = malloc(db->fence_interval + MAX_LINE_LENGTH + 1);
+    int fd = fileno(db->acc_fp);
+    uint64_t probes = 0;
+    uint64_t bytes_read = 0;
+    size_t first;
+
+    if (!block) {
+        log_message(db->log_fp, "Error: couldn't allocate memory.\n");
+        return 0;
+    }
+
+    for (first=0; first<n; first+=ASYNC_WINDOW) {
+        size_t count = n - first < ASYNC_WINDOW ? n - first : ASYNC_WINDOW;
+        size_t i;
+
+        for (i=0; i<count; i++) {
+            has_block[i] = find_fence_block(db, accessions[first + i], &starts[i], &ends[i], &probes);
+            if (has_block[i]) {
+                posix_fadvise(fd, starts[i], ends[i] - starts[i], POSIX_FADV_WILLNEED);
+            }
+        }
+
+        for (i=0; i<count; i++) {
+            long int taxid;
+            ssize_t got;
+            char* buffer = block;
+
+            if (!has_block[i]) {
+                continue;
+            }
+
+            // Fences are normally fence_interval apart, but a long record can stretch a block
+            if (ends[i] - starts[i] > db->fence_interval + MAX_LINE_LENGTH) {
+                buffer = malloc(ends[i] - starts[i] + 1);
+                if (!buffer) {
+                    log_message(db->log_fp, "Error: couldn't allocate memory.\n");
+                    free(block);
+                    return 0;
+                }
+            }
+
+            got = pread(fd, buffer, ends[i] - starts[i], starts[i]);
+            if (got > 0) {
+                bytes_read += got;
+                if (find_buffered_accession(buffer, got, accessions[first + i], &taxid, &probes)) {
+                    taxids[first + i] = taxid;
+                    found[first + i] = 1;
+                }
+            }
+            if (buffer != block) {
+                free(buffer);
+            }
+        }
+    }
+
+    free(block);
+    add_stat(db, &db->stats.probes, probes);
+    add_stat(db, &db->stats.bytes_read, bytes_read);
+
+    return 1;
+}
+
+/*----------------------------------------------------------------------*
+ * Function:   acc2tax_default_options
+ * Purpose:    Fill in default options - nucleotide accessions, logging
+ *             to stdout
+ * Parameters: options -> options to fill in
+ * Returns:    None
+ *----------------------------------------------------------------------*/
+void acc2tax_default_options(Acc2TaxOptions* options)
+{
+    memset(options, 0, sizeof(Acc2TaxOptions));
+    options->load_accessions = 1;
+    options->log_fp = stdout;
+}
+
+/*----------------------------------------------------------------------*
+ * Function:   apply_options
+ * Purpose:    Copy options into a new database handle
+ * Parameters: db -> database handle
+ *             options -> options
+ * Returns:    1 on success, 0 if an option is invalid
+ *----------------------------------------------------------------------*/
+static int apply_options(Acc2TaxDB* db, const Acc2TaxOptions* options)
+{
+    if (options->database_dir) {
+        if (strlen(options->database_dir) >= MAX_PATH - 32) {
+            log_message(options->log_fp, "Error: database directory name too long\n");
+            return 0;
+        }
+        strcpy(db->database_dir, options->database_dir);
+    }
+    db->is_protein = options->protein;
+    db->log_fp = options->log_fp;
+    db->fence_interval = options->fence_interval;
+    db->in_memory = options->in_memory;
+    db->collect_stats = options->collect_stats;
+    db->huge_pages = options->huge_pages;
+    db->numa_placement = options->numa_placement;
+    db->load_threads = options->load_threads > 0 ? options->load_threads : sysconf(_SC_NPROCESSORS_ONLN);
+    if (db->load_threads < 1) {
+        db->load_threads = 1;
+    } else if (db->load_threads > MAX_LOAD_THREADS) {
+        db->load_threads = MAX_LOAD_THREADS;
+    }
+    if (db->fence_interval > MAX_FENCE_INTERVAL) {
+        log_message(options->log_fp, "Error: fence interval can't be more than %d bytes\n", MAX_FENCE_INTERVAL);
+        return 0;
+    }
+    if ((db->huge_pages < ACC2TAX_PAGES_DEFAULT) || (db->huge_pages > ACC2TAX_PAGES_EXPLICIT) ||
+        (db->numa_placement < ACC2TAX_NUMA_DEFAULT) || (db->numa_placement > ACC2TAX_NUMA_REPLICATE)) {
+        log_message(options->log_fp, "Error: unknown huge page or NUMA placement option\n");
+        return 0;
+    }
+
+    return 1;
+}
+
+/*----------------------------------------------------------------------*
+ * Function:   open_accession_backend
+ * Purpose:    Open the accession file or index, and the lookup cache
+ * Parameters: db -> database handle
+ *             options -> options
+ * Returns:    1 on success, 0 on failure
+ *----------------------------------------------------------------------*/
+static int open_accession_backend(Acc2TaxDB* db, const Acc2TaxOptions* options)
+{
+    double start = get_seconds();
+    int loaded;
+
+    db->lookup_cache_size = options->lookup_cache_size;
+    loaded = load_accession_file(db);
+    db->stats.load_accessions_seconds = get_seconds() - start;
+
+    // The in-memory table is already a hash, so gains nothing. Shards
+    // get caches of their own.
+    if ((loaded) && (options->lookup_cache_size > 0) && (!db->hash_entries) && (!db->shards)) {
+        loaded = allocate_lookup_cache(db, options->lookup_cache_size);
+    }
+
+    return loaded;
+}
+
+/*----------------------------------------------------------------------*
+ * Function:   share_taxonomy
+ * Purpose:    Point a new handle at the taxonomy tables of another, which
+ *             must be closed after it
+ * Parameters: db -> new database handle
+ *             taxonomy -> handle to share taxonomy of
+ * Returns:    None
+ *----------------------------------------------------------------------*/
+static void share_taxonomy(Acc2TaxDB* db, Acc2TaxDB* taxonomy)
+{
+    strcpy(db->database_dir, taxonomy->database_dir);
+
+    db->shares_taxonomy = 1;
+    db->nodes = taxonomy->nodes;
+    db->nodes_size = taxonomy->nodes_size;
+    db->node_ranks = taxonomy->node_ranks;
+    memcpy(db->rank_names, taxonomy->rank_names, sizeof(db->rank_names));
+    db->rank_count = taxonomy->rank_count;
+    memcpy(db->standard_rank_of, taxonomy->standard_rank_of, sizeof(db->standard_rank_of));
+    db->rank_ancestors = taxonomy->rank_ancestors;
+    db->rank_ancestors_size = taxonomy->rank_ancestors_size;
+    db->euler_nodes = taxonomy->euler_nodes;
+    db->euler_depths = taxonomy->euler_depths;
+    db->euler_masks = taxonomy->euler_masks;
+    db->euler_size = taxonomy->euler_size;
+    db->euler_first = taxonomy->euler_first;
+    db->euler_first_size = taxonomy->euler_first_size;
+    db->block_minima = taxonomy->block_minima;
+    db->block_count = taxonomy->block_count;
+    db->block_levels = taxonomy->block_levels;
+    db->lineages = taxonomy->lineages;
+    db->name_arena = taxonomy->name_arena;
+    db->name_arena_size = taxonomy->name_arena_size;
+    db->name_arena_used = taxonomy->name_arena_used;
+    db->name_offsets = taxonomy->name_offsets;
+    db->name_offsets_size = taxonomy->name_offsets_size;
+}
+
+/*----------------------------------------------------------------------*
+ * Function:   acc2tax_open
+ * Purpose:    Load databases and return a handle to them
+ * Parameters: options -> what to load
+ * Returns:    Database handle, or NULL on failure
+ *----------------------------------------------------------------------*/
+Acc2TaxDB* acc2tax_open(const Acc2TaxOptions* options)
+{
+    Acc2TaxDB* db = calloc(1, sizeof(Acc2TaxDB));
+    double start;
+    int loaded;
+
+    if (!db) {
+        log_message(options->log_fp, "Error: couldn't allocate memory.\n");
+        return NULL;
+    }
+
+    if (!apply_options(db, options)) {
+        free(db);
+        return NULL;
+    }
+
+    if (options->snapshot_filename) {
+        start = get_seconds();
+        loaded = load_snapshot(db, options->snapshot_filename, options->load_gi);
+        db->stats.load_snapshot_seconds = get_seconds() - start;
+    } else {
+        start = get_seconds();
+        loaded = allocate_memory(db);
+        db->stats.allocate_seconds = get_seconds() - start;
+        loaded = loaded && load_dmp_files(db, options->load_gi);
+    }
+
+    if ((loaded) && (options->load_accessions)) {
+        loaded = open_accession_backend(db, options);
+    }
+
+    loaded = loaded && allocate_lineage_cache(db);
+
+    start = get_seconds();
+    if (loaded) {
+        map_standard_ranks(db);
+        if (options->rank_table) {
+            loaded = build_rank_table(db);
+        }
+        if ((loaded) && (options->lca_table)) {
+            loaded = build_lca_table(db);
+        }
+        if (loaded) {
+            place_tables(db);
+        }
+    }
+
+    if (!loaded) {
+        acc2tax_close(db);
+        return NULL;
+    }
+
+    if (options->precompute_lineages) {
+        precompute_all_lineages(db);
+    }
+    db->stats.build_tables_seconds = get_seconds() - start;
+
+    return db;
+}
+
+/*----------------------------------------------------------------------*
+ * Function:   acc2tax_open_shared
+ * Purpose:    Open a GI table and/or accession file for lookups, using
+ *             the taxonomy already loaded by another handle rather than
+ *             loading it again. Lets nucleotide and protein lookups share
+ *             one taxonomy. The taxonomy handle must be closed last.
+ * Parameters: taxonomy -> handle to share taxonomy of
+ *             options -> what to load - database_dir, snapshot and
+ *                        taxonomy table options are ignored
+ * Returns:    Database handle, or NULL on failure
+ *----------------------------------------------------------------------*/
+Acc2TaxDB* acc2tax_open_shared(Acc2TaxDB* taxonomy, const Acc2TaxOptions* options)
+{
+    Acc2TaxDB* db = calloc(1, sizeof(Acc2TaxDB));
+    double start;
+    int loaded = 1;
+
+    if (!db) {
+        log_message(options->log_fp, "Error: couldn't allocate memory.\n");
+        return NULL;
+    }
+
+    if (!apply_options(db, options)) {
+        free(db);
+        return NULL;
+    }
+    share_taxonomy(db, taxonomy);
+
+    if (options->load_gi) {
+        start = get_seconds();
+        loaded = load_gi_to_node_list(db);
+        db->stats.load_gi_seconds = get_seconds() - start;
+    }
+
+    if ((loaded) && (options->load_accessions)) {
+        loaded = open_accession_backend(db, options);
+    }
+
+    if (!loaded) {
+        acc2tax_close(db);
+        return NULL;
+    }
+
+    place_tables(db);
+
+    return db;
+}
+
+/*----------------------------------------------------------------------*
+ * Function:   open_shard
+ * Purpose:    Open the index of a shard as a handle sharing the
+ *             taxonomy and options of the sharded handle
+ * Parameters: db -> sharded database handle
+ *             shard -> shard to open
+ * Returns:    Shard handle, or NULL on failure
+ *----------------------------------------------------------------------*/
+static Acc2TaxDB* open_shard(Acc2TaxDB* db, ShardEntry* shard)
+{
+    Acc2TaxDB* shard_db = calloc(1, sizeof(Acc2TaxDB));
+    double start = get_seconds();
+    int opened;
+
+    if (!shard_db) {
+        log_message(db->log_fp, "Error: couldn't allocate memory.\n");
+        return NULL;
+    }
+
+    share_taxonomy(shard_db, db);
+    shard_db->is_protein = db->is_protein;
+    shard_db->log_fp = db->log_fp;
+    shard_db->load_threads = db->load_threads;
+    shard_db->in_memory = db->in_memory;
+    shard_db->collect_stats = db->collect_stats;
+    shard_db->huge_pages = db->huge_pages;
+    shard_db->numa_placement = db->numa_placement;
+
+    opened = open_index_file(shard_db, shard->filename);
+    if (opened == 0) {
+        log_message(db->log_fp, "Error: can't open shard %s\n", shard->filename);
+    } else if (opened > 0) {
+        log_message(db->log_fp, "Opened shard %s\n", shard->filename);
+        if (db->in_memory) {
+            opened = load_accession_hash(shard_db);
+        } else {
+            opened = load_accession_filter(shard_db, shard->filename);
+            if ((opened) && (db->lookup_cache_size > 0)) {
+                opened = allocate_lookup_cache(shard_db, db->lookup_cache_size);
+            }
+        }
+    }
+
+    if (opened <= 0) {
+        acc2tax_close(shard_db);
+        return NULL;
+    }
+
+    place_tables(shard_db);
+    shard_db->stats.load_accessions_seconds = get_seconds() - start;
+
+    return shard_db;
+}
+
+/*----------------------------------------------------------------------*
+ * Function:   get_shard
+ * Purpose:    Return the handle of a shard, opening it the first time it
+ *             is needed. A shard that fails to open isn't tried again.
+ * Parameters: db -> sharded database handle
+ *             index = shard number
+ * Returns:    Shard handle, or NULL if it couldn't be opened
+ *----------------------------------------------------------------------*/
+static Acc2TaxDB* get_shard(Acc2TaxDB* db, int index)
+{
+    ShardEntry* shard = &db->shards[index];
+    Acc2TaxDB* shard_db = __atomic_load_n(&shard->db, __ATOMIC_ACQUIRE);
+
+    if ((shard_db) || (__atomic_load_n(&shard->failed, __ATOMIC_RELAXED))) {
+        return shard_db;
+    }
+
+    pthread_mutex_lock(&db->shard_mutex);
+    shard_db = shard->db;
+    if ((!shard_db) && (!shard->failed)) {
+        shard_db = open_shard(db, shard);
+        if (shard_db) {
+            __atomic_add_fetch(&db->memory_required, shard_db->memory_required, __ATOMIC_RELAXED);
+            __atomic_store_n(&shard->db, shard_db, __ATOMIC_RELEASE);
+        } else {
+            __atomic_store_n(&shard->failed, 1, __ATOMIC_RELAXED);
+        }
+    }
+    pthread_mutex_unlock(&db->shard_mutex);
+
+    return shard_db;
+}
+
+/*----------------------------------------------------------------------*
+ * Function:   find_shard
+ * Purpose:    Find which shard holds an accession - the last whose first
+ *             key is not after it
+ * Parameters: db -> sharded database handle
+ *             accession -> accession
+ * Returns:    Shard number
+ *----------------------------------------------------------------------*/
+static int find_shard(Acc2TaxDB* db, const char* accession)
+{
+    int min = 0;
+    int max = db->shard_count - 1;
+
+    while (min < max) {
+        int mid = (min + max + 1) / 2;
+
+        if (strcmp(db->shards[mid].first_key, accession) <= 0) {
+            min = mid;
+        } else {
+            max = mid - 1;
+        }
+    }
+
+    return min;
+}
+
+/*----------------------------------------------------------------------*
+ * Function:   lookup_sharded_accessions
+ * Purpose:    Group a batch of accessions by shard and look up each group
+ *             in its shard, so only the shards the batch touches are
+ *             opened
+ * Parameters: db -> sharded database handle
+ *             accessions -> array of n accessions
+ *             n = number of accessions
+ *             taxids, found -> arrays of n to store results
+ *             method = batch method to use within each shard
+ * Returns:    1 on success, 0 if memory couldn't be allocated
+ *----------------------------------------------------------------------*/
+static int lookup_sharded_accessions(Acc2TaxDB* db, const char** accessions, size_t n, unsigned int* taxids, int* found, int method)
+{
+    size_t* starts = calloc(db->shard_count + 1, sizeof(size_t));
+    size_t* next = malloc((db->shard_count + 1) * sizeof(size_t));
+    size_t* order = malloc((n + 1) * sizeof(size_t));
+    int* shard_of = malloc((n + 1) * sizeof(int));
+    const char** shard_accessions = malloc((n + 1) * sizeof(const char*));
+    unsigned int* shard_taxids = malloc((n + 1) * sizeof(unsigned int));
+    int* shard_found = malloc((n + 1) * sizeof(int));
+    int looked_up = 0;
+    size_t i;
+    int s;
+
+    if ((starts) && (next) && (order) && (shard_of) && (shard_accessions) && (shard_taxids) && (shard_found)) {
+        for (i=0; i<n; i++) {
+            shard_of[i] = find_shard(db, accessions[i]);
+            starts[shard_of[i] + 1]++;
+        }
+        for (s=0; s<db->shard_count; s++) {
+            starts[s + 1] += starts[s];
+            next[s] = starts[s];
+        }
+        for (i=0; i<n; i++) {
+            order[next[shard_of[i]]++] = i;
+        }
+
+        for (s=0; s<db->shard_count; s++) {
+            size_t first = starts[s];
+            size_t count = starts[s + 1] - first;
+            Acc2TaxDB* shard_db;
+
+            if (count == 0) {
+                continue;
+            }
+
+            for (i=first; i<first + count; i++) {
+                shard_accessions[i] = accessions[order[i]];
+            }
+
+            shard_db = get_shard(db, s);
+            if (shard_db) {
+                acc2tax_lookup_accessions(shard_db, shard_accessions + first, count, shard_taxids + first, shard_found + first, method);
+            } else {
+                memset(shard_taxids + first, 0, count * sizeof(unsigned int));
+                memset(shard_found + first, 0, count * sizeof(int));
+                add_stat(db, &db->stats.accession_lookups, count);
+            }
+
+            for (i=first; i<first + count; i++) {
+                taxids[order[i]] = shard_taxids[i];
+                found[order[i]] = shard_found[i];
+            }
+        }
+        looked_up = 1;
+    } else {
+        log_message(db->log_fp, "Error: couldn't allocate memory.\n");
+    }
+
+    free(starts);
+    free(next);
+    free(order);
+    free(shard_of);
+    free(shard_accessions);
+    free(shard_taxids);
+    free(shard_found);
+
+    return looked_up;
+}
+
+/*----------------------------------------------------------------------*
+ * Function:   acc2tax_close
+ * Purpose:    Free everything held by a database handle
+ * Parameters: db -> database handle
+ * Returns:    None
+ *----------------------------------------------------------------------*/
+void acc2tax_close(Acc2TaxDB* db)
+{
+    unsigned int i;
+
+    if (!db) {
+        return;
+    }
+
+    close_acc_file(db);
+
+    if (db->gi_pages) {
+        for (i=0; i<db->gi_directory_size; i++) {
+            release_table(db, db->gi_pages[i]);
+        }
+        release_table(db, db->gi_pages);
+    }
+
+    if (!db->shares_taxonomy) {
+        release_table(db, db->rank_ancestors);
+        release_table(db, db->euler_nodes);
+        release_table(db, db->euler_depths);
+        release_table(db, db->euler_masks);
+        release_table(db, db->euler_first);
+        release_table(db, db->block_minima);
+
+        if (db->lineages) {
+            for (i=0; i<db->nodes_size; i++) {
+                free(db->lineages[i]);
+            }
+            free(db->lineages);
+        }
+
+        release_table(db, db->nodes);
+        release_table(db, db->node_ranks);
+        release_table(db, db->name_offsets);
+        release_table(db, db->name_arena);
+
+        if (db->snapshot_map) {
+            munmap(db->snapshot_map, db->snapshot_size);
+        }
+    }
+
+    for (i=0; i<(unsigned int)db->placed_count; i++) {
+        munmap(db->placed_tables[i].data, db->placed_tables[i].size);
+    }
+    free(db->cpu_replicas);
+
+    free(db);
+}
+
+/*----------------------------------------------------------------------*
+ * Function:   acc2tax_lookup_accession
+ * Purpose:    Find taxid of an accession
+ * Parameters: db -> database handle
+ *             accession -> accession to find
+ *             taxid -> to store taxid (0 if database has no taxid)
+ * Returns:    1 if found, 0 otherwise
+ *----------------------------------------------------------------------*/
+int acc2tax_lookup_accession(Acc2TaxDB* db, const char* accession, unsigned int* taxid)
+{
+    char buffer[1024];
+    char *found_accession;
+    char *version;
+    long int found_taxid = 0;
+    long int gi;
+    PackedKey key;
+    int cached = (db->cache_sets) && (accession[0] != 0) && (pack_accession(accession, &key));
+    int found;
+
+    if (db->shards) {
+        Acc2TaxDB* shard_db = get_shard(db, find_shard(db, accession));
+
+        if (shard_db) {
+            return acc2tax_lookup_accession(shard_db, accession, taxid);
+        }
+        *taxid = 0;
+        add_stat(db, &db->stats.accession_lookups, 1);
+        return 0;
+    }
+
+    // Definite misses skip the cache and the search
+    if (!filter_may_contain(db, accession)) {
+        *taxid = 0;
+        add_stat(db, &db->stats.accession_lookups, 1);
+        return 0;
+    }
+
+    if ((cached) && (find_cached_accession(db, &key, &found_taxid, &found))) {
+        *taxid = found ? found_taxid : 0;
+        add_stat(db, &db->stats.accession_lookups, 1);
+        add_stat(db, &db->stats.accessions_found, found);
+        add_stat(db, &db->stats.cache_hits, 1);
+        return found;
+    }
+
+    if (db->hash_entries) {
+        found = find_hashed_accession(db, accession, &found_taxid);
+    } else if (db->index_fp) {
+        found = find_indexed_accession(db, accession, &found_taxid);
+    } else if (db->fences) {
+        found = find_fenced_accession(db, accession, &found_taxid);
+    } else if (db->acc_map) {
+        found = find_mapped_accession(db, accession, &found_taxid);
+    } else if (db->acc_fp) {
+        found = find_accession(db, accession, buffer, &found_accession, &version, &found_taxid, &gi);
+    } else {
+        found = 0;
+    }
+
+    *taxid = found ? found_taxid : 0;
+    add_stat(db, &db->stats.accession_lookups, 1);
+    add_stat(db, &db->stats.accessions_found, found);
+
+    if (cached) {
+        add_cached_accession(db, &key, *taxid, found);
+        add_stat(db, &db->stats.cache_misses, 1);
+    }
+
+    return found;
+}
+
+/*----------------------------------------------------------------------*
+ * Function:   acc2tax_lookup_accessions
+ * Purpose:    Find taxids of an array of accessions. With
+ *             ACC2TAX_BATCH_MERGE the accessions are sorted and resolved
+ *             in one sequential pass of the database, which suits large
+ *             batches. ACC2TAX_BATCH_ASYNC keeps many searches of the
+ *             index or fenced text file in flight at once, which suits
+ *             a database not in the page cache. ACC2TAX_BATCH_SEARCH
+ *             searches for each in turn. A sharded index is searched a
+ *             shard at a time, with the method applied within each.
+ * Parameters: db -> database handle
+ *             accessions -> array of n accessions
+ *             n = number of accessions
+ *             taxids -> array of n to store taxids
+ *             found -> array of n to store 1 if found, 0 if not (or NULL)
+ *             method = ACC2TAX_BATCH_SEARCH, ACC2TAX_BATCH_MERGE or
+ *                      ACC2TAX_BATCH_ASYNC
+ * Returns:    Number of accessions found
+ *----------------------------------------------------------------------*/
+size_t acc2tax_lookup_accessions(Acc2TaxDB* db, const char** accessions, size_t n, unsigned int* taxids, int* found, int method)
+{
+    int* found_flags = found ? found : calloc(n + 1, sizeof(int));
+    size_t count = 0;
+    int sharded = 0;
+    int batched = 0;
+    size_t i;
+
+    if (!found_flags) {
+        log_message(db->log_fp, "Error: couldn't allocate memory.\n");
+        return 0;
+    }
+
+    for (i=0; i<n; i++) {
+        taxids[i] = 0;
+        found_flags[i] = 0;
+    }
+
+    // Shards count their own lookups
+    if (db->shards) {
+        sharded = lookup_sharded_accessions(db, accessions, n, taxids, found_flags, method);
+    } else if ((method == ACC2TAX_BATCH_MERGE) && (!db->hash_entries) && ((db->index_fp) || (db->acc_fp))) {
+        BatchQuery* queries = malloc((n + 1) * sizeof(BatchQuery));
+
+        if (!queries) {
+            log_message(db->log_fp, "Error: couldn't allocate memory.\n");
+        } else {
+            size_t n_queries = 0;
+
+            for (i=0; i<n; i++) {
+                if (filter_may_contain(db, accessions[i])) {
+                    queries[n_queries].accession = accessions[i];
+                    queries[n_queries].index = i;
+                    n_queries++;
+                }
+            }
+            qsort(queries, n_queries, sizeof(BatchQuery), compare_batch_queries);
+
+            if (db->index_fp) {
+                merge_batch_with_index(db, queries, n_queries, taxids, found_flags);
+            } else {
+                merge_batch_with_text(db, queries, n_queries, taxids, found_flags);
+            }
+            free(queries);
+            batched = 1;
+        }
+    } else if ((method == ACC2TAX_BATCH_ASYNC) && (!db->hash_entries) && ((db->index_fp) || (db->fences))) {
+        if (db->index_fp) {
+            batched = search_index_async(db, accessions, n, taxids, found_flags);
+        } else {
+            batched = search_fences_async(db, accessions, n, taxids, found_flags);
+        }
+    }
+
+    if ((!batched) && (!sharded)) {
+        for (i=0; i<n; i++) {
+            found_flags[i] = acc2tax_lookup_accession(db, accessions[i], &taxids[i]);
+        }
+    }
+
+    for (i=0; i<n; i++) {
+        count += found_flags[i];
+    }
+
+    // Single lookups count themselves
+    if (batched) {
+        add_stat(db, &db->stats.accession_lookups, n);
+        add_stat(db, &db->stats.accessions_found, count);
+    }
+
+    if (!found) {
+        free(found_flags);
+    }
+
+    return count;
+}
+
+/*----------------------------------------------------------------------*
+ * Function:   acc2tax_lookup_gi
+ * Purpose:    Find taxid of a GI
+ * Parameters: db -> database handle
+ *             gi = GI to find
+ *             taxid -> to store taxid
+ * Returns:    1 if found, 0 otherwise
+ *----------------------------------------------------------------------*/
+int acc2tax_lookup_gi(Acc2TaxDB* db, unsigned int gi, unsigned int* taxid)
+{
+    *taxid = get_gi_node(db, gi);
+    add_stat(db, &db->stats.gi_lookups, 1);
+    add_stat(db, &db->stats.gis_found, *taxid != 0);
+
+    return *taxid != 0;
+}
+
+/*----------------------------------------------------------------------*
+ * Function:   acc2tax_lineage
+ * Purpose:    Return comma separated lineage of a taxid, root first.
+ *             The string is cached and owned by the database handle.
+ * Parameters: db -> database handle
+ *             taxid = taxid
+ *             length -> to store length of lineage (or NULL)
+ * Returns:    Pointer to lineage, or NULL if taxid is out of range
+ *----------------------------------------------------------------------*/
+const char* acc2tax_lineage(Acc2TaxDB* db, unsigned int taxid, size_t* length)
+{
+    Lineage* lineage = get_lineage(db, taxid);
+
+    if (!lineage) {
+        return NULL;
+    }
+
+    if (length) {
+        *length = lineage->length;
+    }
+
+    return lineage->string;
+}
+
+/*----------------------------------------------------------------------*
+ * Function:   acc2tax_name
+ * Purpose:    Return scientific name of a taxid
+ * Parameters: db -> database handle
+ *             taxid = taxid
+ * Returns:    Pointer to name, or NULL if it has none
+ *----------------------------------------------------------------------*/
+const char* acc2tax_name(Acc2TaxDB* db, unsigned int taxid)
+{
+    return get_name(db, taxid);
+}
+
+/*----------------------------------------------------------------------*
+ * Function:   acc2tax_parent
+ * Purpose:    Return parent of a taxid
+ * Parameters: db -> database handle
+ *             taxid = taxid
+ * Returns:    Parent taxid, or 0 if unknown
+ *----------------------------------------------------------------------*/
+unsigned int acc2tax_parent(Acc2TaxDB* db, unsigned int taxid)
+{
+    if (taxid >= db->nodes_size) {
+        return 0;
+    }
+
+    return db->nodes[taxid];
+}
+
+/*----------------------------------------------------------------------*
+ * Function:   acc2tax_find_rank
+ * Purpose:    Find the number of a standard rank (domain, superkingdom,
+ *             kingdom, phylum, class, order, family, genus, species)
+ * Parameters: rank -> rank name
+ * Returns:    Rank number, or -1 if not a standard rank
+ *----------------------------------------------------------------------*/
+int acc2tax_find_rank(const char* rank)
+{
+    int i;
+
+    for (i=0; i<STANDARD_RANK_COUNT; i++) {
+        if (strcmp(standard_ranks[i], rank) == 0) {
+            return i;
+        }
+    }
+
+    return -1;
+}
+
+/*----------------------------------------------------------------------*
+ * Function:   acc2tax_rank
+ * Purpose:    Get the rank of a node
+ * Parameters: db -> database handle
+ *             taxid = node ID
+ * Returns:    Rank name, or an empty string if not known
+ *----------------------------------------------------------------------*/
+const char* acc2tax_rank(Acc2TaxDB* db, unsigned int taxid)
+{
+    if (taxid >= db->nodes_size) {
+        return db->rank_names[0];
+    }
+
+    return db->rank_names[db->node_ranks[taxid]];
+}
+
+/*----------------------------------------------------------------------*
+ * Function:   acc2tax_rank_ancestor
+ * Purpose:    Find the node at a standard rank in the lineage of a node.
+ *             Uses the rank table if it was built, otherwise walks up
+ *             the tree.
+ * Parameters: db -> database handle
+ *             taxid = node ID
+ *             rank = standard rank number from acc2tax_find_rank
+ * Returns:    Node ID, or 0 if the lineage has no node of that rank
+ *----------------------------------------------------------------------*/
+unsigned int acc2tax_rank_ancestor(Acc2TaxDB* db, unsigned int taxid, int rank)
+{
+    int depth = 0;
+
+    if ((rank < 0) || (rank >= STANDARD_RANK_COUNT)) {
+        return 0;
+    }
+
+    if (db->rank_ancestors) {
+        if (taxid >= db->rank_ancestors_size) {
+            return 0;
+        }
+        return db->rank_ancestors[((size_t)taxid * STANDARD_RANK_COUNT) + rank];
+    }
+
+    while ((taxid >= 1) && (taxid < db->nodes_size) && (depth++ < MAX_LINEAGE_DEPTH)) {
+        if (db->standard_rank_of[db->node_ranks[taxid]] == rank) {
+            return taxid;
+        }
+        taxid = db->nodes[taxid] == taxid ? 0 : db->nodes[taxid];
+    }
+
+    return 0;
+}
+
+/*----------------------------------------------------------------------*
+ * Function:   acc2tax_lca
+ * Purpose:    Find the lowest common ancestor of two nodes. Uses the LCA
+ *             table if it was built, otherwise walks up the tree.
+ * Parameters: db -> database handle
+ *             a, b = node IDs
+ * Returns:    Node ID of common ancestor, or 0 if either node is unknown
+ *             or they have no common ancestor
+ *----------------------------------------------------------------------*/
+unsigned int acc2tax_lca(Acc2TaxDB* db, unsigned int a, unsigned int b)
+{
+    uint32_t left;
+    uint32_t right;
+    uint32_t best;
+
+    if (!db->euler_nodes) {
+        return find_lca_by_walking(db, a, b);
+    }
+
+    if ((a >= db->euler_first_size) || (b >= db->euler_first_size) ||
+        (db->euler_first[a] == LCA_NONE) || (db->euler_first[b] == LCA_NONE)) {
+        return 0;
+    }
+
+    left = db->euler_first[a];
+    right = db->euler_first[b];
+    if (left > right) {
+        best = left;
+        left = right;
+        right = best;
+    }
+
+    if ((left >> LCA_BLOCK_BITS) == (right >> LCA_BLOCK_BITS)) {
+        best = euler_block_min(db, left, right);
+    } else {
+        uint64_t first_block = (left >> LCA_BLOCK_BITS) + 1;
+        uint64_t last_block = right >> LCA_BLOCK_BITS;
+
+        best = euler_min(db, euler_block_min(db, left, (first_block << LCA_BLOCK_BITS) - 1), euler_block_min(db, last_block << LCA_BLOCK_BITS, right));
+        if (first_block < last_block) {
+            int level = 63 - __builtin_clzll(last_block - first_block);
+            uint32_t* minima = db->block_minima + (level * db->block_count);
+
+            best = euler_min(db, best, euler_min(db, minima[first_block], minima[last_block - ((uint64_t)1 << level)]));
+        }
+    }
+
+    return db->euler_nodes[best];
+}
+
+/*----------------------------------------------------------------------*
+ * Function:   acc2tax_node_count
+ * Purpose:    Get the size of the node table
+ * Parameters: db -> database handle
+ * Returns:    One more than the highest node ID that can be stored
+ *----------------------------------------------------------------------*/
+unsigned int acc2tax_node_count(Acc2TaxDB* db)
+{
+    return db->nodes_size;
+}
+
+/*----------------------------------------------------------------------*
+ * Function:   acc2tax_memory_required
+ * Purpose:    Return memory used by loaded tables
+ * Parameters: db -> database handle
+ * Returns:    Bytes
+ *----------------------------------------------------------------------*/
+long int acc2tax_memory_required(Acc2TaxDB* db)
+{
+    return db->memory_required;
+}
+
+/*----------------------------------------------------------------------*
+ * Function:   acc2tax_get_stats
+ * Purpose:    Copy load times and lookup counters. Lookups still running
+ *             in other threads may not be included.
+ * Parameters: db -> database handle
+ *             stats -> to store statistics
+ * Returns:    None
+ *----------------------------------------------------------------------*/
+void acc2tax_get_stats(Acc2TaxDB* db, Acc2TaxStats* stats)
+{
+    *stats = db->stats;
+    stats->accession_lookups = __atomic_load_n(&db->stats.accession_lookups, __ATOMIC_RELAXED);
+    stats->accessions_found = __atomic_load_n(&db->stats.accessions_found, __ATOMIC_RELAXED);
+    stats->gi_lookups = __atomic_load_n(&db->stats.gi_lookups, __ATOMIC_RELAXED);
+    stats->gis_found = __atomic_load_n(&db->stats.gis_found, __ATOMIC_RELAXED);
+    stats->probes = __atomic_load_n(&db->stats.probes, __ATOMIC_RELAXED);
+    stats->bytes_read = __atomic_load_n(&db->stats.bytes_read, __ATOMIC_RELAXED);
+    stats->cache_hits = __atomic_load_n(&db->stats.cache_hits, __ATOMIC_RELAXED);
+    stats->cache_misses = __atomic_load_n(&db->stats.cache_misses, __ATOMIC_RELAXED);
+    stats->filter_rejects = __atomic_load_n(&db->stats.filter_rejects, __ATOMIC_RELAXED);
+
+    if (db->shards) {
+        Acc2TaxStats shard_stats;
+        int i;
+
+        for (i=0; i<db->shard_count; i++) {
+            Acc2TaxDB* shard_db = __atomic_load_n(&db->shards[i].db, __ATOMIC_ACQUIRE);
+
+            if (shard_db) {
+                acc2tax_get_stats(shard_db, &shard_stats);
+                stats->load_accessions_seconds += shard_stats.load_accessions_seconds;
+                stats->accession_lookups += shard_stats.accession_lookups;
+                stats->accessions_found += shard_stats.accessions_found;
+                stats->probes += shard_stats.probes;
+                stats->bytes_read += shard_stats.bytes_read;
+                stats->cache_hits += shard_stats.cache_hits;
+                stats->cache_misses += shard_stats.cache_misses;
+                stats->filter_rejects += shard_stats.filter_rejects;
+                stats->placed_bytes += shard_stats.placed_bytes;
+            }
+        }
+    }
+}
+
+/*----------------------------------------------------------------------*
+ * Function:   acc2tax_shard_count
+ * Purpose:    Return number of shards the accession index is split into
+ * Parameters: db -> database handle
+ * Returns:    Number of shards, or 0 if the index isn't sharded
+ *----------------------------------------------------------------------*/
+int acc2tax_shard_count(Acc2TaxDB* db)
+{
+    return db->shard_count;
+}
+
+/*----------------------------------------------------------------------*
+ * Function:   acc2tax_shard_of
+ * Purpose:    Find which shard would hold an accession, without opening
+ *             any shard. Lets a batch be split among workers that each
+ *             hold different shards.
+ * Parameters: db -> database handle
+ *             accession -> accession
+ * Returns:    Shard number, or -1 if the index isn't sharded
+ *----------------------------------------------------------------------*/
+int acc2tax_shard_of(Acc2TaxDB* db, const char* accession)
+{
+    return db->shards ? find_shard(db, accession) : -1;
+}